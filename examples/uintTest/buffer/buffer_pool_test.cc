@@ -11,10 +11,146 @@
 #include <signal.h>
 
 #include <string>
+#include <thread>
 
 #include "buffer.h"
 #include "utils.h"
 
+#define POOL_BUFFER_SIZE 1024
+
+// Not assert, the calls checked have side effects.
+#define CHECK(cond)                                                            \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      LOG("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);             \
+      exit(1);                                                                 \
+    }                                                                          \
+  } while (0)
+
+static void test_elastic_pool() {
+  const int min_cnt = 1, max_cnt = 4, idle_ms = 100;
+  easymedia::BufferPool pool(min_cnt, max_cnt, POOL_BUFFER_SIZE,
+                             easymedia::MediaBuffer::MemType::MEM_COMMON,
+                             idle_ms);
+  easymedia::BufferPoolStats stats;
+  pool.GetStats(stats);
+  CHECK(stats.total == min_cnt && stats.in_use == 0);
+
+  // grows on demand up to max_cnt
+  std::list<std::shared_ptr<easymedia::MediaBuffer>> lent;
+  for (int i = 0; i < max_cnt; i++) {
+    auto mb = pool.GetBuffer(false);
+    CHECK(mb && mb->GetSize() >= POOL_BUFFER_SIZE);
+    lent.push_back(mb);
+  }
+  CHECK(!pool.GetBuffer(false));
+  pool.GetStats(stats);
+  CHECK(stats.total == max_cnt && stats.in_use == max_cnt);
+  CHECK(stats.peak_in_use == max_cnt && stats.grown == max_cnt - min_cnt);
+  lent.clear();
+
+  // shrinks back to min_cnt once the buffers were idle for idle_ms
+  for (int i = 0; i < 10; i++) {
+    easymedia::msleep(idle_ms + 20);
+    pool.GetBuffer(false).reset();
+    pool.GetStats(stats);
+    if (stats.total == min_cnt)
+      break;
+  }
+  CHECK(stats.total == min_cnt && stats.in_use == 0);
+  CHECK(stats.shrunk == max_cnt - min_cnt);
+}
+
+static void test_pool_drain() {
+  easymedia::BufferPool pool(2, POOL_BUFFER_SIZE,
+                             easymedia::MediaBuffer::MemType::MEM_COMMON);
+  CHECK(pool.Drain(0) == 0);
+
+  // times out while a buffer is lent
+  auto mb = pool.GetBuffer();
+  CHECK(mb);
+  int64_t begin = easymedia::gettimeofday();
+  CHECK(pool.Drain(50) == 1);
+  CHECK(easymedia::gettimeofday() - begin >= 45 * 1000);
+
+  // drained by the release of another thread
+  std::thread releaser([&mb] {
+    easymedia::msleep(50);
+    mb.reset();
+  });
+  CHECK(pool.Drain(5000) == 0);
+  releaser.join();
+  easymedia::BufferPoolStats stats;
+  pool.GetStats(stats);
+  CHECK(stats.in_use == 0 && stats.total == 2);
+}
+
+static void test_release_after_pool() {
+  easymedia::MemAccountStats before, after;
+  easymedia::GetMemAccountStats(easymedia::MediaBuffer::MemType::MEM_COMMON,
+                                before);
+  auto pool = new easymedia::BufferPool(
+      2, POOL_BUFFER_SIZE, easymedia::MediaBuffer::MemType::MEM_COMMON);
+  auto mb = pool->GetBuffer();
+  CHECK(mb);
+  delete pool;
+
+  // the buffer lent outlives the pool, the free one is gone already
+  easymedia::GetMemAccountStats(easymedia::MediaBuffer::MemType::MEM_COMMON,
+                                after);
+  CHECK(after.cnt == before.cnt + 1);
+  memset(mb->GetPtr(), 0x5a, mb->GetSize());
+  mb.reset();
+  easymedia::GetMemAccountStats(easymedia::MediaBuffer::MemType::MEM_COMMON,
+                                after);
+  CHECK(after.cnt == before.cnt && after.bytes == before.bytes);
+}
+
+// A device writes the pooled buffer, the cpu reads it and gives it back, as
+// rga into a buffer of the pool for a reader of the cpu.
+static void device_to_cpu_reader(easymedia::BufferPool &pool) {
+  auto mb = pool.GetBuffer();
+  CHECK(mb);
+  mb->BeginDeviceAccess(false);
+  mb->EndDeviceAccess(false);
+  volatile uint8_t *p = static_cast<uint8_t *>(mb->GetPtr());
+  (void)p[0];
+}
+
+static bool test_cache_sync() {
+  easymedia::BufferPool pool(1, POOL_BUFFER_SIZE,
+                             easymedia::MediaBuffer::MemType::MEM_HARD_WARE);
+  auto mb = pool.GetBuffer(false);
+  if (!mb || mb->GetFD() < 0 || !mb->GetCacheSync()) {
+    LOG("cache sync: no dma-buf of the hardware, skipped\n");
+    return false;
+  }
+  auto cs = mb->GetCacheSync();
+  mb.reset();
+  // the first round may flush what the cpu wrote before
+  device_to_cpu_reader(pool);
+
+  // only the invalidate for the reader, no flush of the destination
+  const int rounds = 4;
+  uint64_t synced = cs->GetSynced(), elided = cs->GetElided();
+  for (int i = 0; i < rounds; i++)
+    device_to_cpu_reader(pool);
+  CHECK(cs->GetSynced() == synced + rounds);
+  CHECK(cs->GetElided() == elided + 2 * rounds);
+  CHECK(cs->GetState() == easymedia::CacheSync::State::CLEAN);
+
+  // a write of the cpu is flushed before a device reads
+  mb = pool.GetBuffer();
+  CHECK(mb);
+  memset(mb->GetWritablePtr(), 0x5a, mb->GetSize());
+  synced = cs->GetSynced();
+  mb->BeginDeviceAccess(true);
+  mb->EndDeviceAccess(true);
+  CHECK(cs->GetSynced() == synced + 1);
+  CHECK(cs->GetState() == easymedia::CacheSync::State::CLEAN);
+  return true;
+}
+
 void release_pool_buffer(easymedia::BufferPool *pool) {
   int i = 100;
 
@@ -31,9 +167,75 @@ void release_pool_buffer(easymedia::BufferPool *pool) {
   }
 }
 
+#define CACHE_BUFFER_SIZE (128 * 1024)
+
+static void test_buffer_cache() {
+  const auto type = easymedia::MediaBuffer::MemType::MEM_COMMON;
+  easymedia::BufferCacheStats orig;
+  easymedia::GetBufferCacheStats(type, orig);
+  easymedia::SetBufferCacheLimit(type, 4 * CACHE_BUFFER_SIZE);
+  easymedia::TrimBufferCache(type, 0);
+  easymedia::BufferCacheStats s0, stats;
+  easymedia::GetBufferCacheStats(type, s0);
+  CHECK(s0.cached_cnt == 0 && s0.cached_bytes == 0);
+  CHECK(s0.limit == 4 * CACHE_BUFFER_SIZE);
+
+  // a miss, then the buffer freed is reused
+  auto mb = easymedia::MediaBuffer::Alloc(CACHE_BUFFER_SIZE, type);
+  CHECK(mb);
+  void *ptr = mb->GetPtr();
+  mb.reset();
+  easymedia::GetBufferCacheStats(type, stats);
+  CHECK(stats.misses == s0.misses + 1 && stats.cached_cnt == 1);
+  mb = easymedia::MediaBuffer::Alloc(CACHE_BUFFER_SIZE, type);
+  CHECK(mb && mb->GetPtr() == ptr);
+  mb.reset();
+  easymedia::GetBufferCacheStats(type, stats);
+  CHECK(stats.hits == s0.hits + 1 && stats.misses == s0.misses + 1);
+
+  // the oldest ones are evicted beyond the limit
+  easymedia::SetBufferCacheLimit(type, 2 * CACHE_BUFFER_SIZE);
+  std::list<std::shared_ptr<easymedia::MediaBuffer>> held;
+  for (int i = 0; i < 3; i++)
+    held.push_back(easymedia::MediaBuffer::Alloc(CACHE_BUFFER_SIZE, type));
+  held.clear();
+  easymedia::GetBufferCacheStats(type, stats);
+  CHECK(stats.cached_cnt == 2 && stats.cached_bytes == 2 * CACHE_BUFFER_SIZE);
+  CHECK(stats.evicted == s0.evicted + 1);
+
+  // trimmed on demand
+  easymedia::TrimBufferCache(type, CACHE_BUFFER_SIZE);
+  easymedia::GetBufferCacheStats(type, stats);
+  CHECK(stats.cached_cnt == 1 && stats.evicted == s0.evicted + 2);
+  easymedia::TrimBufferCache(type);
+  easymedia::GetBufferCacheStats(type, stats);
+  CHECK(stats.cached_cnt == 0 && stats.cached_bytes == 0);
+
+  // the limit 0 disables the cache
+  easymedia::SetBufferCacheLimit(type, 0);
+  easymedia::GetBufferCacheStats(type, s0);
+  for (int i = 0; i < 2; i++) {
+    mb = easymedia::MediaBuffer::Alloc(CACHE_BUFFER_SIZE, type);
+    CHECK(mb);
+    mb.reset();
+  }
+  easymedia::GetBufferCacheStats(type, stats);
+  CHECK(stats.limit == 0 && stats.cached_cnt == 0 && stats.hits == s0.hits);
+  easymedia::SetBufferCacheLimit(type, orig.limit);
+}
+
 int main() {
   LOG_INIT();
 
+  test_elastic_pool();
+  test_pool_drain();
+  test_release_after_pool();
+  LOG("elastic pool, drain and release after pool: OK\n");
+  test_buffer_cache();
+  LOG("buffer cache: OK\n");
+  if (test_cache_sync())
+    LOG("cache sync: OK\n");
+
   easymedia::BufferPool pool(10, 1024, easymedia::MediaBuffer::MemType::MEM_COMMON);;
 
   LOG("#001 Dump Info....\n");
@@ -0,0 +1,220 @@
+// Copyright 2020 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <string>
+
+#include "buffer.h"
+#include "buffer_share.h"
+#include "utils.h"
+
+#define SHARE_PATH "/tmp/rkmedia_buffer_share_test"
+#define SHARE_CREDITS 2
+#define FRAME_SIZE (64 * 1024)
+
+// Not assert, the calls checked have side effects.
+#define CHECK(cond)                                                            \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      LOG("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);             \
+      exit(1);                                                                 \
+    }                                                                          \
+  } while (0)
+
+static void fill_frame(easymedia::MediaBuffer &mb, int index) {
+  uint8_t *p = (uint8_t *)mb.GetPtr();
+  for (size_t i = 0; i < FRAME_SIZE; i++)
+    p[i] = (uint8_t)(index + i);
+  mb.SetValidSize(FRAME_SIZE);
+  mb.SetUSTimeStamp(index);
+}
+
+// No fd on the consumer side, only the dma-bufs keep it.
+static bool check_frame(std::shared_ptr<easymedia::MediaBuffer> &mb,
+                        int index) {
+  if (!mb || mb->GetValidSize() != FRAME_SIZE ||
+      mb->GetUSTimeStamp() != index || mb->GetFD() >= 0)
+    return false;
+  const uint8_t *p = (const uint8_t *)mb->GetPtr();
+  for (size_t i = 0; i < FRAME_SIZE; i++) {
+    if (p[i] != (uint8_t)(index + i))
+      return false;
+  }
+  return true;
+}
+
+// Buffers with a memfd, shared as is and held by the producer until
+// released, as the buffers of a pool. Not a dma-buf, so not synced.
+static std::atomic_int fd_buffers_released(0);
+
+struct FdBuffer {
+  int fd;
+  void *ptr;
+};
+
+static int free_fd_buffer(void *arg) {
+  FdBuffer *b = (FdBuffer *)arg;
+  munmap(b->ptr, FRAME_SIZE);
+  close(b->fd);
+  delete b;
+  fd_buffers_released++;
+  return 0;
+}
+
+static std::shared_ptr<easymedia::MediaBuffer> alloc_fd_buffer() {
+  FdBuffer *b = new FdBuffer();
+  b->fd = syscall(SYS_memfd_create, "buffer_share_test", 0);
+  CHECK(b->fd >= 0 && !ftruncate(b->fd, FRAME_SIZE));
+  b->ptr = mmap(NULL, FRAME_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, b->fd, 0);
+  CHECK(b->ptr != MAP_FAILED);
+  return std::make_shared<easymedia::MediaBuffer>(b->ptr, FRAME_SIZE, b->fd, b,
+                                                  free_fd_buffer);
+}
+
+static void signal_peer(int fd, char c) { CHECK(write(fd, &c, 1) == 1); }
+
+static char wait_peer(int fd) {
+  char c = 0;
+  CHECK(read(fd, &c, 1) == 1);
+  return c;
+}
+
+// The loopback consumer, holds the credits then releases them.
+static int consumer(int to_producer, int from_producer) {
+  easymedia::BufferShareClient client;
+  if (!client.Connect(SHARE_PATH, SHARE_CREDITS))
+    return 1;
+  signal_peer(to_producer, 'c');
+  std::shared_ptr<easymedia::MediaBuffer> held[SHARE_CREDITS];
+  for (int i = 0; i < SHARE_CREDITS; i++) {
+    held[i] = client.Receive(1000);
+    if (!check_frame(held[i], i)) {
+      LOG("consumer: frame %d is wrong\n", i);
+      return 2;
+    }
+  }
+  signal_peer(to_producer, 'h');
+  wait_peer(from_producer);
+  // nothing beyond the credits
+  if (client.Receive(200)) {
+    LOG("consumer: got a buffer beyond the credits\n");
+    return 3;
+  }
+  for (int i = 0; i < SHARE_CREDITS; i++)
+    held[i].reset();
+  auto mb = client.Receive(1000);
+  if (!check_frame(mb, SHARE_CREDITS)) {
+    LOG("consumer: frame after release is wrong\n");
+    return 4;
+  }
+  mb.reset();
+
+  // distinct buffers of the same size must not share a mapping
+  for (int i = 0; i < SHARE_CREDITS; i++) {
+    held[i] = client.Receive(1000);
+    if (!check_frame(held[i], SHARE_CREDITS + 1 + i)) {
+      LOG("consumer: fd frame %d is wrong\n", i);
+      return 5;
+    }
+  }
+  signal_peer(to_producer, 'f');
+  wait_peer(from_producer);
+  for (int i = 0; i < SHARE_CREDITS; i++)
+    held[i].reset();
+  signal_peer(to_producer, 'd');
+  wait_peer(from_producer);
+  return 0;
+}
+
+int main() {
+  LOG_INIT();
+
+  int to_producer[2], from_producer[2];
+  CHECK(!pipe(to_producer) && !pipe(from_producer));
+  easymedia::BufferShareServer server(SHARE_PATH, 4);
+  CHECK(server.Start());
+
+  pid_t pid = fork();
+  CHECK(pid >= 0);
+  if (pid == 0)
+    _exit(consumer(to_producer[1], from_producer[0]));
+
+  // common memory without fd, copied into memfds
+  easymedia::BufferPool pool(2, FRAME_SIZE,
+                             easymedia::MediaBuffer::MemType::MEM_COMMON);
+  CHECK(wait_peer(to_producer[0]) == 'c');
+  while (server.GetConsumerNum() == 0)
+    easymedia::msleep(1);
+
+  int index = 0;
+  for (; index < SHARE_CREDITS; index++) {
+    auto mb = pool.GetBuffer();
+    CHECK(mb);
+    fill_frame(*mb, index);
+    CHECK(server.Send(mb) == 1);
+  }
+  CHECK(wait_peer(to_producer[0]) == 'h');
+
+  // the consumer holds all its credits
+  auto mb = pool.GetBuffer();
+  CHECK(mb);
+  fill_frame(*mb, index);
+  CHECK(server.Send(mb) == 0);
+  signal_peer(from_producer[1], 'g');
+
+  // sent again once released
+  int sent = 0;
+  for (int i = 0; i < 1000 && !sent; i++) {
+    sent = server.Send(mb);
+    if (!sent)
+      easymedia::msleep(1);
+  }
+  CHECK(sent == 1);
+  mb.reset();
+  index++;
+
+  // the copies do not hold the pool buffers
+  easymedia::BufferPoolStats stats;
+  pool.GetStats(stats);
+  CHECK(stats.in_use == 0);
+
+  // the buffers with fd are held until the consumer releases them
+  for (int i = 0; i < SHARE_CREDITS; i++, index++) {
+    auto fd_mb = alloc_fd_buffer();
+    fill_frame(*fd_mb, index);
+    sent = 0;
+    for (int j = 0; j < 1000 && !sent; j++) {
+      sent = server.Send(fd_mb);
+      if (!sent)
+        easymedia::msleep(1);
+    }
+    CHECK(sent == 1);
+  }
+  CHECK(wait_peer(to_producer[0]) == 'f');
+  CHECK(fd_buffers_released == 0);
+  signal_peer(from_producer[1], 'r');
+  CHECK(wait_peer(to_producer[0]) == 'd');
+  for (int i = 0; i < 1000 && fd_buffers_released < SHARE_CREDITS; i++)
+    easymedia::msleep(1);
+  CHECK(fd_buffers_released == SHARE_CREDITS);
+  signal_peer(from_producer[1], 'q');
+
+  int status = 0;
+  CHECK(waitpid(pid, &status, 0) == pid);
+  LOG("consumer exit status: %d\n", WEXITSTATUS(status));
+  CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+  server.Stop();
+  CHECK(access(SHARE_PATH, F_OK) != 0);
+
+  LOG("===== FINISH ====\n");
+  return 0;
+}
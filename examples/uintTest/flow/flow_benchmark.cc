@@ -0,0 +1,537 @@
+// Copyright 2019 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Benchmark of the flow engine with synthetic flows, no hardware needed.
+// A source sends pool buffers to fanout branches, each branch is a chain of
+// passthrough flows ending with a sink:
+//   source -> pass_0 -> ... -> pass_(chain-1) -> sink   (x fanout)
+// Every combination of the given thread models, input modes, queue depths,
+// fan-out widths and chain lengths is run, and reported as one json line:
+//   fps           frames received by each sink per second
+//   hop_p50/p99   us from the SetOutput of a flow to the process of the next
+//   e2e_p50/p99   us from the source to the sinks
+//   cpu_us_per_frame  process cpu time divided by the frames of all sinks
+// Input mode and depth do not apply to asyncatomic and sync, they are run
+// once with null reported.
+// With the flow scheduler, a blocking chain of one hop more than the workers
+// is run last, which stalls if the blocking pushes park all the workers.
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "buffer.h"
+#include "flow.h"
+#include "flow_stats.h"
+#include "key_string.h"
+#include "utils.h"
+
+namespace easymedia {
+
+#define BENCH_MAX_SAMPLES (1 << 20)
+
+// Latency samples kept for exact percentiles, the rest are ignored.
+class Samples {
+public:
+  Samples() : values(BENCH_MAX_SAMPLES), num(0) {}
+  void Add(int64_t v) {
+    uint32_t i = num.fetch_add(1, std::memory_order_relaxed);
+    if (i < values.size())
+      values[i] = (int32_t)std::min<int64_t>(v, INT32_MAX);
+  }
+  void Reset() { num.store(0, std::memory_order_relaxed); }
+  int64_t Percentile(double p) {
+    size_t n = std::min<size_t>(num.load(), values.size());
+    if (!n)
+      return 0;
+    size_t k = std::min(n - 1, (size_t)(n * p / 100.0));
+    std::nth_element(values.begin(), values.begin() + k, values.begin() + n);
+    return values[k];
+  }
+
+private:
+  std::vector<int32_t> values;
+  std::atomic<uint32_t> num;
+};
+
+struct BenchContext {
+  BenchContext() : measuring(false), delivered(0), work_us(0) {}
+  std::atomic_bool measuring;
+  std::atomic<uint64_t> delivered;
+  int work_us;
+  Samples hop;
+  Samples e2e;
+};
+
+static BenchContext bench;
+
+class BenchSource : public Flow {
+public:
+  BenchSource() {
+    SetAsSource(std::vector<int>({0}), void_transaction00, "bench_source");
+    SetFlowTag("bench_source");
+  }
+  virtual ~BenchSource() { StopAllThread(); }
+};
+
+static bool bench_process(Flow *f, MediaBufferVector &input_vector);
+
+class BenchFlow : public Flow {
+public:
+  BenchFlow(Model model, InputMode mode, int depth, int max_age,
+            float interval, int batch_num, int batch_window, bool sink,
+            const std::string &name)
+      : is_sink(sink), resample(model == Model::ASYNCATOMIC) {
+    SlotMap sm;
+    sm.input_slots.push_back(0);
+    if (!sink)
+      sm.output_slots.push_back(0);
+    sm.thread_model = model;
+    sm.mode_when_full = mode;
+    sm.input_maxcachenum.push_back(depth);
+    sm.input_max_age.push_back(max_age);
+    sm.interval = interval;
+    sm.batch_num = batch_num;
+    sm.batch_window = batch_window;
+    sm.process = bench_process;
+    if (!InstallSlotMap(sm, name, 0)) {
+      SetError(-EINVAL);
+      return;
+    }
+    SetFlowTag(name);
+  }
+  virtual ~BenchFlow() { StopAllThread(); }
+
+  bool is_sink;
+  // asyncatomic processes the latest buffer every interval, even if it is
+  // processed before, and sends an empty buffer down if there is no output.
+  // Hold the last input, so that its address is not reused, and send the last
+  // output again for a repeated input.
+  bool resample;
+  std::shared_ptr<MediaBuffer> last;
+  std::shared_ptr<MediaBuffer> last_out;
+
+  friend bool bench_process(Flow *f, MediaBufferVector &input_vector);
+};
+
+static void busy_work(int us) {
+  if (us <= 0)
+    return;
+  int64_t end = getmonotonictime() + us;
+  while (getmonotonictime() < end)
+    ;
+}
+
+bool bench_process(Flow *f, MediaBufferVector &input_vector) {
+  BenchFlow *flow = static_cast<BenchFlow *>(f);
+  auto &in = input_vector[0];
+  if (!in)
+    return true;
+  if (flow->resample) {
+    if (in == flow->last)
+      return flow->last_out ? flow->SetOutput(flow->last_out, 0) : true;
+    flow->last = in;
+  }
+  int64_t now = getmonotonictime();
+  bool measuring = bench.measuring.load(std::memory_order_relaxed);
+  if (measuring)
+    bench.hop.Add(now - in->GetUSTimeStamp());
+  busy_work(bench.work_us);
+  if (flow->is_sink) {
+    if (measuring) {
+      bench.e2e.Add(getmonotonictime() - (int64_t)in->GetAtomicClock());
+      bench.delivered.fetch_add(1, std::memory_order_relaxed);
+    }
+    return true;
+  }
+  // Shares the pool buffer, which returns to the pool with the last copy.
+  auto out = std::make_shared<MediaBuffer>(*in);
+  out->SetUSTimeStamp(getmonotonictime());
+  if (flow->resample)
+    flow->last_out = out;
+  return flow->SetOutput(out, 0);
+}
+
+struct BenchCase {
+  Model model;
+  InputMode mode;
+  int depth;
+  int fanout;
+  int chain;
+  bool must_deliver; // exit as stalled if no frame is delivered
+};
+
+struct BenchOptions {
+  BenchOptions()
+      : duration_ms(1000), warmup_ms(200), work_us(0), fps(0), pool_cnt(64),
+        buffer_size(4096), max_age(10), interval(1.0f), batch_num(1),
+        batch_window(0) {}
+  int duration_ms;
+  int warmup_ms;
+  int work_us;
+  int fps; // 0 means as fast as possible
+  int pool_cnt;
+  int buffer_size;
+  int max_age;    // ms, dropstale
+  float interval; // ms, asyncatomic
+  int batch_num;    // asynccommon
+  int batch_window; // ms, asynccommon
+};
+
+static double cpu_time_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return ts.tv_sec * 1000000.0 + ts.tv_nsec / 1000.0;
+}
+
+static const struct {
+  Model model;
+  const char *name;
+} bench_models[] = {{Model::ASYNCCOMMON, KEY_ASYNCCOMMON},
+                    {Model::ASYNCATOMIC, KEY_ASYNCATOMIC},
+                    {Model::SYNC, KEY_SYNC}};
+
+static const struct {
+  InputMode mode;
+  const char *name;
+} bench_modes[] = {{InputMode::BLOCKING, KEY_BLOCKING},
+                   {InputMode::DROPFRONT, KEY_DROPFRONT},
+                   {InputMode::DROPCURRENT, KEY_DROPCURRENT},
+                   {InputMode::DROPSTALE, KEY_DROPSTALE}};
+
+static const char *model_name(Model model) {
+  for (auto &m : bench_models)
+    if (m.model == model)
+      return m.name;
+  return "none";
+}
+
+static Model model_by_name(const std::string &name) {
+  for (auto &m : bench_models)
+    if (name == m.name)
+      return m.model;
+  return Model::NONE;
+}
+
+static const char *mode_name(InputMode mode) {
+  for (auto &m : bench_modes)
+    if (m.mode == mode)
+      return m.name;
+  return "none";
+}
+
+static InputMode mode_by_name(const std::string &name) {
+  for (auto &m : bench_modes)
+    if (name == m.name)
+      return m.mode;
+  return InputMode::NONE;
+}
+
+static void run_case(const BenchCase &c, const BenchOptions &opt, FILE *out) {
+  BufferPool pool(opt.pool_cnt, opt.buffer_size,
+                  MediaBuffer::MemType::MEM_COMMON);
+  auto source = std::make_shared<BenchSource>();
+  std::vector<std::vector<std::shared_ptr<Flow>>> branches(c.fanout);
+  std::vector<std::shared_ptr<Flow>> all;
+  for (int b = 0; b < c.fanout; b++) {
+    std::shared_ptr<Flow> up = source;
+    for (int i = 0; i <= c.chain; i++) {
+      bool sink = (i == c.chain);
+      std::string name = sink ? "bench_sink_" : "bench_pass_";
+      name += std::to_string(b) + "_" + std::to_string(i);
+      std::shared_ptr<Flow> flow = std::make_shared<BenchFlow>(
+          c.model, c.mode, c.depth, opt.max_age, opt.interval, opt.batch_num,
+          opt.batch_window, sink, name);
+      up->AddDownFlow(flow, 0, 0);
+      branches[b].push_back(flow);
+      all.push_back(flow);
+      up = flow;
+    }
+  }
+
+  bench.work_us = opt.work_us;
+  bench.delivered = 0;
+  bench.hop.Reset();
+  bench.e2e.Reset();
+  std::atomic_bool loop(true);
+  std::atomic<uint64_t> produced(0);
+  std::thread producer([&] {
+    int64_t period = opt.fps > 0 ? 1000000 / opt.fps : 0;
+    int64_t next = getmonotonictime();
+    while (loop) {
+      auto mb = pool.GetBuffer(true);
+      if (!mb)
+        continue;
+      int64_t now = getmonotonictime();
+      mb->SetValidSize(mb->GetSize());
+      mb->SetAtomicClock(now);
+      mb->SetUSTimeStamp(now);
+      source->SendInput(mb, 0);
+      if (bench.measuring.load(std::memory_order_relaxed))
+        produced++;
+      if (period) {
+        next += period;
+        int64_t wait = next - getmonotonictime();
+        if (wait > 0)
+          easymedia::usleep(wait);
+      }
+    }
+  });
+
+  easymedia::msleep(opt.warmup_ms);
+  for (auto &f : all)
+    f->ResetStats();
+  double cpu_begin = cpu_time_us();
+  int64_t begin = getmonotonictime();
+  bench.measuring = true;
+  easymedia::msleep(opt.duration_ms);
+  bench.measuring = false;
+  int64_t wall_us = getmonotonictime() - begin;
+  double cpu_us = cpu_time_us() - cpu_begin;
+  uint64_t delivered = bench.delivered.load();
+  if (c.must_deliver && !delivered) {
+    // the flows can not be stopped
+    fprintf(out, "{\"model\":\"%s\",\"chain\":%d,\"stalled\":true}\n",
+            model_name(c.model), c.chain);
+    fflush(out);
+    _exit(1);
+  }
+
+  uint64_t dropped = 0;
+  for (auto &f : all) {
+    FlowStats stats;
+    f->GetStats(stats);
+    for (auto &in : stats.inputs)
+      dropped += in.drop_front + in.drop_current + in.drop_stale +
+                 in.drop_overtaken + in.replaced;
+  }
+
+  loop = false;
+  producer.join();
+  for (int b = 0; b < c.fanout; b++) {
+    std::shared_ptr<Flow> up = source;
+    for (auto &flow : branches[b]) {
+      up->RemoveDownFlow(flow);
+      up = flow;
+    }
+  }
+  branches.clear();
+  all.clear();
+  source.reset();
+
+  bool queued = (c.model == Model::ASYNCCOMMON);
+  fprintf(out, "{\"model\":\"%s\",", model_name(c.model));
+  if (queued)
+    fprintf(out,
+            "\"input_mode\":\"%s\",\"depth\":%d,\"batch_num\":%d,"
+            "\"batch_window_ms\":%d,",
+            mode_name(c.mode), c.depth, opt.batch_num, opt.batch_window);
+  else
+    fprintf(out, "\"input_mode\":null,\"depth\":null,\"batch_num\":null,"
+                 "\"batch_window_ms\":null,");
+  fprintf(out,
+          "\"fanout\":%d,\"chain\":%d,\"work_us\":%d,\"duration_ms\":%lld,"
+          "\"produced\":%llu,\"delivered\":%llu,\"dropped\":%llu,"
+          "\"fps\":%.1f,\"hop_p50_us\":%lld,\"hop_p99_us\":%lld,"
+          "\"e2e_p50_us\":%lld,\"e2e_p99_us\":%lld,"
+          "\"cpu_us_per_frame\":%.2f,\"cpu_util\":%.3f}\n",
+          c.fanout, c.chain, opt.work_us, (long long)(wall_us / 1000),
+          (unsigned long long)produced.load(), (unsigned long long)delivered,
+          (unsigned long long)dropped,
+          delivered * 1000000.0 / c.fanout / wall_us,
+          (long long)bench.hop.Percentile(50),
+          (long long)bench.hop.Percentile(99),
+          (long long)bench.e2e.Percentile(50),
+          (long long)bench.e2e.Percentile(99),
+          delivered ? cpu_us / delivered : 0.0, cpu_us / wall_us);
+  fflush(out);
+}
+
+} // namespace easymedia
+
+using namespace easymedia;
+
+static void usage(const char *name) {
+  printf("Usage: %s [options]\n"
+         "  lists are separated by comma\n"
+         "  -m models       asynccommon,asyncatomic,sync\n"
+         "  -i input modes  blocking,dropfront,dropcurrent,dropstale\n"
+         "  -d depths       default 4\n"
+         "  -n fan-outs     default 1,4\n"
+         "  -c chains       passthrough flows of each branch, default 1,4\n"
+         "  -t ms           measured time of each case, default 1000\n"
+         "  -W ms           warmup time of each case, default 200\n"
+         "  -w us           busy work of each process, default 0\n"
+         "  -r fps          source rate, default 0 as fast as possible\n"
+         "  -a ms           asyncatomic interval, default 1\n"
+         "  -A ms           dropstale max age, default 10\n"
+         "  -b count        asynccommon batch num, default 1\n"
+         "  -B ms           asynccommon batch window, default 0\n"
+         "  -p count        source buffer pool size, default 64\n"
+         "  -s workers      enable the flow scheduler, 0 for all cpus,\n"
+         "                  and run the blocking chain stall case\n"
+         "  -f              enable flow fusion\n"
+         "  -o file         write results to file, default stdout\n",
+         name);
+}
+
+static std::vector<std::string> split(const char *arg) {
+  std::vector<std::string> list;
+  std::string s(arg);
+  size_t pos = 0;
+  while (pos <= s.size()) {
+    size_t end = s.find(',', pos);
+    if (end == std::string::npos)
+      end = s.size();
+    if (end > pos)
+      list.push_back(s.substr(pos, end - pos));
+    pos = end + 1;
+  }
+  return list;
+}
+
+static std::vector<int> split_int(const char *arg) {
+  std::vector<int> list;
+  for (auto &s : split(arg))
+    list.push_back(atoi(s.c_str()));
+  return list;
+}
+
+int main(int argc, char **argv) {
+  std::vector<Model> models = {Model::ASYNCCOMMON, Model::ASYNCATOMIC,
+                               Model::SYNC};
+  std::vector<InputMode> modes = {InputMode::BLOCKING, InputMode::DROPFRONT,
+                                  InputMode::DROPCURRENT};
+  std::vector<int> depths = {4};
+  std::vector<int> fanouts = {1, 4};
+  std::vector<int> chains = {1, 4};
+  BenchOptions opt;
+  const char *out_path = nullptr;
+  int workers = -1;
+  int c;
+
+  LOG_INIT();
+  while ((c = getopt(argc, argv, "m:i:d:n:c:t:W:w:r:a:A:b:B:p:s:fo:h")) != -1) {
+    switch (c) {
+    case 'm':
+      models.clear();
+      for (auto &s : split(optarg))
+        models.push_back(model_by_name(s));
+      break;
+    case 'i':
+      modes.clear();
+      for (auto &s : split(optarg))
+        modes.push_back(mode_by_name(s));
+      break;
+    case 'd':
+      depths = split_int(optarg);
+      break;
+    case 'n':
+      fanouts = split_int(optarg);
+      break;
+    case 'c':
+      chains = split_int(optarg);
+      break;
+    case 't':
+      opt.duration_ms = atoi(optarg);
+      break;
+    case 'W':
+      opt.warmup_ms = atoi(optarg);
+      break;
+    case 'w':
+      opt.work_us = atoi(optarg);
+      break;
+    case 'r':
+      opt.fps = atoi(optarg);
+      break;
+    case 'a':
+      opt.interval = atof(optarg);
+      break;
+    case 'A':
+      opt.max_age = atoi(optarg);
+      break;
+    case 'b':
+      opt.batch_num = atoi(optarg);
+      break;
+    case 'B':
+      opt.batch_window = atoi(optarg);
+      break;
+    case 'p':
+      opt.pool_cnt = atoi(optarg);
+      break;
+    case 's':
+      workers = atoi(optarg);
+      EnableFlowScheduler(workers);
+      break;
+    case 'f':
+      EnableFlowFusion(true);
+      break;
+    case 'o':
+      out_path = optarg;
+      break;
+    default:
+      usage(argv[0]);
+      return 0;
+    }
+  }
+  for (auto m : models) {
+    if (m == Model::NONE) {
+      printf("Unknown model\n");
+      return -1;
+    }
+  }
+  for (auto m : modes) {
+    if (m == InputMode::NONE) {
+      printf("Unknown input mode\n");
+      return -1;
+    }
+  }
+  if (models.empty() || modes.empty() || depths.empty() || fanouts.empty() ||
+      chains.empty()) {
+    usage(argv[0]);
+    return -1;
+  }
+
+  FILE *out = stdout;
+  if (out_path) {
+    out = fopen(out_path, "w");
+    if (!out) {
+      printf("Fail to open %s: %m\n", out_path);
+      return -1;
+    }
+  }
+  for (auto m : models) {
+    bool queued = (m == Model::ASYNCCOMMON);
+    for (size_t i = 0; i < (queued ? modes.size() : 1); i++) {
+      for (size_t d = 0; d < (queued ? depths.size() : 1); d++) {
+        for (int fanout : fanouts) {
+          for (int chain : chains) {
+            BenchCase bc = {m, modes[i], depths[d], fanout, chain, false};
+            run_case(bc, opt, out);
+          }
+        }
+      }
+    }
+  }
+  if (workers >= 0) {
+    if (workers == 0)
+      workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    // the sink is the extra hop
+    BenchCase bc = {Model::ASYNCCOMMON, InputMode::BLOCKING, 1, 1, workers,
+                    true};
+    run_case(bc, opt, out);
+  }
+  if (out != stdout)
+    fclose(out);
+  return 0;
+}
@@ -734,8 +734,9 @@ void single_pipe_run(std::string mode,
       flow_name.c_str(), param.c_str());
   assert(sink);
 
-  src->AddDownFlow(io11, 0, 0);
+  // link from the end, source starts sending once it gets a down flow.
   io11->AddDownFlow(sink, 0, 0);
+  src->AddDownFlow(io11, 0, 0);
   LOGD("#SrcFlow:%p, IO11Flow:%p, SinkFLow:%p\n", src.get(), io11.get(), sink.get());
 
   while(!is_src_eos(src)) {
@@ -993,7 +994,6 @@ int multi_pipe_test() {
   LOG("\t p1_io21:%p\n", p1_io21.get());
   LOG("\t p1_sink:%p\n", p1_sink.get());
 
-  src->AddDownFlow(io11_tt, 0, 0);
   // link pipeline 0
   io11_tt->AddDownFlow(p0_io12, 0, 0);
   p0_io12->AddDownFlow(p0_io11_0, 0, 0);
@@ -1012,6 +1012,8 @@ int multi_pipe_test() {
   p1_io22->AddDownFlow(p1_io21, 0, 0);
   p1_io22->AddDownFlow(p1_io21, 1, 1);
   p1_io21->AddDownFlow(p1_sink, 0 , 0);
+  // link source at last, it starts sending once it gets a down flow.
+  src->AddDownFlow(io11_tt, 0, 0);
 
   while(g_need_sleep && !is_src_eos(src)) {
     easymedia::msleep(100);
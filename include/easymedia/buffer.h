@@ -9,7 +9,12 @@
 #include <string.h>
 #include <sys/time.h>
 
+#include <atomic>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <vector>
 
 #include "image.h"
 #include "lock.h"
@@ -33,6 +38,42 @@ enum drm_rockchip_gem_mem_type {
   ROCKCHIP_BO_MASK = ROCKCHIP_BO_CONTIG | ROCKCHIP_BO_CACHABLE | ROCKCHIP_BO_WC
 };
 
+// The cache coherency state of the memory of a dma buffer, shared by all the
+// MediaBuffer of it, so that the cache is synced only when the memory passes
+// between the cpu and the devices.
+class _API CacheSync {
+public:
+  enum class State {
+    CPU,    // the cpu wrote, flush before a device accesses
+    CLEAN,  // the cache agrees with the memory
+    DEVICE, // a device wrote, invalidate before the cpu reads
+  };
+  CacheSync() : state(State::CPU), synced(0), elided(0) {}
+  State GetState() const { return state.load(std::memory_order_relaxed); }
+  // sync ioctls issued, and the ones skipped for no domain transition
+  uint64_t GetSynced() const { return synced.load(std::memory_order_relaxed); }
+  uint64_t GetElided() const { return elided.load(std::memory_order_relaxed); }
+
+private:
+  friend class MediaBuffer;
+  std::atomic<State> state;
+  std::mutex mtx; // serializes the transitions
+  std::atomic<uint64_t> synced;
+  std::atomic<uint64_t> elided;
+};
+
+// Who holds a live buffer, as last seen by the memory census.
+enum class MemHolder {
+  NONE,   // the code which allocated it
+  FLOW,   // a flow, which processes or keeps it
+  QUEUE,  // the input queue of a flow
+  POOL,   // free in a BufferPool
+  OUTPUT, // the output of a flow
+  USER,   // the application, by the c api
+};
+
+struct MemRecord;
+
 // wrapping existing buffer
 class _API MediaBuffer {
 public:
@@ -47,25 +88,55 @@ public:
   // special flags
   static const uint32_t kBuildinLibvorbisenc = (1 << 16);
 
+  // High priority buffers, such as intra frames, are never dropped by the
+  // async flow inputs for a full queue, they jump the queue instead and
+  // the older normal buffers are dropped. Blocking inputs keep the order.
+  enum class Priority { NORMAL, HIGH };
+
   MediaBuffer()
       : ptr(nullptr), size(0), fd(-1), valid_size(0), type(Type::None),
-        user_flag(0), ustimestamp(0), eof(false), tsvc_level(-1) {}
+        user_flag(0), ustimestamp(0), atomic_clock(0), trace_frame(0),
+        eof(false), tsvc_level(-1), priority(Priority::NORMAL),
+        mem_record(nullptr) {}
   // Set userdata and delete function if you want free resource when destrut.
   MediaBuffer(void *buffer_ptr, size_t buffer_size, int buffer_fd = -1,
               void *user_data = nullptr, DeleteFun df = nullptr)
       : ptr(buffer_ptr), size(buffer_size), fd(buffer_fd), valid_size(0),
-        type(Type::None), user_flag(0), ustimestamp(0), eof(false),
-        tsvc_level(-1) {
+        type(Type::None), user_flag(0), ustimestamp(0), atomic_clock(0),
+        trace_frame(0), eof(false), tsvc_level(-1),
+        priority(Priority::NORMAL), mem_record(nullptr) {
     SetUserData(user_data, df);
   }
   virtual ~MediaBuffer() = default;
   virtual PixelFormat GetPixelFormat() const { return PIX_FMT_NONE; }
   virtual SampleFormat GetSampleFormat() const { return SAMPLE_FMT_NONE; }
+  // Always syncs the cache, even with a CacheSync. A readonly access does
+  // not count as a write of the cpu.
   void BeginCPUAccess(bool readonly);
   void EndCPUAccess(bool readonly);
+  // Around the access of a device by the fd. Without a CacheSync, the cache
+  // is flushed before a device reads and invalidated after it writes. With
+  // one, only on a domain transition, and the invalidation is deferred to
+  // the next access of the cpu.
+  void BeginDeviceAccess(bool readonly);
+  void EndDeviceAccess(bool readonly);
   int GetFD() const { return fd; }
   void SetFD(int new_fd) { fd = new_fd; }
-  void *GetPtr() const { return ptr; }
+  // For the cpu to read, invalidates the cache first if a device wrote.
+  void *GetPtr() const {
+    if (cache_sync && cache_sync->GetState() == CacheSync::State::DEVICE)
+      SyncForCpu(false);
+    return ptr;
+  }
+  // For the cpu to write, so that the cache is flushed before a device
+  // reads. Or write by GetPtr() and call EndCPUAccess(false).
+  void *GetWritablePtr() const {
+    if (cache_sync && cache_sync->GetState() != CacheSync::State::CPU)
+      SyncForCpu(true);
+    return ptr;
+  }
+  // Only to hand the memory to a device along with the fd.
+  void *GetDevicePtr() const { return ptr; }
   void SetPtr(void *addr) { ptr = addr; }
   size_t GetSize() const { return size; }
   void SetSize(size_t s) { size = s; }
@@ -93,6 +164,8 @@ public:
   void SetEOF(bool val) { eof = val; }
   int GetTsvcLevel() { return tsvc_level; }
   void SetTsvcLevel(int _level) { tsvc_level = _level; }
+  Priority GetPriority() const { return priority; }
+  void SetPriority(Priority p) { priority = p; }
 
   void SetUserData(void *user_data, DeleteFun df) {
     if (user_data) {
@@ -103,6 +176,7 @@ public:
     } else {
       userdata.reset();
     }
+    mem_record = nullptr; // owned by the previous userdata
   }
   int64_t GetAtomicClock() const { return atomic_clock; }
   struct timeval GetAtomicTimeVal() const {
@@ -115,8 +189,15 @@ public:
   void SetAtomicTimeVal(const struct timeval &val) {
     atomic_clock = val.tv_sec * 1000000LL + val.tv_usec;
   }
-
-  void SetUserData(std::shared_ptr<void> user_data) { userdata = user_data; }
+  // The frame followed by the latency trace, inherited by the outputs of
+  // its process. 0 if not traced.
+  int64_t GetTraceFrame() const { return trace_frame; }
+  void SetTraceFrame(int64_t frame) { trace_frame = frame; }
+
+  void SetUserData(std::shared_ptr<void> user_data) {
+    userdata = user_data;
+    mem_record = nullptr;
+  }
   std::shared_ptr<void> GetUserData() { return userdata; }
 
   void SetRelatedSPtr(const std::shared_ptr<void> &rdata, int index = -1) {
@@ -132,6 +213,10 @@ public:
     return related_sptrs;
   }
 
+  // Set by the owner of the memory, which keeps the state between lendings.
+  void SetCacheSync(const std::shared_ptr<CacheSync> &cs) { cache_sync = cs; }
+  std::shared_ptr<CacheSync> GetCacheSync() { return cache_sync; }
+
   bool IsValid() { return valid_size > 0; }
   bool IsHwBuffer() { return fd >= 0; }
 
@@ -146,10 +231,30 @@ public:
                             unsigned int flag = ROCKCHIP_BO_CACHABLE);
   static std::shared_ptr<MediaBuffer>
   Clone(MediaBuffer &src, MemType dst_type = MemType::MEM_COMMON);
+  // A buffer of length bytes from offset of src without copy, which keeps
+  // the memory of src alive and has its own attributes. A view from a
+  // nonzero offset has no fd, as the devices would see the whole memory.
+  // A copy if src has no userdata to keep the memory alive.
+  static std::shared_ptr<MediaBuffer> View(MediaBuffer &src, size_t offset,
+                                           size_t length);
+  // Whether the memory is referenced by other buffers, such as views.
+  bool IsShared() const { return userdata.use_count() > 1; }
+  // Copy on write, call before writing the memory. Moves the valid data to
+  // a private memory of mem_type if shared. Return false if no memory.
+  bool MakeWritable(MemType mem_type = MemType::MEM_COMMON);
+
+  // Tell the memory census who holds the memory now, name valid for the
+  // whole process (see TraceName). Only the buffers of Alloc/Alloc2 and of
+  // BufferPool are accounted, it does nothing for the others.
+  void SetHolder(MemHolder holder, const char *name);
 
 private:
+  friend class BufferPoolCore;
+  static MediaBuffer AllocAt(size_t size, MemType type, unsigned int flag,
+                             const void *site);
   // copy attributs except buffer
   void CopyAttribute(MediaBuffer &src_attr);
+  void SyncForCpu(bool write) const;
 
   void *ptr; // buffer virtual address
   size_t size;
@@ -159,14 +264,85 @@ private:
   uint32_t user_flag;
   int64_t ustimestamp;
   int64_t atomic_clock;
+  int64_t trace_frame;
   bool eof;
   int tsvc_level; // for avc/hevc encoder
+  Priority priority;
   std::shared_ptr<void> userdata;
   std::vector<std::shared_ptr<void>> related_sptrs;
+  std::shared_ptr<CacheSync> cache_sync;
+  MemRecord *mem_record; // of the census, owned by the userdata
 };
 
 MediaBuffer::MemType StringToMemType(const char *s);
 
+class _API BufferCacheStats {
+public:
+  BufferCacheStats();
+  uint64_t hits;   // allocations served by a cached buffer
+  uint64_t misses; // allocations done by the allocator for the cache
+  uint64_t evicted;
+  int cached_cnt; // free buffers kept now
+  size_t cached_bytes;
+  size_t limit;
+};
+
+// The buffers freed by MediaBuffer::Alloc/Alloc2 are kept by size class for
+// the next allocations of the same type, up to the limit bytes per type,
+// the oldest freed first. The limit 0 disables the cache of the type.
+_API void SetBufferCacheLimit(MediaBuffer::MemType type, size_t bytes);
+// Free the cached buffers until at most keep_bytes are kept.
+_API void TrimBufferCache(MediaBuffer::MemType type, size_t keep_bytes = 0);
+_API void GetBufferCacheStats(MediaBuffer::MemType type,
+                              BufferCacheStats &stats);
+
+class _API HugePageArenaStats {
+public:
+  HugePageArenaStats();
+  size_t reserved; // 0 without arena
+  bool hugetlb;    // explicit hugepages, else transparent ones
+  size_t min_size;
+  size_t used;
+  size_t peak_used;
+  int chunks;         // buffers in the arena now
+  uint64_t allocs;    // buffers served by the arena
+  uint64_t fallbacks; // buffers left to malloc for lack of room
+};
+
+#define HUGEPAGE_ARENA_DEFAULT_MIN_SIZE (1024 * 1024)
+// The MEM_COMMON buffers of at least min_size bytes, of MediaBuffer::Alloc
+// and of BufferPool, are served from an arena of bytes reserved with
+// hugepages and faulted in at once, and by malloc once it is full. Call it
+// at startup, or set RKMEDIA_HUGEPAGE_ARENA to the MB to reserve. bytes 0
+// drops the arena, which is freed when its last buffer is.
+_API bool ReserveHugePageArena(
+    size_t bytes, size_t min_size = HUGEPAGE_ARENA_DEFAULT_MIN_SIZE);
+_API void GetHugePageArenaStats(HugePageArenaStats &stats);
+
+class _API MemAccountStats {
+public:
+  MemAccountStats();
+  size_t bytes; // live now
+  int cnt;
+  size_t peak_bytes;
+  int peak_cnt;
+  uint64_t allocs;
+};
+
+// The memory of MediaBuffer::Alloc/Alloc2 and of BufferPool is accounted for
+// as long as it lives, by memory type, by the flow which allocated it and by
+// the call site of the allocation, with the last holder seen.
+_API void GetMemAccountStats(MediaBuffer::MemType type, MemAccountStats &stats);
+_API void ResetMemAccountPeak();
+// Charge the allocations of this thread to name, valid for the whole
+// process, nullptr for none. Return the previous one.
+_API const char *SetMemOwner(const char *name);
+// Append the live bytes by type, flow and call site, then the buffers alive
+// for at least min_age_s seconds with their holder, lent ones of a pool
+// since their lending. The call sites are the library and offset for
+// addr2line.
+_API void DumpMemCensus(std::string &dump, int min_age_s = 0);
+
 // Audio sample buffer
 class _API SampleBuffer : public MediaBuffer {
 public:
@@ -240,16 +416,22 @@ private:
   std::list<RknnResult> nn_result;
 };
 
+template <typename T> class PoolHandleAllocator;
+class BufferPoolCore;
+
 class MediaGroupBuffer {
 public:
-  MediaGroupBuffer() : pool(nullptr), ptr(nullptr), size(0), fd(-1) {}
+  MediaGroupBuffer()
+      : pool(nullptr), ptr(nullptr), size(0), fd(-1), next_free(nullptr),
+        lent(false), handles(0), mem_record(nullptr) {}
   // Set userdata and delete function if you want free resource when destrut.
   MediaGroupBuffer(void *buffer_ptr, size_t buffer_size, int buffer_fd = -1,
                    void *user_data = nullptr, DeleteFun df = nullptr)
-      : pool(nullptr), ptr(buffer_ptr), size(buffer_size), fd(buffer_fd) {
+      : pool(nullptr), ptr(buffer_ptr), size(buffer_size), fd(buffer_fd),
+        next_free(nullptr), lent(false), handles(0), mem_record(nullptr) {
     SetUserData(user_data, df);
   }
-  virtual ~MediaGroupBuffer() = default;
+  virtual ~MediaGroupBuffer();
 
   void SetUserData(void *user_data, DeleteFun df) {
     if (user_data) {
@@ -281,24 +463,64 @@ private:
   int fd; // buffer fd
 
   std::shared_ptr<void> userdata;
+
+  friend class BufferPoolCore;
+  template <typename T> friend class PoolHandleAllocator;
+  // link of the free list of the pool, protected by the pool
+  MediaGroupBuffer *next_free;
+  bool lent;
+  // The control blocks of the MediaBuffer lent by the pool and of its
+  // userdata are placed here, so that lending allocates nothing. It returns
+  // to the pool once both are released.
+  std::atomic_int handles;
+  CacheSync cache_sync;
+  MemRecord *mem_record; // of the census, for the buffers lent
+  std::aligned_storage<sizeof(MediaBuffer) + 64>::type buffer_handle;
+  std::aligned_storage<96>::type data_handle;
 };
 
+class _API BufferPoolStats {
+public:
+  BufferPoolStats();
+  int total;             // buffers allocated now
+  int in_use;            // buffers lent now
+  int peak_in_use;
+  uint64_t waits;        // GetBuffer calls blocked for lack of buffer
+  uint64_t wait_us;      // total time GetBuffer blocked
+  uint64_t alloc_failed; // failed to grow, or to allocate at creation
+  uint64_t grown;        // buffers allocated on demand
+  uint64_t shrunk;       // buffers freed for being idle
+};
+
+// Get and put are O(1) and allocate nothing, except the growth of an elastic
+// pool.
 class _API BufferPool {
 public:
   BufferPool(int cnt, int size, MediaBuffer::MemType type);
+  // Elastic, starts with min_cnt buffers and grows on demand up to max_cnt.
+  // The buffers beyond min_cnt which were not needed for idle_ms are freed.
+  BufferPool(int min_cnt, int max_cnt, int size, MediaBuffer::MemType type,
+             int idle_ms);
+  // Never waits, the buffers still lent are freed by their last release.
   ~BufferPool();
 
+  // The buffer returns to the pool when the last copy of it is released.
   std::shared_ptr<MediaBuffer> GetBuffer(bool block = true);
   int PutBuffer(MediaGroupBuffer *mgb);
 
+  // Wait for all buffers to return, timeout_ms < 0 means forever.
+  // Return the number of buffers still lent, 0 if drained.
+  int Drain(int timeout_ms);
+  // Free the unused buffers beyond the min count at once.
+  void Trim();
+  void GetStats(BufferPoolStats &stats);
+  // Reset the counters, and the peak to the buffers lent now.
+  void ResetStats();
+
   void DumpInfo();
 
 private:
-  std::list<MediaGroupBuffer *> ready_buffers;
-  std::list<MediaGroupBuffer *> busy_buffers;
-  ConditionLockMutex mtx;
-  int buf_cnt;
-  int buf_size;
+  BufferPoolCore *core;
 };
 
 } // namespace easymedia
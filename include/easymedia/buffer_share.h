@@ -0,0 +1,131 @@
+// Copyright 2019 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef EASYMEDIA_BUFFER_SHARE_H_
+#define EASYMEDIA_BUFFER_SHARE_H_
+
+#include <stdint.h>
+
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "buffer.h"
+
+namespace easymedia {
+
+// Shares MediaBuffers with other processes over a unix seqpacket socket.
+// Each buffer is sent with its fd by SCM_RIGHTS, the dma-buf fd of the
+// drm/ion memory or any other fd as is, and the common memory copied into a
+// memfd. Only the dma-bufs keep their fd on the consumer side. The
+// consumer maps it and sends back a release once done with it, then the
+// producer drops its reference, which returns the buffer to its pool.
+
+#define BUFFER_SHARE_MAGIC 0x53424d52 // "RMBS"
+#define BUFFER_SHARE_VERSION 1
+
+enum class BufferShareMsg : uint32_t {
+  HELLO = 1, // consumer -> producer, with the credits wanted
+  BUFFER,    // producer -> consumer, with the fd
+  RELEASE,   // consumer -> producer
+};
+
+enum class BufferShareFdKind : uint32_t {
+  DMABUF = 1,
+  MEMFD,
+};
+
+struct BufferShareHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t msg;     // BufferShareMsg
+  uint32_t id;      // of the buffer to release
+  uint32_t credits; // HELLO: buffers held at most, 0 for the default
+  uint32_t fd_kind; // BufferShareFdKind
+  uint64_t map_size;
+  uint64_t offset; // of the data in the mapping
+  uint64_t valid_size;
+  int64_t ustimestamp;
+  int64_t atomic_clock;
+  uint32_t user_flag;
+  uint32_t type; // Type
+  uint32_t eof;
+  // Type::Image only
+  int32_t pix_fmt;
+  int32_t width;
+  int32_t height;
+  int32_t vir_width;
+  int32_t vir_height;
+};
+
+class _API BufferShareServer {
+public:
+  // credits: the buffers a consumer holds at most, the ones beyond are not
+  // sent to it, so a slow consumer never blocks the producer.
+  BufferShareServer(const std::string &path, int credits);
+  ~BufferShareServer();
+  bool Start();
+  void Stop();
+
+  // Send to every consumer with credit. Return the consumers sent to.
+  int Send(const std::shared_ptr<MediaBuffer> &mb);
+  int GetConsumerNum();
+
+private:
+  struct Consumer;
+  struct Memfd;
+  struct Entry {
+    std::shared_ptr<void> buffer; // kept until all consumers release it
+    int holders;
+  };
+  void Run();
+  void Accept();
+  // Return false if the consumer is gone. Called with mtx held, the buffers
+  // to drop are added to unheld, to drop out of the lock.
+  bool HandleMessage(Consumer *c, std::vector<std::shared_ptr<void>> &unheld);
+  void RemoveConsumer(Consumer *c, std::vector<std::shared_ptr<void>> &unheld);
+  void Unhold(uint32_t id, std::vector<std::shared_ptr<void>> &unheld);
+  // The common memory copied into a memfd, recycled once released.
+  std::shared_ptr<void> CopyToMemfd(MediaBuffer &mb, int &fd, size_t &size);
+
+  std::string sock_path;
+  int max_credits;
+  int listen_fd;
+  int wake_fd[2]; // wakes up the poll to stop
+  std::thread *th;
+  std::mutex mtx;
+  std::list<Consumer *> consumers;
+  std::map<uint32_t, Entry> held;
+  uint32_t next_id;
+  std::vector<std::shared_ptr<Memfd>> free_memfds;
+};
+
+// The consumer side, in another process.
+class _API BufferShareClient {
+public:
+  BufferShareClient();
+  ~BufferShareClient();
+  // credits: the buffers held at most, 0 for the default of the producer
+  bool Connect(const std::string &path, int credits = 0);
+  void Close();
+  // Wait for the next buffer, timeout_ms < 0 means forever. It is released
+  // to the producer once the last copy is destroyed, which must be done to
+  // get more than the credits. nullptr on timeout or disconnection.
+  std::shared_ptr<MediaBuffer> Receive(int timeout_ms = -1);
+  // for poll
+  int GetFD();
+
+private:
+  class Core;
+  // shared with the buffers, which may outlive the client
+  std::shared_ptr<Core> core;
+};
+
+} // namespace easymedia
+
+#endif // #ifndef EASYMEDIA_BUFFER_SHARE_H_
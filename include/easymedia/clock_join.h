@@ -0,0 +1,136 @@
+// Copyright 2019 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef EASYMEDIA_CLOCK_JOIN_H_
+#define EASYMEDIA_CLOCK_JOIN_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <iterator>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "utils.h"
+
+namespace easymedia {
+
+class MediaBuffer;
+
+// How an entry is matched to a target clock:
+//   EXACT: the nearest one within the skew tolerance, none otherwise.
+//   NEAREST: the nearest one however far. A join only falls back to it once
+//            EXACT fails and the wait times out.
+//   LATEST: the newest one not later than the target plus the tolerance,
+//           it is kept for the next targets, such as a slow detection result.
+enum class JoinPolicy { EXACT, NEAREST, LATEST };
+
+// Entries ordered by clock, so that a lookup costs O(log n).
+// The oldest one is dropped when full. Not thread safe.
+template <typename T> class ClockIndex {
+public:
+  ClockIndex(size_t max_num = 16) : capacity(max_num) {}
+  void SetCapacity(size_t max_num) {
+    capacity = max_num;
+    Trim();
+  }
+  void Insert(int64_t clock, const T &v) {
+    entries.emplace(clock, v);
+    Trim();
+  }
+  // Return nullptr if no match, the pointer is valid till the next change.
+  const T *Find(int64_t target, int64_t tolerance, JoinPolicy policy,
+                int64_t *clock = nullptr) const {
+    if (entries.empty())
+      return nullptr;
+    auto it = entries.upper_bound(
+        policy == JoinPolicy::LATEST ? target + tolerance : target);
+    if (policy == JoinPolicy::LATEST) {
+      if (it == entries.begin())
+        return nullptr;
+      --it;
+    } else {
+      // the nearest of the two neighbours
+      if (it == entries.end() ||
+          (it != entries.begin() &&
+           target - std::prev(it)->first <= it->first - target))
+        --it;
+      int64_t delta = it->first - target;
+      if (policy == JoinPolicy::EXACT &&
+          (delta > tolerance || -delta > tolerance))
+        return nullptr;
+    }
+    if (clock)
+      *clock = it->first;
+    return &it->second;
+  }
+  // An entry later than the target plus tolerance is in, so that the later
+  // ones will not match better.
+  bool Passed(int64_t target, int64_t tolerance) const {
+    return !entries.empty() && entries.rbegin()->first > target + tolerance;
+  }
+  const T *Oldest(int64_t *clock = nullptr) const {
+    if (entries.empty())
+      return nullptr;
+    if (clock)
+      *clock = entries.begin()->first;
+    return &entries.begin()->second;
+  }
+  void PopOldest() {
+    if (!entries.empty())
+      entries.erase(entries.begin());
+  }
+  // Erase the entries older than the clock, and the one at it if inclusive.
+  void EraseBefore(int64_t clock, bool inclusive = false) {
+    entries.erase(entries.begin(), inclusive ? entries.upper_bound(clock)
+                                             : entries.lower_bound(clock));
+  }
+  void Clear() { entries.clear(); }
+  size_t Size() const { return entries.size(); }
+  bool Empty() const { return entries.empty(); }
+
+private:
+  void Trim() {
+    while (entries.size() > capacity && !entries.empty())
+      entries.erase(entries.begin());
+  }
+
+  std::multimap<int64_t, T> entries;
+  size_t capacity;
+};
+
+// Aligns the buffers of N slots by the atomic clock. The buffers of slot 0
+// are the references, each one is joined with a buffer of every other slot
+// by the policy. A reference waits for the slots without a match till the
+// timeout, unless a slot has passed its clock.
+class _API ClockJoin {
+public:
+  ClockJoin(int slot_num, int64_t tolerance_us, int64_t timeout_us,
+            JoinPolicy policy, size_t max_num = 16);
+  // Buffers without atomic clock are ignored.
+  void Push(int slot, const std::shared_ptr<MediaBuffer> &buffer);
+  // Join the oldest reference. Return false if it is still waiting, or there
+  // is none. The slots without a match are null in out.
+  bool Pop(std::vector<std::shared_ptr<MediaBuffer>> &out);
+  void Clear();
+
+private:
+  struct Reference {
+    std::shared_ptr<MediaBuffer> buffer;
+    int64_t arrival; // us of monotonic clock, for the timeout
+  };
+  int64_t tolerance;
+  int64_t timeout;
+  JoinPolicy policy;
+  ClockIndex<Reference> references;
+  std::vector<ClockIndex<std::shared_ptr<MediaBuffer>>> slots;
+};
+
+JoinPolicy GetJoinPolicyByString(const std::string &policy);
+
+} // namespace easymedia
+
+#endif // #ifndef EASYMEDIA_CLOCK_JOIN_H_
@@ -49,6 +49,11 @@ _API std::list<std::shared_ptr<MediaBuffer>>
 split_h264_separate(const uint8_t *buffer, size_t length, int64_t timestamp);
 _API std::list<std::shared_ptr<MediaBuffer>>
 split_h265_separate(const uint8_t *buffer, size_t length, int64_t timestamp);
+// The same, but views of buffer without copy.
+_API std::list<std::shared_ptr<MediaBuffer>>
+split_h264_separate(MediaBuffer &buffer);
+_API std::list<std::shared_ptr<MediaBuffer>>
+split_h265_separate(MediaBuffer &buffer);
 _API void *GetVpsFromBuffer(std::shared_ptr<MediaBuffer> &mb,
   int &size, CodecType c_type);
 _API void *GetSpsFromBuffer(std::shared_ptr<MediaBuffer> &mb,
@@ -0,0 +1,80 @@
+// Copyright 2019 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef EASYMEDIA_CPU_GOVERNOR_H_
+#define EASYMEDIA_CPU_GOVERNOR_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "utils.h"
+
+namespace easymedia {
+
+class Flow;
+
+// Keeps the cpu usage of the whole process under a budget by degrading the
+// least important work first, instead of dropping frames in whatever queue
+// fills first. Every period, one more step is applied if the usage is over
+// the budget, and the last applied one is reverted once the usage is below
+// the budget by the hysteresis.
+class _API CpuGovernor {
+public:
+  // budget: percent of one cpu, such as 250 for two and a half cores.
+  // hysteresis: percent of the budget.
+  CpuGovernor(int budget, int period_ms = 1000, int hysteresis = 10);
+  // Stop and revert all the applied steps.
+  ~CpuGovernor();
+
+  // The steps are applied in the order they are added, so the least
+  // important one goes first, and reverted in the reverse order.
+  void AddStep(const std::string &name, std::function<void()> degrade,
+               std::function<void()> restore);
+  // Process one of every decimation inputs of the flow, such as 2 to halve
+  // the rate of a detection. The flow is not kept alive by the governor.
+  void AddStep(const std::string &name, std::shared_ptr<Flow> flow,
+               int decimation);
+  void SetBudget(int budget) { cpu_budget = budget; }
+
+  bool Start();
+  void Stop();
+
+  int GetUsage() { return usage; } // percent of one cpu in the last period
+  int GetLevel() { return level; } // number of the applied steps
+
+private:
+  struct Step {
+    std::string name;
+    std::function<void()> degrade;
+    std::function<void()> restore;
+  };
+  void Run();
+  void Update(int64_t cpu_time, int64_t wall_time);
+  void RestoreAll();
+
+  int period;     // ms
+  int hysteresis; // percent of the budget
+  std::atomic_int cpu_budget;
+  std::atomic_int usage;
+  std::atomic_int level;
+  // periods in a row under the budget by the hysteresis
+  int calm_periods;
+  std::mutex mtx; // protects the steps, level changes and quit
+  std::condition_variable cond;
+  std::vector<Step> steps;
+  std::thread *th;
+  bool quit;
+};
+
+} // namespace easymedia
+
+#endif // #ifndef EASYMEDIA_CPU_GOVERNOR_H_
@@ -5,14 +5,22 @@
 #ifndef EASYMEDIA_FLOW_H_
 #define EASYMEDIA_FLOW_H_
 
+#include "flow_stats.h"
 #include "lock.h"
 #include "message.h"
+#include "pacer.h"
 #include "reflector.h"
+#include "ring_queue.h"
 #include "utils.h"
 
+#include <sched.h>
 #include <stdarg.h>
+#include <stdint.h>
 
 #include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <thread>
 #include <type_traits>
 #include <vector>
@@ -36,8 +44,21 @@ DECLARE_REFLECTOR(Flow)
 class MediaBuffer;
 enum class Model { NONE, ASYNCCOMMON, ASYNCATOMIC, SYNC };
 // PushMode
-enum class InputMode { NONE, BLOCKING, DROPFRONT, DROPCURRENT };
+// DROPSTALE drops the front buffer when full as DROPFRONT, and also drops the
+// buffers older than the max age of the slot instead of processing them.
+// The age is from the atomic clock, or from the arrival in the queue if not
+// set, the buffer is left untouched.
+enum class InputMode { NONE, BLOCKING, DROPFRONT, DROPCURRENT, DROPSTALE };
 enum class HoldInputMode { NONE, HOLD_INPUT, INHERIT_FORM_INPUT };
+// Credit of a down flow is the free space of its input queue, limited by the
+// credit of its own down flows on the way to the sinks.
+// What a flow does with a buffer if its down flows have no credit:
+//   NONE: send anyway, the full input queue drops or blocks as its InputMode.
+//   THROTTLE: a source waits until any down flow has credit.
+//   SKIP: a source drops the buffer at once.
+// In both THROTTLE and SKIP, the buffer is not sent to the down flows
+// without credit, so that no work is wasted on a congested branch.
+enum class BackPressure { NONE, THROTTLE, SKIP };
 using MediaBufferVector = std::vector<std::shared_ptr<MediaBuffer>>;
 // TODO: outputs ret, outslot index, outslot queue model
 using FunctionProcess =
@@ -62,24 +83,62 @@ using OutputCallBack = std::add_pointer<void(
     void *handler, std::shared_ptr<MediaBuffer> mb)>::type;
 using EventCallBack = std::add_pointer<void(void *handler, void *data)>::type;
 
+// Scheduling attributes of the thread which runs a coroutine.
+class _API ThreadAttr {
+public:
+  ThreadAttr() : cpu_mask(0), policy(SCHED_OTHER), priority(0), nice(0) {}
+  bool IsDefault() const {
+    return !cpu_mask && policy == SCHED_OTHER && !nice;
+  }
+  uint64_t cpu_mask; // bit n for cpu n, 0 means no pinning
+  int policy;        // SCHED_OTHER, SCHED_FIFO or SCHED_RR
+  int priority;      // 1~99, only for SCHED_FIFO and SCHED_RR
+  int nice;          // -20~19, only for SCHED_OTHER
+};
+
 class _API SlotMap {
 public:
   SlotMap()
       : thread_model(Model::SYNC), mode_when_full(InputMode::DROPFRONT),
-        process(nullptr), interval(16.66f) {}
+        dedicated_thread(false), back_pressure(BackPressure::NONE),
+        batch_num(1), batch_window(0), process(nullptr), interval(16.66f),
+        pace_policy(PacePolicy::CATCHUP) {}
   std::vector<int> input_slots;
   Model thread_model;
   InputMode mode_when_full;
   std::vector<bool> fetch_block; // if ASYNCCOMMON
   std::vector<int> input_maxcachenum;
+  // ms, if ASYNCCOMMON and DROPSTALE, the last one applies to the rest slots
+  std::vector<int> input_max_age;
+  // if ASYNCCOMMON, true if only one producer sends to the input slot
+  std::vector<bool> single_producer;
+  // if ASYNCCOMMON, keep an own thread even if the flow scheduler is enabled.
+  // Set it if the process function may block, such as file or network IO.
+  bool dedicated_thread;
+  // applied when the coroutine thread starts, if not default, the coroutine
+  // never runs on the flow scheduler.
+  ThreadAttr thread_attr;
+  BackPressure back_pressure;
   std::vector<int> output_slots;
   // std::vector<DataSetModel> output_ds_model;
   std::vector<HoldInputMode> hold_input;
+  // If ASYNCCOMMON, fetch up to batch_num buffers in one wakeup and process
+  // them back to back, one buffer per slot and process call as usual.
+  // A coroutine with its own thread, woken by the first buffer, also waits
+  // up to batch_window ms for the rest of the batch, so the input cache num
+  // should be well above the buffers arriving in a window. For high-rate
+  // small buffers such as audio, as the wakeup costs more than the process.
+  int batch_num;
+  int batch_window; // ms
   FunctionProcess process;
-  float interval;
+  float interval; // ms, if ASYNCATOMIC
+  // if ASYNCATOMIC, when a process takes longer than the interval
+  PacePolicy pace_policy;
 };
 
 class FlowCoroutine;
+class CoroutineWaker;
+class FlowWatchdog;
 class _API Flow {
 public:
   // We may need a flow which can be sync and async.
@@ -91,7 +150,12 @@ public:
   // The GetFlowName interface is occupied by the reflector,
   // so GetFlowTag is used to distinguish Flow.
   const char *GetFlowTag() { return flow_tag.c_str(); }
-  void SetFlowTag(std::string tag) { flow_tag = tag; }
+  void SetFlowTag(std::string tag) {
+    flow_tag = tag;
+    trace_name = nullptr;
+  }
+  // The flow tag as a name valid for the whole process, see TraceName.
+  const char *GetTraceName();
 
   // TODO: Right now out_slot_index and in_slot_index is decided by exact
   //       subclass, automatically get these value or ignore them in future.
@@ -102,6 +166,31 @@ public:
   void SendInput(std::shared_ptr<MediaBuffer> &input, int in_slot_index);
   void SetDisable() { enable = false; }
 
+  // Change the scheduling attributes of all coroutine threads of this flow at
+  // runtime. A coroutine on the flow scheduler takes its own thread for non
+  // default attributes. Return -1 if the flow has no thread, such as a sync
+  // flow, or fail to apply, such as no permission for SCHED_FIFO.
+  int SetThreadAttr(const ThreadAttr &attr);
+  // Query the first coroutine thread, cpu_mask is the allowed cpus. Return -1
+  // if every coroutine runs on the flow scheduler or in its producer.
+  int GetThreadAttr(ThreadAttr &attr);
+
+  // Performance counters of this flow and its slots, always enabled.
+  void GetStats(FlowStats &stats);
+  void ResetStats();
+
+  // Process one of every n inputs, the others are released without process,
+  // such as to lower the rate of an analytics under cpu overload.
+  // 1 processes all.
+  void SetDecimation(int n) { decimation = n > 1 ? n : 1; }
+  int GetDecimation() { return decimation; }
+
+  // The number of buffers the out slot can send now without being dropped
+  // or blocked by any down flow on the way to the sinks, INT_MAX if unlimited.
+  int GetCredit(int out_slot_index = 0);
+  void SetBackPressure(BackPressure bp) { back_pressure = bp; }
+  BackPressure GetBackPressure() { return back_pressure; }
+
   // The Control must be called in the same thread to that create flow
   virtual int Control(unsigned long int request _UNUSED, ...) { return -1; }
   virtual int SubControl(unsigned long int request, void *arg, int size = 0) {
@@ -185,24 +274,32 @@ protected:
       return flow == f;
     }
   };
+  using FlowInputMapList = std::vector<FlowInputMap>;
   class FlowMap {
   private:
     void SetOutputBehavior(const std::shared_ptr<MediaBuffer> &output);
     void SetOutputToQueueBehavior(const std::shared_ptr<MediaBuffer> &output);
 
   public:
-    FlowMap() : valid(false), hold_input(HoldInputMode::NONE) {
-      assert(list_mtx.valid);
-    }
+    FlowMap()
+        : valid(false), hold_input(HoldInputMode::NONE),
+          flows(std::make_shared<const FlowInputMapList>()) {}
     FlowMap(FlowMap &&);
     void Init(Model m, HoldInputMode hold_in);
     bool valid;
     HoldInputMode hold_input;
-    // down flow
-    void AddFlow(std::shared_ptr<Flow> flow, int index);
-    void RemoveFlow(std::shared_ptr<Flow> flow);
-    std::list<FlowInputMap> flows;
-    ReadWriteLockMutex list_mtx;
+    // down flow, return the input index the flow was linked to before,
+    // or -1 if it was not linked
+    int AddFlow(std::shared_ptr<Flow> flow, int index);
+    int RemoveFlow(std::shared_ptr<Flow> flow);
+    // The snapshot of down flows, never modified after published.
+    // AddFlow/RemoveFlow swap in a new one, readers just hold a reference.
+    std::shared_ptr<const FlowInputMapList> GetFlows() const {
+      return std::atomic_load(&flows);
+    }
+    std::shared_ptr<const FlowInputMapList> flows;
+    std::mutex list_mtx; // serialize the writers of flows
+    OutputCounter counter;
     std::deque<std::shared_ptr<MediaBuffer>> cached_buffers; // never drop
     std::shared_ptr<MediaBuffer> cached_buffer;
     decltype(&FlowMap::SetOutputBehavior) set_output_behavior;
@@ -218,23 +315,73 @@ protected:
     bool ASyncFullDropCurrentBehavior(volatile bool &pred);
 
   public:
-    Input() : valid(false), flow(nullptr), fetch_block(true) {}
+    Input()
+        : valid(false), flow(nullptr), fetch_block(true), max_age_us(0),
+          overtake_clock(0), batched(false), cached_fetched(true),
+          producers(0), fused(false) {}
     Input(Input &&);
-    void Init(Flow *f, Model m, int mcn, InputMode im, bool f_block,
+    void Init(Flow *f, Model m, int mcn, InputMode im, int max_age_ms,
+              bool f_block, bool single_prod,
               std::shared_ptr<FlowCoroutine> fc);
+    // free space of the queue, INT_MAX if it never drops or blocks
+    int Credit();
+    // A buffer queued, with the time it arrived if DROPSTALE.
+    class QueuedBuffer {
+    public:
+      QueuedBuffer() : arrival(0) {}
+      QueuedBuffer(const std::shared_ptr<MediaBuffer> &b, int64_t t)
+          : buffer(b), arrival(t) {}
+      std::shared_ptr<MediaBuffer> buffer;
+      int64_t arrival; // us of the monotonic clock, 0 if not DROPSTALE
+    };
+    // Older than the max age of DROPSTALE, from the capture time, or else
+    // from the arrival if known. The buffer itself is never stamped, as it
+    // may be shared with the other down flows.
+    bool IsStale(const std::shared_ptr<MediaBuffer> &buffer,
+                 int64_t arrival = 0);
+    void DropStale(const std::shared_ptr<MediaBuffer> &buffer);
+    // The following take both lanes, the high priority one first.
+    bool Pop(std::shared_ptr<MediaBuffer> &buffer, int64_t &arrival);
+    size_t Size() const {
+      return priority_buffers.Size() + cached_buffers.Size();
+    }
+    bool Empty() const { return Size() == 0; }
+    size_t Clear() { return priority_buffers.Clear() + cached_buffers.Clear(); }
+    // A normal buffer older than the last high priority buffer fetched, which
+    // has jumped the queue, such as a predicted frame of the previous gop.
+    bool IsOvertaken(const std::shared_ptr<MediaBuffer> &buffer);
+    void DropOvertaken(const std::shared_ptr<MediaBuffer> &buffer);
     bool valid;
     Flow *flow;
     Model thread_model;
     bool fetch_block;
-    std::deque<std::shared_ptr<MediaBuffer>> cached_buffers;
-    ConditionLockMutex mtx;
+    RingQueue<QueuedBuffer> cached_buffers;
+    // MediaBuffer::Priority::HIGH which found the queue full, never dropped
+    RingQueue<QueuedBuffer> priority_buffers;
     int max_cache_num;
     InputMode mode_when_full;
+    int64_t max_age_us; // 0 if not DROPSTALE
+    // atomic clock of the last high priority buffer fetched, consumer only
+    int64_t overtake_clock;
+    // the coroutine fetches in batches, do not yield to it after each send
+    bool batched;
     std::shared_ptr<MediaBuffer> cached_buffer;
+    // cached_buffer has been fetched, under spin_mtx
+    bool cached_fetched;
     SpinLockMutex spin_mtx;
     decltype(&Input::SyncSendInputBehavior) send_input_behavior;
     decltype(&Input::ASyncFullBlockingBehavior) async_full_behavior;
     std::shared_ptr<FlowCoroutine> coroutine;
+    // wake up the coroutine which fetch this input
+    std::shared_ptr<CoroutineWaker> waker;
+    // wake up the producers blocked by a full queue
+    FutexEvent space_event;
+    InputCounter counter;
+    // number of linked up flows
+    std::atomic_int producers;
+    // run the process in the producer thread instead of queueing
+    std::atomic_bool fused;
+    std::weak_ptr<FlowCoroutine> weak_coroutine; // if ASYNCCOMMON
   };
 
   // Can not change the following values after initialize,
@@ -249,6 +396,9 @@ protected:
   int down_flow_num;
   bool waite_down_flow;
 
+  // jitter of the ASYNCATOMIC coroutines or the pacer of a source
+  PaceCounter pace_counter;
+
   // source flow
   bool SetAsSource(const std::vector<int> &output_slots, FunctionProcess f,
                    const std::string &mark);
@@ -256,6 +406,9 @@ protected:
                       int exp_process_time);
   bool SetOutput(const std::shared_ptr<MediaBuffer> &output,
                  int out_slot_index);
+  // Sources call it before sending a buffer. Return false if the buffer
+  // should be skipped, THROTTLE waits for credit instead.
+  bool CheckSourceCredit(int out_slot_index = 0);
   bool ParseWrapFlowParams(const char *param,
                            std::map<std::string, std::string> &flow_params,
                            std::list<std::string> &sub_param_list);
@@ -276,12 +429,33 @@ protected:
 private:
   volatile bool enable;
   volatile bool quit;
-  ConditionLockMutex cond_mtx;
+
+  Histogram process_time;
+  Histogram process_cpu_time;
+  std::atomic<uint64_t> process_failed;
+
+  std::atomic_int decimation;
+  std::atomic<uint32_t> decimation_count;
+  std::atomic<uint64_t> decimated;
+  // Return true if the next input should be released without process.
+  bool Decimate();
+
+  // flow tag interned for tracing, looked up at the first traced event
+  std::atomic<const char *> trace_name;
+
+  BackPressure back_pressure;
+  void UpdateFusion(int out_slot_index);
+  // neck is the input which limits the credit, if no credit
+  int GetOutputCredit(int out_slot_index, int depth,
+                      std::shared_ptr<Flow> &neck_flow, int &neck_slot);
+  int GetInputCredit(int in_slot_index, int depth,
+                     std::shared_ptr<Flow> &neck_flow, int &neck_slot);
 
   // event handler
   std::unique_ptr<EventHandler> event_handler_;
 
   friend class FlowCoroutine;
+  friend class FlowWatchdog;
 
   LinkVideoHandler link_video_handler_;
   LinkAudioHandler link_audio_handler_;
@@ -309,6 +483,9 @@ private:
 std::string gen_datatype_rule(std::map<std::string, std::string> &params);
 Model GetModelByString(const std::string &model);
 InputMode GetInputModelByString(const std::string &in_model);
+BackPressure GetBackPressureByString(const std::string &bp);
+PacePolicy GetPacePolicyByString(const std::string &policy);
+int GetSchedPolicyByString(const std::string &policy);
 _API void ParseParamToSlotMap(std::map<std::string, std::string> &params,
                               SlotMap &sm, int &input_maxcachenum);
 size_t FlowOutputHoldInput(std::shared_ptr<MediaBuffer> &out_buffer,
@@ -316,6 +493,57 @@ size_t FlowOutputHoldInput(std::shared_ptr<MediaBuffer> &out_buffer,
 size_t FlowOutputInheritFromInput(std::shared_ptr<MediaBuffer> &out_buffer,
                                   const MediaBufferVector &input_vector);
 
+// Run the ASYNCCOMMON coroutines of flows created afterwards as tasks of a
+// shared worker pool, instead of one thread per coroutine. A task is
+// dispatched to the pool when any of its inputs gets a buffer.
+// worker_num <= 0 means the number of online cpus.
+// It can also be enabled by env RKMEDIA_FLOW_SCHEDULER=<worker_num>.
+// SlotMap::dedicated_thread opts out a coroutine, ASYNCATOMIC coroutines
+// always keep their own threads. A coroutine linked to a BLOCKING input
+// leaves the pool for its own thread, as a worker blocked in the push may
+// wait for a task which no other worker is free to run.
+_API bool EnableFlowScheduler(int worker_num = 0);
+// The running pool quits after all of its coroutines are gone.
+_API void DisableFlowScheduler();
+
+// Fuse the links made afterwards, if the link is the only one of the out slot
+// and of the down input, and the down flow is an ASYNCCOMMON flow with one
+// input slot. The producer then runs the process of the down flow directly
+// instead of queueing, so a linear chain runs in one thread like SYNC flows,
+// and queueing only happens at the fan-out or fan-in points.
+// A fused input never drops, it slows down the producer instead.
+// Down flows with thread attributes are never fused, neither are the
+// dedicated_thread ones into a producer running on the flow scheduler.
+// It can also be enabled by env RKMEDIA_FLOW_FUSION=1.
+_API void EnableFlowFusion(bool enable);
+
+// A coroutine without progress, reported by the flow watchdog.
+class _API FlowStall {
+public:
+  const char *flow_tag; // valid for the whole process
+  // the input with pending buffers, or -1 if stuck in the process
+  int in_slot;
+  uint32_t depth;        // pending buffers of in_slot
+  int64_t stalled_us;    // in the process, or without progress, for so long
+  int64_t buffer_age_us; // age of the buffer in process, -1 if unknown
+  // not null if blocked in a push to a full input of a down flow
+  const char *down_flow;
+  int down_slot;
+  int64_t blocked_us;
+  bool recovered; // makes progress again after the stall is reported
+};
+using FlowStallHandler = std::function<void(const FlowStall &)>;
+
+// Check the coroutines of all flows on a monitor thread, and report the ones
+// in a process for longer than stall_ms, or with pending input but no process
+// for longer than stall_ms. A stall is reported once, and again once it
+// recovers. Reports are logged and passed to the handler, which must not
+// block or destroy flows.
+// It can also be enabled by env RKMEDIA_FLOW_WATCHDOG=<stall_ms>.
+_API bool EnableFlowWatchdog(int stall_ms,
+                             FlowStallHandler handler = nullptr);
+_API void DisableFlowWatchdog();
+
 // the separator of flow params and flow core element params
 #define FLOW_PARAM_SEPARATE_CHAR ' '
 _API std::string JoinFlowParam(const std::string &flow_param, size_t num_elem,
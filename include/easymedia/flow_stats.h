@@ -0,0 +1,153 @@
+// Copyright 2019 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef EASYMEDIA_FLOW_STATS_H_
+#define EASYMEDIA_FLOW_STATS_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <vector>
+
+#include "utils.h"
+
+namespace easymedia {
+
+// Log2 buckets of microseconds. Bucket 0 counts 0us, bucket i counts
+// [2^(i-1), 2^i) us, the last bucket also counts all the larger values.
+#define FLOW_HISTOGRAM_BUCKETS 26
+
+class _API HistogramInfo {
+public:
+  HistogramInfo();
+  int64_t Average() const { return count ? (int64_t)(sum / count) : 0; }
+  // The upper bound of the bucket where the p percent values fall below.
+  int64_t Percentile(double p) const;
+
+  uint64_t count;
+  uint64_t sum;
+  uint64_t max;
+  uint64_t buckets[FLOW_HISTOGRAM_BUCKETS];
+};
+
+// Always on, updated with relaxed atomic operations only.
+class _API Histogram {
+public:
+  Histogram() { Reset(); }
+  void Add(int64_t v) {
+    uint64_t u = v > 0 ? (uint64_t)v : 0;
+    int idx = u ? 64 - __builtin_clzll(u) : 0;
+    if (idx >= FLOW_HISTOGRAM_BUCKETS)
+      idx = FLOW_HISTOGRAM_BUCKETS - 1;
+    buckets[idx].fetch_add(1, std::memory_order_relaxed);
+    count.fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(u, std::memory_order_relaxed);
+    uint64_t m = max.load(std::memory_order_relaxed);
+    while (u > m &&
+           !max.compare_exchange_weak(m, u, std::memory_order_relaxed))
+      ;
+  }
+  void Get(HistogramInfo &info) const;
+  void Reset();
+
+private:
+  std::atomic<uint64_t> count;
+  std::atomic<uint64_t> sum;
+  std::atomic<uint64_t> max;
+  std::atomic<uint64_t> buckets[FLOW_HISTOGRAM_BUCKETS];
+};
+
+class _API InputStats {
+public:
+  InputStats();
+  uint64_t received;       // buffers sent to this input
+  uint64_t drop_front;     // dropped by InputMode::DROPFRONT
+  uint64_t drop_current;   // dropped by InputMode::DROPCURRENT
+  uint64_t drop_stale;     // older than the max age of InputMode::DROPSTALE
+  uint64_t drop_overtaken; // older than a high priority buffer served first
+  uint64_t replaced;       // replaced by Model::ASYNCATOMIC before fetched
+  uint64_t high_priority;  // buffers queued in the high priority lane
+  uint64_t blocked;        // times the producer blocked by InputMode::BLOCKING
+  uint64_t blocked_us;     // total time the producers blocked
+  uint32_t depth;          // buffers in queue now
+  uint32_t peak_depth;
+  uint32_t capacity;
+  HistogramInfo inter_arrival; // us between two received buffers
+};
+
+class _API OutputStats {
+public:
+  OutputStats();
+  uint64_t buffers;      // buffers output by process
+  uint64_t sent;         // buffers sent, once per down flow
+  uint64_t null_sent;    // empty buffers sent when process fails
+  uint32_t fan_out;      // down flow number now
+  uint64_t skipped;      // not sent to a down flow for lack of credit
+  uint64_t throttled_us; // time a source waited for credit
+};
+
+class _API FlowStats {
+public:
+  FlowStats() : process_failed(0), pace_skipped(0), decimated(0) {}
+  HistogramInfo process_time; // us of each process
+  // us of the thread cpu time of each process, including the sync flows
+  // run inside, so it is less than process_time when the process waits
+  HistogramInfo process_cpu_time;
+  uint64_t process_failed;
+  HistogramInfo pace_jitter; // us of the wakeup later than the deadline
+  uint64_t pace_skipped;     // periods skipped for being late
+  uint64_t decimated;        // inputs released without process by decimation
+  std::vector<InputStats> inputs;
+  std::vector<OutputStats> outputs;
+};
+
+class InputCounter {
+public:
+  InputCounter() { Reset(); }
+  void Arrive(int64_t now) {
+    received.fetch_add(1, std::memory_order_relaxed);
+    int64_t last = last_arrival.exchange(now, std::memory_order_relaxed);
+    if (last > 0)
+      inter_arrival.Add(now - last);
+  }
+  void UpdateDepth(uint32_t depth) {
+    uint32_t m = peak_depth.load(std::memory_order_relaxed);
+    while (depth > m &&
+           !peak_depth.compare_exchange_weak(m, depth,
+                                             std::memory_order_relaxed))
+      ;
+  }
+  void Get(InputStats &stats) const;
+  void Reset();
+
+  std::atomic<uint64_t> received;
+  std::atomic<uint64_t> drop_front;
+  std::atomic<uint64_t> drop_current;
+  std::atomic<uint64_t> drop_stale;
+  std::atomic<uint64_t> drop_overtaken;
+  std::atomic<uint64_t> replaced;
+  std::atomic<uint64_t> high_priority;
+  std::atomic<uint64_t> blocked;
+  std::atomic<uint64_t> blocked_us;
+  std::atomic<uint32_t> peak_depth;
+  std::atomic<int64_t> last_arrival;
+  Histogram inter_arrival;
+};
+
+class OutputCounter {
+public:
+  OutputCounter() { Reset(); }
+  void Get(OutputStats &stats) const;
+  void Reset();
+
+  std::atomic<uint64_t> buffers;
+  std::atomic<uint64_t> sent;
+  std::atomic<uint64_t> null_sent;
+  std::atomic<uint64_t> skipped;
+  std::atomic<uint64_t> throttled_us;
+};
+
+} // namespace easymedia
+
+#endif // #ifndef EASYMEDIA_FLOW_STATS_H_
@@ -127,6 +127,10 @@
 #define KEY_CHANNEL_NAME "channel_name"
 
 #define KEY_MEM_CNT "mem_cnt"
+// The pool grows on demand from mem_cnt up to mem_max_cnt buffers, and frees
+// the ones beyond mem_cnt not needed for mem_idle_time ms.
+#define KEY_MEM_MAX_CNT "mem_max_cnt"
+#define KEY_MEM_IDLE_TIME "mem_idle_time"
 #define KEY_MEM_TYPE "mem_type"
 #define KEY_MEM_ION "ion"
 #define KEY_MEM_DRM "drm"
@@ -134,6 +138,10 @@
 
 #define KEY_MEM_SIZE_PERTIME "size_pertime"
 
+// buffer share, the unix socket and the buffers held by a consumer at most
+#define KEY_SHARE_PATH "share_path"
+#define KEY_SHARE_CREDITS "share_credits"
+
 #define KEY_LOOP_TIME "loop_time"
 
 // flow
@@ -146,12 +154,49 @@
 #define KEY_BLOCKING "blocking"
 #define KEY_DROPFRONT "dropfront"
 #define KEY_DROPCURRENT "dropcurrent"
+#define KEY_DROPSTALE "dropstale"
 
 #define KEY_INPUT_CACHE_NUM "input_cache_num"
+#define KEY_INPUT_MAX_AGE "input_max_age" // ms, if dropstale
 #define KEY_OUTPUT_CACHE_NUM "output_cache_num"
 
 #define KEY_OUTPUT_HOLD_INPUT "output_hold_input"
 
+// 1: never run on the shared flow scheduler
+#define KEY_DEDICATED_THREAD "dedicated_thread"
+
+// flow thread attributes, cpu affinity is a bit mask string, such as "0x3"
+#define KEY_CPU_AFFINITY "cpu_affinity"
+#define KEY_SCHED_POLICY "sched_policy"
+#define KEY_SCHED_OTHER "other"
+#define KEY_SCHED_FIFO "fifo"
+#define KEY_SCHED_RR "rr"
+#define KEY_SCHED_PRIORITY "sched_priority"
+#define KEY_NICE "nice"
+
+// buffers fetched in one wakeup, and the ms to wait for them, see SlotMap
+#define KEY_BATCH_NUM "batch_num"
+#define KEY_BATCH_WINDOW "batch_window"
+
+// what to do when the down flows have no credit, see BackPressure
+#define KEY_BACKPRESSURE "backpressure"
+#define KEY_BP_THROTTLE "throttle"
+#define KEY_BP_SKIP "skip"
+
+// what a paced loop does when it is late, see PacePolicy
+#define KEY_PACE_POLICY "pace_policy"
+#define KEY_PACE_CATCHUP "catchup"
+#define KEY_PACE_SKIP "skip"
+
+// clock join flow, aligns the inputs to input 0, see JoinPolicy
+#define KEY_JOIN_INPUT_NUM "join_input_num"
+#define KEY_JOIN_TOLERANCE "join_tolerance" // ms of clock skew
+#define KEY_JOIN_TIMEOUT "join_timeout"     // ms
+#define KEY_JOIN_POLICY "join_policy"
+#define KEY_JOIN_EXACT "exact"
+#define KEY_JOIN_NEAREST "nearest"
+#define KEY_JOIN_LATEST "latest"
+
 // muxer flow
 #define KEY_FILE_PREFIX "file_prefix"
 #define KEY_FILE_SUFFIX "file_suffix"
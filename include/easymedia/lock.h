@@ -7,6 +7,7 @@
 
 #include <assert.h>
 #include <pthread.h>
+#include <stdint.h>
 
 #include <atomic>
 #include <condition_variable>
@@ -78,6 +79,29 @@ private:
   std::atomic_flag flag;
 };
 
+// Futex based event count, one or more threads wait for a condition which is
+// changed by lock-free producers. Usage of waiter:
+//   uint32_t key = ev.prepare_wait();
+//   if (condition is satisfied) { ev.cancel_wait(); return; }
+//   ev.wait(key);
+// A notify between prepare_wait and wait is never lost. Notify costs only
+// two atomic operations if nobody is sleeping.
+class FutexEvent {
+public:
+  FutexEvent() : seq(0), waiters(0) {}
+  FutexEvent(const FutexEvent &) = delete;
+  FutexEvent &operator=(const FutexEvent &) = delete;
+  uint32_t prepare_wait();
+  void cancel_wait();
+  // timeout_ms < 0 means wait forever, return false if timeout.
+  bool wait(uint32_t key, int timeout_ms = -1);
+  void notify(bool all = true);
+
+private:
+  std::atomic<uint32_t> seq;
+  std::atomic_int waiters;
+};
+
 class AutoLockMutex {
 public:
   AutoLockMutex(LockMutex &lm) : m_lm(lm) { m_lm.lock(); }
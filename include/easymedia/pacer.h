@@ -0,0 +1,58 @@
+// Copyright 2019 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef EASYMEDIA_PACER_H_
+#define EASYMEDIA_PACER_H_
+
+#include <stdint.h>
+
+#include <atomic>
+
+#include "flow_stats.h"
+
+namespace easymedia {
+
+// What a pacer does with the periods already passed when the loop is late:
+//   CATCHUP: run them back to back until on time again, at most
+//            PACER_MAX_CATCHUP periods, the older ones are skipped.
+//   SKIP: skip them all and wait for the next deadline.
+enum class PacePolicy { CATCHUP, SKIP };
+
+#define PACER_MAX_CATCHUP 8
+
+class PaceCounter {
+public:
+  PaceCounter() { Reset(); }
+  void Reset() {
+    jitter.Reset();
+    skipped.store(0, std::memory_order_relaxed);
+  }
+
+  Histogram jitter; // us of the wakeup later than the deadline
+  std::atomic<uint64_t> skipped;
+};
+
+// Paces a loop on absolute deadlines of the monotonic clock, so that the time
+// spent in each period does not accumulate into drift.
+class _API Pacer {
+public:
+  Pacer(int64_t period_us = 0, PacePolicy policy = PacePolicy::CATCHUP,
+        PaceCounter *counter = nullptr);
+  void SetPeriod(int64_t period_us);
+  void SetPolicy(PacePolicy policy) { pace_policy = policy; }
+  // Restart, the next deadline is one period after the next Wait.
+  void Reset() { deadline = 0; }
+  // Sleep until the next deadline. Return the number of periods skipped.
+  int Wait();
+
+private:
+  int64_t period;
+  int64_t deadline; // us of CLOCK_MONOTONIC, 0 if not started
+  PacePolicy pace_policy;
+  PaceCounter *counter;
+};
+
+} // namespace easymedia
+
+#endif // #ifndef EASYMEDIA_PACER_H_
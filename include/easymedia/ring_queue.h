@@ -0,0 +1,147 @@
+// Copyright 2019 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef EASYMEDIA_RING_QUEUE_H_
+#define EASYMEDIA_RING_QUEUE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <utility>
+
+namespace easymedia {
+
+// Bounded lock-free queue, based on Dmitry Vyukov's bounded mpmc queue.
+// Every cell carries a sequence number, so producers and consumers never
+// take a lock. Pop is always multi-consumer safe, as a producer may pop the
+// front itself when the queue is full (InputMode::DROPFRONT).
+// If the queue is known to have only one producer, the producer side skips
+// the CAS on the enqueue position.
+enum class RingProducer { SINGLE, MULTI };
+
+template <typename T> class RingQueue {
+public:
+  RingQueue()
+      : cells(nullptr), mask(0), limit(0), producer(RingProducer::MULTI),
+        enqueue_pos(0), dequeue_pos(0) {}
+  ~RingQueue() { delete[] cells; }
+  RingQueue(const RingQueue &) = delete;
+  RingQueue &operator=(const RingQueue &) = delete;
+
+  // max_num is the exact number of elements the queue can hold,
+  // the cells are rounded up to power of 2.
+  bool Init(size_t max_num, RingProducer prod = RingProducer::MULTI) {
+    if (cells || max_num == 0)
+      return false;
+    size_t cell_num = 1;
+    while (cell_num < max_num)
+      cell_num <<= 1;
+    cells = new Cell[cell_num];
+    if (!cells)
+      return false;
+    for (size_t i = 0; i < cell_num; i++)
+      cells[i].sequence.store(i, std::memory_order_relaxed);
+    mask = cell_num - 1;
+    limit = max_num;
+    producer = prod;
+    enqueue_pos.store(0, std::memory_order_relaxed);
+    dequeue_pos.store(0, std::memory_order_relaxed);
+    return true;
+  }
+  bool Valid() const { return cells != nullptr; }
+
+  // Return false if queue is full, v is untouched in this case.
+  bool Push(const T &v) {
+    Cell *cell;
+    size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+    for (;;) {
+      intptr_t used =
+          (intptr_t)(pos - dequeue_pos.load(std::memory_order_acquire));
+      if (used >= (intptr_t)limit)
+        return false;
+      cell = &cells[pos & mask];
+      size_t seq = cell->sequence.load(std::memory_order_acquire);
+      intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+      if (dif == 0) {
+        if (producer == RingProducer::SINGLE) {
+          enqueue_pos.store(pos + 1, std::memory_order_relaxed);
+          break;
+        }
+        if (enqueue_pos.compare_exchange_weak(pos, pos + 1,
+                                              std::memory_order_relaxed))
+          break;
+      } else if (dif < 0) {
+        return false;
+      } else {
+        pos = enqueue_pos.load(std::memory_order_relaxed);
+      }
+    }
+    cell->data = v;
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Return false if queue is empty.
+  bool Pop(T &v) {
+    Cell *cell;
+    size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+    for (;;) {
+      cell = &cells[pos & mask];
+      size_t seq = cell->sequence.load(std::memory_order_acquire);
+      intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+      if (dif == 0) {
+        if (dequeue_pos.compare_exchange_weak(pos, pos + 1,
+                                              std::memory_order_relaxed))
+          break;
+      } else if (dif < 0) {
+        return false;
+      } else {
+        pos = dequeue_pos.load(std::memory_order_relaxed);
+      }
+    }
+    v = std::move(cell->data);
+    cell->data = T(); // release the element as soon as possible
+    cell->sequence.store(pos + mask + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Drop all elements, return the number of dropped.
+  size_t Clear() {
+    size_t cnt = 0;
+    T v;
+    while (Pop(v))
+      cnt++;
+    return cnt;
+  }
+
+  // The following are snapshots, they may be stale once returned.
+  size_t Size() const {
+    intptr_t used = (intptr_t)(enqueue_pos.load(std::memory_order_acquire) -
+                               dequeue_pos.load(std::memory_order_acquire));
+    return used > 0 ? (size_t)used : 0;
+  }
+  bool Empty() const { return Size() == 0; }
+  bool Full() const { return Size() >= limit; }
+  size_t Capacity() const { return limit; }
+
+private:
+  struct Cell {
+    std::atomic<size_t> sequence;
+    T data;
+  };
+  Cell *cells;
+  size_t mask;
+  size_t limit;
+  RingProducer producer;
+  // keep producer and consumer positions in different cache lines
+  char pad0[64];
+  std::atomic<size_t> enqueue_pos;
+  char pad1[64 - sizeof(std::atomic<size_t>)];
+  std::atomic<size_t> dequeue_pos;
+};
+
+} // namespace easymedia
+
+#endif // #ifndef EASYMEDIA_RING_QUEUE_H_
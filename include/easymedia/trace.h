@@ -0,0 +1,56 @@
+// Copyright 2019 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef EASYMEDIA_TRACE_H_
+#define EASYMEDIA_TRACE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+#include "utils.h"
+
+namespace easymedia {
+
+// Latency tracing of buffers passing through flows.
+// A buffer is identified by its trace frame, the capture time set by the
+// source (such as the v4l2 timestamp) or the time it enters the first flow.
+// Output buffers of a flow inherit the trace frame of its inputs, so the
+// events of one frame can be followed from the source to the sinks. The
+// atomic clock of the buffers is left untouched.
+// Events are recorded into a fixed size ring of each thread without any lock,
+// the oldest events are overwritten when the ring is full.
+enum class TraceType : uint8_t {
+  CAPTURE,       // buffer enters the flows
+  ENQUEUE,       // buffer is sent to a flow input slot
+  DEQUEUE,       // buffer is taken by the flow to process
+  DROP,          // buffer is dropped by the input slot
+  PROCESS_BEGIN, // flow process starts
+  PROCESS_END,   // flow process ends
+};
+
+#define TRACE_DEFAULT_EVENTS_PER_THREAD 16384
+
+// Start recording. events_per_thread applies to the rings of new threads,
+// 0 means TRACE_DEFAULT_EVENTS_PER_THREAD.
+// It can also be enabled by env RKMEDIA_TRACE=<events_per_thread>.
+_API void EnableTrace(size_t events_per_thread = 0);
+_API void DisableTrace();
+_API bool IsTraceEnabled();
+// Return a name pointer valid for the whole process, to be used in events.
+_API const char *TraceName(const std::string &name);
+// ts is monotonic time in us, 0 means now.
+_API void TraceRecord(TraceType type, const char *name, int slot,
+                      int64_t frame, int64_t ts = 0);
+// Discard all recorded events.
+_API void ClearTrace();
+// Write recorded events of all threads to path in chrome trace event format,
+// which can be loaded by chrome://tracing or perfetto.
+// Return the number of events written, or -1 on failure.
+_API int DumpTrace(const char *path);
+
+} // namespace easymedia
+
+#endif // #ifndef EASYMEDIA_TRACE_H_
@@ -47,6 +47,8 @@ public:
   static const bool Result = (sizeof(int) == sizeof(t((T *)nullptr)));
 };
 
+#include <time.h>
+
 #include <list>
 #include <map>
 #include <string>
@@ -123,6 +125,21 @@ _API inline int64_t gettimeofday() {
   return us.count();
 }
 
+// return microseconds of the monotonic clock, for durations
+_API inline int64_t getmonotonictime() {
+  std::chrono::microseconds us =
+      std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now().time_since_epoch());
+  return us.count();
+}
+
+// return microseconds of the cpu time consumed by the calling thread
+_API inline int64_t getthreadcputime() {
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
 _API inline void msleep(int ms) {
   std::this_thread::sleep_for(std::chrono::milliseconds(ms));
 }
@@ -70,6 +70,95 @@ _CAPI RK_S32 RK_MPI_SYS_SendMediaBuffer(MOD_ID_E enModID, RK_S32 s32ChnID,
 _CAPI MEDIA_BUFFER RK_MPI_SYS_GetMediaBuffer(MOD_ID_E enModID, RK_S32 s32ChnID,
                                              RK_S32 s32MilliSec);
 
+// Performance statistics of the channel flow.
+// Histogram bucket 0 counts 0us, bucket i counts [2^(i-1), 2^i) us,
+// the last bucket also counts all the larger values.
+#define RK_HISTOGRAM_BUCKETS 26
+#define RK_CHN_STAT_MAX_SLOT 4
+
+typedef struct rkHISTOGRAM_S {
+  RK_U64 u64Count;
+  RK_U64 u64SumUs;
+  RK_U64 u64MaxUs;
+  RK_U64 au64Buckets[RK_HISTOGRAM_BUCKETS];
+} HISTOGRAM_S;
+
+typedef struct rkCHN_INPUT_STAT_S {
+  RK_U64 u64Received;
+  RK_U64 u64DropFront;     // dropped by dropfront input mode
+  RK_U64 u64DropCurrent;   // dropped by dropcurrent input mode
+  RK_U64 u64DropStale;     // older than the max age of dropstale input mode
+  RK_U64 u64DropOvertaken; // older than a high priority buffer served first
+  RK_U64 u64Replaced;      // replaced before fetched by a latest only input
+  RK_U64 u64HighPriority;  // buffers queued in the high priority lane
+  RK_U64 u64Blocked;       // times the sender blocked by blocking input mode
+  RK_U64 u64BlockedUs;
+  RK_U32 u32Depth;
+  RK_U32 u32PeakDepth;
+  RK_U32 u32Capacity;
+  HISTOGRAM_S stInterArrival;
+} CHN_INPUT_STAT_S;
+
+typedef struct rkCHN_OUTPUT_STAT_S {
+  RK_U64 u64Buffers;
+  RK_U64 u64Sent; // once per down flow
+  RK_U64 u64NullSent;
+  RK_U64 u64Skipped; // not sent to a down channel for lack of credit
+  RK_U64 u64ThrottledUs;
+  RK_U32 u32FanOut;
+} CHN_OUTPUT_STAT_S;
+
+typedef struct rkCHN_STAT_S {
+  HISTOGRAM_S stProcessTime;
+  HISTOGRAM_S stProcessCpuTime; // thread cpu time of each process
+  RK_U64 u64ProcessFailed;
+  HISTOGRAM_S stPaceJitter; // wakeup later than the deadline of fps pacing
+  RK_U64 u64PaceSkipped;    // periods skipped for being late
+  RK_U64 u64Decimated;      // inputs released without process by decimation
+  RK_U32 u32InputNum;  // at most RK_CHN_STAT_MAX_SLOT are filled
+  RK_U32 u32OutputNum; // at most RK_CHN_STAT_MAX_SLOT are filled
+  CHN_INPUT_STAT_S astInput[RK_CHN_STAT_MAX_SLOT];
+  CHN_OUTPUT_STAT_S astOutput[RK_CHN_STAT_MAX_SLOT];
+} CHN_STAT_S;
+
+_CAPI RK_S32 RK_MPI_SYS_GetChnStat(const MPP_CHN_S *pstChn,
+                                   CHN_STAT_S *pstStat);
+_CAPI RK_S32 RK_MPI_SYS_ResetChnStat(const MPP_CHN_S *pstChn);
+
+// Process one of every u32Decimation inputs of the channel, 1 processes all.
+_CAPI RK_S32 RK_MPI_SYS_SetChnDecimation(const MPP_CHN_S *pstChn,
+                                         RK_U32 u32Decimation);
+
+// Keep the cpu usage of the process under u32BudgetPercent of one cpu, by
+// applying the degrade steps one per period while over the budget, in the
+// order they are added, and reverting them in the reverse order once the
+// usage drops below the budget by u32Hysteresis percent.
+_CAPI RK_S32 RK_MPI_SYS_StartCpuGovernor(RK_U32 u32BudgetPercent,
+                                         RK_U32 u32PeriodMs,
+                                         RK_U32 u32Hysteresis);
+// Revert all the applied steps and remove them.
+_CAPI RK_S32 RK_MPI_SYS_StopCpuGovernor();
+// A degrade step which decimates the channel, such as 2 to halve the rate
+// of a detection. Add the least important one first, after the governor
+// starts.
+_CAPI RK_S32 RK_MPI_SYS_AddCpuDegradeStep(const MPP_CHN_S *pstChn,
+                                          RK_U32 u32Decimation);
+// pu32Level is the number of the applied steps.
+_CAPI RK_S32 RK_MPI_SYS_GetCpuGovernorState(RK_U32 *pu32UsagePercent,
+                                            RK_U32 *pu32Level);
+
+// Log the channels in a process, or with pending input but no process, for
+// longer than u32StallMs, with the channel blocking its send if any.
+_CAPI RK_S32 RK_MPI_SYS_StartWatchdog(RK_U32 u32StallMs);
+_CAPI RK_S32 RK_MPI_SYS_StopWatchdog();
+
+// Latency tracing of buffers through all channels.
+// u32EventsPerThread is the ring size of each thread, 0 means default.
+_CAPI RK_S32 RK_MPI_SYS_StartTrace(RK_U32 u32EventsPerThread);
+_CAPI RK_S32 RK_MPI_SYS_StopTrace();
+// Write the recorded events to a chrome trace event json file.
+_CAPI RK_S32 RK_MPI_SYS_DumpTrace(const RK_CHAR *pcFilePath);
+
 /********************************************************************
  * Vi api
  ********************************************************************/
@@ -6,11 +6,20 @@
 
 #include <assert.h>
 #include <fcntl.h>
+#include <stdio.h>
 #include <string.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <iterator>
+#include <map>
+#include <mutex>
+
 #include "key_string.h"
 #include "utils.h"
 
@@ -39,15 +48,230 @@ static int free_common_memory(void *buffer) {
   return 0;
 }
 
+#define HUGEPAGE_SIZE (2 * 1024 * 1024)
+// The unit of the chunks, so that the free ranges stay few.
+#define HUGEPAGE_ARENA_ALIGN (64 * 1024)
+
+HugePageArenaStats::HugePageArenaStats()
+    : reserved(0), hugetlb(false), min_size(0), used(0), peak_used(0),
+      chunks(0), allocs(0), fallbacks(0) {}
+
+// A region of hugepages reserved and faulted in once, which the large common
+// buffers are carved out of, instead of fresh malloc pages faulted in 4KB at
+// a time on each first touch. It outlives its release while chunks are lent.
+class HugePageArena {
+public:
+  struct Chunk {
+    std::shared_ptr<HugePageArena> arena;
+    size_t offset;
+    size_t size;
+  };
+
+  HugePageArena(size_t min)
+      : base(MAP_FAILED), size(0), hugetlb(false), min_size(min), used(0),
+        peak_used(0), chunks(0), allocs(0), fallbacks(0) {}
+  ~HugePageArena() {
+    if (base != MAP_FAILED)
+      munmap(base, size);
+  }
+  bool Reserve(size_t bytes);
+  // nullptr if it does not fit, to allocate elsewhere
+  void *Alloc(size_t bytes, Chunk *chunk);
+  void Free(Chunk *chunk);
+  size_t GetMinSize() const { return min_size; }
+  void GetStats(HugePageArenaStats &stats);
+
+private:
+  std::mutex mtx;
+  void *base;
+  size_t size;
+  bool hugetlb;
+  size_t min_size;
+  std::map<size_t, size_t> free_ranges; // offset -> size
+  size_t used;
+  size_t peak_used;
+  int chunks;
+  uint64_t allocs;
+  uint64_t fallbacks;
+};
+
+bool HugePageArena::Reserve(size_t bytes) {
+  size = UPALIGNTO(bytes, (size_t)HUGEPAGE_SIZE);
+#ifdef MAP_HUGETLB
+  // the explicit hugepages, if reserved in /proc/sys/vm/nr_hugepages
+  base = mmap(NULL, size, PROT_READ | PROT_WRITE,
+              MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+  hugetlb = (base != MAP_FAILED);
+#endif
+  if (base == MAP_FAILED) {
+    // else the transparent ones, which need the region aligned to them
+    size_t len = size + HUGEPAGE_SIZE;
+    uint8_t *p = (uint8_t *)mmap(NULL, len, PROT_READ | PROT_WRITE,
+                                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+      LOG("Fail to reserve hugepage arena of %zu bytes: %m\n", size);
+      return false;
+    }
+    uint8_t *aligned = (uint8_t *)UPALIGNTO((uintptr_t)p, HUGEPAGE_SIZE);
+    if (aligned > p)
+      munmap(p, aligned - p);
+    if (aligned + size < p + len)
+      munmap(aligned + size, p + len - aligned - size);
+    base = aligned;
+#ifdef MADV_HUGEPAGE
+    if (madvise(base, size, MADV_HUGEPAGE))
+      LOG("hugepage arena: transparent hugepages not available: %m\n");
+#endif
+    // fault in now rather than on the first frames
+    memset(base, 0, size);
+  }
+  free_ranges[0] = size;
+  LOG("hugepage arena: %zu bytes of %s hugepages, from %zu bytes buffers\n",
+      size, hugetlb ? "explicit" : "transparent", min_size);
+  return true;
+}
+
+void *HugePageArena::Alloc(size_t bytes, Chunk *chunk) {
+  size_t need = UPALIGNTO(bytes, (size_t)HUGEPAGE_ARENA_ALIGN);
+  std::lock_guard<std::mutex> _lg(mtx);
+  // the lowest fit, the frames of the same size then pack together
+  for (auto it = free_ranges.begin(); it != free_ranges.end(); ++it) {
+    if (it->second < need)
+      continue;
+    size_t offset = it->first;
+    size_t left = it->second - need;
+    free_ranges.erase(it);
+    if (left > 0)
+      free_ranges[offset + need] = left;
+    chunk->offset = offset;
+    chunk->size = need;
+    used += need;
+    peak_used = std::max(peak_used, used);
+    chunks++;
+    allocs++;
+    return (uint8_t *)base + offset;
+  }
+  fallbacks++;
+  return nullptr;
+}
+
+void HugePageArena::Free(Chunk *chunk) {
+  std::lock_guard<std::mutex> _lg(mtx);
+  size_t offset = chunk->offset;
+  size_t len = chunk->size;
+  used -= len;
+  chunks--;
+  // merge with the free neighbours
+  auto next = free_ranges.lower_bound(offset);
+  if (next != free_ranges.end() && offset + len == next->first) {
+    len += next->second;
+    next = free_ranges.erase(next);
+  }
+  if (next != free_ranges.begin()) {
+    auto prev = std::prev(next);
+    if (prev->first + prev->second == offset) {
+      prev->second += len;
+      return;
+    }
+  }
+  free_ranges[offset] = len;
+}
+
+void HugePageArena::GetStats(HugePageArenaStats &stats) {
+  std::lock_guard<std::mutex> _lg(mtx);
+  stats.reserved = size;
+  stats.hugetlb = hugetlb;
+  stats.min_size = min_size;
+  stats.used = used;
+  stats.peak_used = peak_used;
+  stats.chunks = chunks;
+  stats.allocs = allocs;
+  stats.fallbacks = fallbacks;
+}
+
+static std::mutex hugepage_arena_mtx;
+static std::shared_ptr<HugePageArena> hugepage_arena;
+static bool hugepage_arena_env_checked = false;
+
+static std::shared_ptr<HugePageArena> GetHugePageArena() {
+  std::lock_guard<std::mutex> _lg(hugepage_arena_mtx);
+  if (!hugepage_arena_env_checked) {
+    hugepage_arena_env_checked = true;
+    // in MB
+    const char *ptr = getenv("RKMEDIA_HUGEPAGE_ARENA");
+    if (ptr && atoi(ptr) > 0) {
+      auto arena =
+          std::make_shared<HugePageArena>(HUGEPAGE_ARENA_DEFAULT_MIN_SIZE);
+      if (arena && arena->Reserve((size_t)atoi(ptr) * 1024 * 1024))
+        hugepage_arena = arena;
+    }
+  }
+  return hugepage_arena;
+}
+
+bool ReserveHugePageArena(size_t bytes, size_t min_size) {
+  std::shared_ptr<HugePageArena> arena;
+  if (bytes > 0) {
+    arena = std::make_shared<HugePageArena>(min_size);
+    if (!arena || !arena->Reserve(bytes))
+      return false;
+  }
+  std::lock_guard<std::mutex> _lg(hugepage_arena_mtx);
+  hugepage_arena_env_checked = true;
+  // the previous one is freed once its last chunk is
+  hugepage_arena = arena;
+  return true;
+}
+
+void GetHugePageArenaStats(HugePageArenaStats &stats) {
+  auto arena = GetHugePageArena();
+  if (arena)
+    arena->GetStats(stats);
+  else
+    stats = HugePageArenaStats();
+}
+
+static int free_arena_memory(void *buffer) {
+  HugePageArena::Chunk *chunk = static_cast<HugePageArena::Chunk *>(buffer);
+  chunk->arena->Free(chunk);
+  delete chunk;
+  return 0;
+}
+
+// Return the chunk of the arena for the size, or nullptr to use malloc.
+static HugePageArena::Chunk *alloc_arena_memory(size_t size, void **ptr) {
+  auto arena = GetHugePageArena();
+  if (!arena || size < arena->GetMinSize())
+    return nullptr;
+  HugePageArena::Chunk *chunk = new HugePageArena::Chunk();
+  if (!chunk)
+    return nullptr;
+  *ptr = arena->Alloc(size, chunk);
+  if (!*ptr) {
+    delete chunk;
+    return nullptr;
+  }
+  chunk->arena = arena;
+  return chunk;
+}
+
 static MediaBuffer alloc_common_memory(size_t size) {
-  void *buffer = malloc(size);
+  void *buffer = nullptr;
+  HugePageArena::Chunk *chunk = alloc_arena_memory(size, &buffer);
+  if (chunk)
+    return MediaBuffer(buffer, size, -1, chunk, free_arena_memory);
+  buffer = malloc(size);
   if (!buffer)
     return MediaBuffer();
   return MediaBuffer(buffer, size, -1, buffer, free_common_memory);
 }
 
 static MediaGroupBuffer *alloc_common_memory_group(size_t size) {
-  void *buffer = malloc(size);
+  void *buffer = nullptr;
+  HugePageArena::Chunk *chunk = alloc_arena_memory(size, &buffer);
+  if (chunk)
+    return new MediaGroupBuffer(buffer, size, -1, chunk, free_arena_memory);
+  buffer = malloc(size);
   if (!buffer)
     return nullptr;
   MediaGroupBuffer *mgb =
@@ -378,24 +602,28 @@ static MediaGroupBuffer *alloc_drm_memory_group(size_t size, bool map = true) {
 
 #endif
 
-std::shared_ptr<MediaBuffer> MediaBuffer::Alloc(size_t size, MemType type,
-                                                unsigned int flag) {
-  MediaBuffer &&mb = Alloc2(size, type, flag);
-  if (mb.GetSize() == 0)
-    return nullptr;
-  return std::make_shared<MediaBuffer>(mb);
-}
+// Buffers smaller than this are left to malloc, which keeps them already.
+#define BUFFER_CACHE_MIN_COMMON_SIZE (64 * 1024)
+#define BUFFER_CACHE_COMMON_LIMIT (8 * 1024 * 1024)
+#define BUFFER_CACHE_HW_LIMIT (16 * 1024 * 1024)
+// A buffer not reused for that long is freed on the next cache access.
+#define BUFFER_CACHE_MAX_IDLE_US (2 * 1000000LL)
 
-MediaBuffer MediaBuffer::Alloc2(size_t size, MemType type, unsigned int flag) {
+BufferCacheStats::BufferCacheStats()
+    : hits(0), misses(0), evicted(0), cached_cnt(0), cached_bytes(0),
+      limit(0) {}
+
+static MediaBuffer alloc_raw_memory(size_t size, MediaBuffer::MemType type,
+                                    unsigned int flag) {
   switch (type) {
-  case MemType::MEM_COMMON:
+  case MediaBuffer::MemType::MEM_COMMON:
     return alloc_common_memory(size);
 #ifdef LIBION
-  case MemType::MEM_HARD_WARE:
+  case MediaBuffer::MemType::MEM_HARD_WARE:
     return alloc_ion_memory(size);
 #endif
 #ifdef LIBDRM
-  case MemType::MEM_HARD_WARE:
+  case MediaBuffer::MemType::MEM_HARD_WARE:
     return alloc_drm_memory(size, flag);
 #endif
   default:
@@ -404,6 +632,541 @@ MediaBuffer MediaBuffer::Alloc2(size_t size, MemType type, unsigned int flag) {
   }
 }
 
+// Keeps the freed buffers of one memory type by size class, so that the
+// per frame allocations reuse them instead of malloc/mmap or dumb buffer
+// ioctls. The oldest one is freed first when over the limit.
+class BufferCache {
+public:
+  BufferCache(MediaBuffer::MemType t, size_t min, size_t max)
+      : type(t), min_size(min), limit(max), cached_bytes(0), cached_cnt(0),
+        hits(0), misses(0), evicted(0) {}
+  MediaBuffer Alloc(size_t size, unsigned int flag);
+  void SetLimit(size_t bytes);
+  void Trim(size_t keep_bytes);
+  void GetStats(BufferCacheStats &stats);
+
+  static BufferCache *GetInstance(MediaBuffer::MemType type);
+
+private:
+  struct Block {
+    BufferCache *cache;
+    size_t size_class;
+    unsigned int flag;
+    void *ptr;
+    size_t size;
+    int fd;
+    int64_t freed_at;
+    std::shared_ptr<void> memory; // frees the memory of the allocator
+    CacheSync cache_sync;
+  };
+  typedef std::pair<size_t, unsigned int> Key;
+
+  static size_t SizeClass(size_t size);
+  static int Recycle(void *arg);
+  void Put(Block *block);
+  // Take the oldest blocks until the cache fits in bytes and none is idle
+  // too long, the returned ones are freed out of the lock.
+  void Evict(size_t bytes, int64_t now, std::vector<Block *> &victims);
+
+  MediaBuffer::MemType type;
+  size_t min_size;
+  std::mutex mtx;
+  // the newest at the back of each class
+  std::map<Key, std::deque<Block *>> free_blocks;
+  size_t limit;
+  size_t cached_bytes;
+  int cached_cnt;
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evicted;
+};
+
+BufferCache *BufferCache::GetInstance(MediaBuffer::MemType type) {
+  // never destroyed, the buffers may be released by static destructors
+  static BufferCache *common_cache =
+      new BufferCache(MediaBuffer::MemType::MEM_COMMON,
+                      BUFFER_CACHE_MIN_COMMON_SIZE, BUFFER_CACHE_COMMON_LIMIT);
+  static BufferCache *hw_cache = new BufferCache(
+      MediaBuffer::MemType::MEM_HARD_WARE, 0, BUFFER_CACHE_HW_LIMIT);
+  switch (type) {
+  case MediaBuffer::MemType::MEM_COMMON:
+    return common_cache;
+  case MediaBuffer::MemType::MEM_HARD_WARE:
+    return hw_cache;
+  default:
+    return nullptr;
+  }
+}
+
+// Pages up to 16KB, then 4 classes per power of two, so that at most a
+// quarter is wasted and nearby sizes share the buffers.
+size_t BufferCache::SizeClass(size_t size) {
+  size_t page = PAGE_SIZE;
+  size_t s = UPALIGNTO(size, page);
+  if (s <= 4 * page)
+    return s;
+  size_t step = ((size_t)1 << (63 - __builtin_clzll(s))) / 4;
+  return UPALIGNTO(s, step);
+}
+
+MediaBuffer BufferCache::Alloc(size_t size, unsigned int flag) {
+  if (size < min_size || limit == 0)
+    return alloc_raw_memory(size, type, flag);
+  size_t size_class = SizeClass(size);
+  // the flags select the cache mode of drm, ion ignores them
+  Key key(size_class,
+          type == MediaBuffer::MemType::MEM_HARD_WARE ? flag : 0);
+  Block *block = nullptr;
+  std::vector<Block *> victims;
+  {
+    std::lock_guard<std::mutex> _lg(mtx);
+    auto it = free_blocks.find(key);
+    if (it != free_blocks.end() && !it->second.empty()) {
+      block = it->second.back();
+      it->second.pop_back();
+      cached_bytes -= block->size_class;
+      cached_cnt--;
+      hits++;
+    } else {
+      misses++;
+    }
+    Evict(limit, getmonotonictime(), victims);
+  }
+  for (auto b : victims)
+    delete b;
+  if (!block) {
+    MediaBuffer raw = alloc_raw_memory(size_class, type, flag);
+    if (raw.GetSize() == 0)
+      return raw;
+    block = new Block();
+    if (!block)
+      return MediaBuffer();
+    block->cache = this;
+    block->size_class = size_class;
+    block->flag = key.second;
+    block->ptr = raw.GetPtr();
+    block->size = raw.GetSize();
+    block->fd = raw.GetFD();
+    block->memory = raw.GetUserData();
+  }
+  // the size as if allocated without the cache
+  size_t buf_size = size;
+  if (type == MediaBuffer::MemType::MEM_HARD_WARE)
+    buf_size = std::min(block->size, (size_t)UPALIGNTO(size, PAGE_SIZE));
+  MediaBuffer mb(block->ptr, buf_size, block->fd, block, Recycle);
+  if (block->fd >= 0)
+    mb.SetCacheSync(
+        std::shared_ptr<CacheSync>(mb.GetUserData(), &block->cache_sync));
+  return mb;
+}
+
+int BufferCache::Recycle(void *arg) {
+  Block *block = static_cast<Block *>(arg);
+  block->cache->Put(block);
+  return 0;
+}
+
+void BufferCache::Put(Block *block) {
+  std::vector<Block *> victims;
+  {
+    std::lock_guard<std::mutex> _lg(mtx);
+    if (block->size_class > limit) {
+      victims.push_back(block);
+    } else {
+      block->freed_at = getmonotonictime();
+      free_blocks[Key(block->size_class, block->flag)].push_back(block);
+      cached_bytes += block->size_class;
+      cached_cnt++;
+      Evict(limit, block->freed_at, victims);
+    }
+  }
+  for (auto b : victims)
+    delete b;
+}
+
+void BufferCache::Evict(size_t bytes, int64_t now,
+                        std::vector<Block *> &victims) {
+  while (cached_cnt > 0) {
+    std::deque<Block *> *oldest = nullptr;
+    for (auto &it : free_blocks) {
+      if (!it.second.empty() &&
+          (!oldest ||
+           it.second.front()->freed_at < oldest->front()->freed_at))
+        oldest = &it.second;
+    }
+    Block *block = oldest->front();
+    if (cached_bytes <= bytes &&
+        now - block->freed_at < BUFFER_CACHE_MAX_IDLE_US)
+      break;
+    oldest->pop_front();
+    cached_bytes -= block->size_class;
+    cached_cnt--;
+    evicted++;
+    victims.push_back(block);
+  }
+}
+
+void BufferCache::SetLimit(size_t bytes) {
+  std::vector<Block *> victims;
+  {
+    std::lock_guard<std::mutex> _lg(mtx);
+    limit = bytes;
+    Evict(limit, getmonotonictime(), victims);
+  }
+  for (auto b : victims)
+    delete b;
+}
+
+void BufferCache::Trim(size_t keep_bytes) {
+  std::vector<Block *> victims;
+  {
+    std::lock_guard<std::mutex> _lg(mtx);
+    Evict(keep_bytes, getmonotonictime(), victims);
+  }
+  for (auto b : victims)
+    delete b;
+}
+
+void BufferCache::GetStats(BufferCacheStats &stats) {
+  std::lock_guard<std::mutex> _lg(mtx);
+  stats.hits = hits;
+  stats.misses = misses;
+  stats.evicted = evicted;
+  stats.cached_cnt = cached_cnt;
+  stats.cached_bytes = cached_bytes;
+  stats.limit = limit;
+}
+
+void SetBufferCacheLimit(MediaBuffer::MemType type, size_t bytes) {
+  BufferCache *cache = BufferCache::GetInstance(type);
+  if (cache)
+    cache->SetLimit(bytes);
+}
+
+void TrimBufferCache(MediaBuffer::MemType type, size_t keep_bytes) {
+  BufferCache *cache = BufferCache::GetInstance(type);
+  if (cache)
+    cache->Trim(keep_bytes);
+}
+
+void GetBufferCacheStats(MediaBuffer::MemType type, BufferCacheStats &stats) {
+  BufferCache *cache = BufferCache::GetInstance(type);
+  if (cache)
+    cache->GetStats(stats);
+}
+
+struct MemRecord {
+  MemRecord()
+      : prev(this), next(this), type(MediaBuffer::MemType::MEM_COMMON),
+        size(0), site(nullptr), owner(nullptr), born(0),
+        holder((int)MemHolder::NONE), holder_name(nullptr), held_since(0) {}
+  MemRecord *prev;
+  MemRecord *next;
+  MediaBuffer::MemType type;
+  size_t size;
+  const void *site; // the caller of Alloc/Alloc2, nullptr for a pool
+  // rewritten at each lending of a pool
+  std::atomic<const char *> owner;
+  std::atomic<int64_t> born;
+  std::atomic<int> holder; // MemHolder
+  std::atomic<const char *> holder_name;
+  std::atomic<int64_t> held_since;
+  std::shared_ptr<void> memory; // the userdata of Alloc2 it replaces
+};
+
+MemAccountStats::MemAccountStats()
+    : bytes(0), cnt(0), peak_bytes(0), peak_cnt(0), allocs(0) {}
+
+static thread_local const char *mem_owner = nullptr;
+
+// The ages are in seconds, the coarse clock is much cheaper.
+static int64_t census_now() {
+#ifdef CLOCK_MONOTONIC_COARSE
+  struct timespec ts;
+  if (!clock_gettime(CLOCK_MONOTONIC_COARSE, &ts))
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+#endif
+  return getmonotonictime();
+}
+
+const char *SetMemOwner(const char *name) {
+  const char *prev = mem_owner;
+  mem_owner = name;
+  return prev;
+}
+
+// All the live records in a list, so that the dump finds the forgotten
+// buffers. One lock and one small allocation per buffer, always on.
+class MemCensus {
+public:
+  static MemCensus *GetInstance() {
+    // never destroyed, the buffers may be released by static destructors
+    static MemCensus *census = new MemCensus();
+    return census;
+  }
+  void Add(MemRecord *r, MediaBuffer::MemType type, size_t size,
+           const void *site);
+  void Remove(MemRecord *r);
+  void GetStats(MediaBuffer::MemType type, MemAccountStats &stats);
+  void ResetPeak();
+  void Dump(std::string &dump, int min_age_s);
+
+private:
+  MemAccountStats &Account(MediaBuffer::MemType type) {
+    return type == MediaBuffer::MemType::MEM_HARD_WARE ? hw : common;
+  }
+
+  std::mutex mtx;
+  MemRecord head;
+  MemAccountStats common;
+  MemAccountStats hw;
+};
+
+void MemCensus::Add(MemRecord *r, MediaBuffer::MemType type, size_t size,
+                    const void *site) {
+  int64_t now = census_now();
+  r->type = type;
+  r->size = size;
+  r->site = site;
+  r->owner = mem_owner;
+  r->born = now;
+  r->held_since = now;
+  std::lock_guard<std::mutex> _lg(mtx);
+  r->prev = head.prev;
+  r->next = &head;
+  head.prev->next = r;
+  head.prev = r;
+  MemAccountStats &a = Account(type);
+  a.bytes += size;
+  a.cnt++;
+  a.allocs++;
+  a.peak_bytes = std::max(a.peak_bytes, a.bytes);
+  a.peak_cnt = std::max(a.peak_cnt, a.cnt);
+}
+
+void MemCensus::Remove(MemRecord *r) {
+  std::lock_guard<std::mutex> _lg(mtx);
+  r->prev->next = r->next;
+  r->next->prev = r->prev;
+  MemAccountStats &a = Account(r->type);
+  a.bytes -= r->size;
+  a.cnt--;
+}
+
+// The userdata of the buffers of Alloc2, which leaves the census when the
+// last buffer is destroyed, then frees the memory out of the lock.
+struct MemCensusHandle : public MemRecord {
+  ~MemCensusHandle() { MemCensus::GetInstance()->Remove(this); }
+};
+
+void MemCensus::GetStats(MediaBuffer::MemType type, MemAccountStats &stats) {
+  std::lock_guard<std::mutex> _lg(mtx);
+  stats = Account(type);
+}
+
+void MemCensus::ResetPeak() {
+  std::lock_guard<std::mutex> _lg(mtx);
+  common.peak_bytes = common.bytes;
+  common.peak_cnt = common.cnt;
+  hw.peak_bytes = hw.bytes;
+  hw.peak_cnt = hw.cnt;
+}
+
+static const char *mem_holder_name(MemHolder holder) {
+  switch (holder) {
+  case MemHolder::FLOW:
+    return "flow";
+  case MemHolder::QUEUE:
+    return "queue";
+  case MemHolder::POOL:
+    return "pool";
+  case MemHolder::OUTPUT:
+    return "output";
+  case MemHolder::USER:
+    return "user";
+  default:
+    return "none";
+  }
+}
+
+// The library and offset of a code address, for addr2line.
+static std::string mem_site_name(const void *site) {
+  if (!site)
+    return "pool";
+  char str[512];
+  snprintf(str, sizeof(str), "%p", site);
+  std::string name = str;
+  FILE *fp = fopen("/proc/self/maps", "r");
+  if (!fp)
+    return name;
+  uintptr_t addr = (uintptr_t)site;
+  while (fgets(str, sizeof(str), fp)) {
+    unsigned long start, end, offset;
+    char path[256] = {0};
+    if (sscanf(str, "%lx-%lx %*s %lx %*s %*s %255s", &start, &end, &offset,
+               path) < 3)
+      continue;
+    if (addr < start || addr >= end)
+      continue;
+    const char *base = strrchr(path, '/');
+    snprintf(str, sizeof(str), "%s+0x%lx", base ? base + 1 : path,
+             (unsigned long)(addr - start + offset));
+    name = str;
+    break;
+  }
+  fclose(fp);
+  return name;
+}
+
+void MemCensus::Dump(std::string &dump, int min_age_s) {
+  struct Old {
+    MediaBuffer::MemType type;
+    size_t size;
+    const void *site;
+    const char *owner;
+    int64_t born;
+    MemHolder holder;
+    const char *holder_name;
+    int64_t held_since;
+  };
+  typedef std::pair<size_t, int> Usage; // bytes, cnt
+  std::map<std::string, Usage> by_owner;
+  std::map<const void *, Usage> by_site;
+  std::vector<Old> olds;
+  MemAccountStats stats[2];
+  int64_t now = census_now();
+  {
+    std::lock_guard<std::mutex> _lg(mtx);
+    stats[0] = common;
+    stats[1] = hw;
+    for (MemRecord *r = head.next; r != &head; r = r->next) {
+      const char *owner = r->owner.load(std::memory_order_relaxed);
+      Usage &o = by_owner[owner ? owner : "-"];
+      o.first += r->size;
+      o.second++;
+      Usage &s = by_site[r->site];
+      s.first += r->size;
+      s.second++;
+      int64_t born = r->born.load(std::memory_order_relaxed);
+      if (now - born < min_age_s * 1000000LL)
+        continue;
+      Old old;
+      old.type = r->type;
+      old.size = r->size;
+      old.site = r->site;
+      old.owner = owner;
+      old.born = born;
+      old.holder = (MemHolder)r->holder.load(std::memory_order_relaxed);
+      old.holder_name = r->holder_name.load(std::memory_order_relaxed);
+      old.held_since = r->held_since.load(std::memory_order_relaxed);
+      olds.push_back(old);
+    }
+  }
+
+  char str_line[1024];
+  static const char *type_names[2] = {
+      "common",
+#if defined(LIBDRM)
+      "drm",
+#elif defined(LIBION)
+      "ion",
+#else
+      "hw",
+#endif
+  };
+  dump.append("#Dump media memory:\r\n");
+  for (int i = 0; i < 2; i++) {
+    snprintf(str_line, sizeof(str_line),
+             "  %s: live:%zu bytes in %d, peak:%zu bytes in %d, allocs:%llu"
+             "\r\n",
+             type_names[i], stats[i].bytes, stats[i].cnt, stats[i].peak_bytes,
+             stats[i].peak_cnt, (unsigned long long)stats[i].allocs);
+    dump.append(str_line);
+  }
+  dump.append("  ->By flow:\r\n");
+  for (auto &it : by_owner) {
+    snprintf(str_line, sizeof(str_line), "    %s: %zu bytes in %d\r\n",
+             it.first.c_str(), it.second.first, it.second.second);
+    dump.append(str_line);
+  }
+  dump.append("  ->By call site:\r\n");
+  for (auto &it : by_site) {
+    snprintf(str_line, sizeof(str_line), "    %s: %zu bytes in %d\r\n",
+             mem_site_name(it.first).c_str(), it.second.first,
+             it.second.second);
+    dump.append(str_line);
+  }
+  snprintf(str_line, sizeof(str_line), "  ->Alive for %ds at least: %zu\r\n",
+           min_age_s, olds.size());
+  dump.append(str_line);
+  for (auto &old : olds) {
+    snprintf(str_line, sizeof(str_line),
+             "    %s %zu bytes, age:%llds, flow:%s, site:%s, holder:%s(%s) "
+             "for %llds\r\n",
+             type_names[old.type == MediaBuffer::MemType::MEM_HARD_WARE],
+             old.size, (long long)((now - old.born) / 1000000),
+             old.owner ? old.owner : "-", mem_site_name(old.site).c_str(),
+             mem_holder_name(old.holder),
+             old.holder_name ? old.holder_name : "-",
+             (long long)((now - old.held_since) / 1000000));
+    dump.append(str_line);
+  }
+}
+
+void GetMemAccountStats(MediaBuffer::MemType type, MemAccountStats &stats) {
+  MemCensus::GetInstance()->GetStats(type, stats);
+}
+
+void ResetMemAccountPeak() { MemCensus::GetInstance()->ResetPeak(); }
+
+void DumpMemCensus(std::string &dump, int min_age_s) {
+  MemCensus::GetInstance()->Dump(dump, min_age_s);
+}
+
+static void mem_record_hold(MemRecord *r, MemHolder holder,
+                            const char *name) {
+  r->holder.store((int)holder, std::memory_order_relaxed);
+  r->holder_name.store(name, std::memory_order_relaxed);
+  r->held_since.store(census_now(), std::memory_order_relaxed);
+}
+
+void MediaBuffer::SetHolder(MemHolder holder, const char *name) {
+  if (mem_record)
+    mem_record_hold(mem_record, holder, name);
+}
+
+std::shared_ptr<MediaBuffer> MediaBuffer::Alloc(size_t size, MemType type,
+                                                unsigned int flag) {
+  MediaBuffer &&mb = AllocAt(size, type, flag, __builtin_return_address(0));
+  if (mb.GetSize() == 0)
+    return nullptr;
+  return std::make_shared<MediaBuffer>(mb);
+}
+
+MediaBuffer MediaBuffer::Alloc2(size_t size, MemType type, unsigned int flag) {
+  return AllocAt(size, type, flag, __builtin_return_address(0));
+}
+
+MediaBuffer MediaBuffer::AllocAt(size_t size, MemType type, unsigned int flag,
+                                 const void *site) {
+  BufferCache *cache = BufferCache::GetInstance(type);
+  if (!cache) {
+    LOG("unknown memtype\n");
+    return MediaBuffer();
+  }
+  MediaBuffer mb = cache->Alloc(size, flag);
+  if (mb.GetSize() == 0)
+    return mb;
+  auto handle = std::make_shared<MemCensusHandle>();
+  if (!handle)
+    return mb;
+  MemCensus::GetInstance()->Add(handle.get(), type, mb.size, site);
+  handle->memory = std::move(mb.userdata);
+  mb.mem_record = handle.get();
+  mb.userdata = std::move(handle);
+  return mb;
+}
+
 std::shared_ptr<MediaBuffer> MediaBuffer::Clone(MediaBuffer &src,
                                                 MemType dst_type) {
   size_t size = src.GetValidSize();
@@ -416,17 +1179,74 @@ std::shared_ptr<MediaBuffer> MediaBuffer::Clone(MediaBuffer &src,
   }
   if (src.IsHwBuffer() && new_buffer->IsHwBuffer())
     LOG_TODO(); // TODO: fd -> fd by RGA
-  memcpy(new_buffer->GetPtr(), src.GetPtr(), size);
+  memcpy(new_buffer->GetWritablePtr(), src.GetPtr(), size);
   new_buffer->SetValidSize(size);
   new_buffer->CopyAttribute(src);
   return new_buffer;
 }
 
+std::shared_ptr<MediaBuffer> MediaBuffer::View(MediaBuffer &src,
+                                               size_t offset, size_t length) {
+  if (offset > src.GetSize() || length > src.GetSize() - offset) {
+    LOG("View [%zu, +%zu) out of buffer size %zu\n", offset, length,
+        src.GetSize());
+    return nullptr;
+  }
+  if (!src.GetUserData()) {
+    // nothing to keep the memory alive, copy the range instead
+    auto copy = Alloc(length);
+    if (!copy) {
+      LOG_NO_MEMORY();
+      return nullptr;
+    }
+    memcpy(copy->GetPtr(), static_cast<uint8_t *>(src.GetPtr()) + offset,
+           length);
+    copy->SetValidSize(length);
+    copy->CopyAttribute(src);
+    return copy;
+  }
+  // shares the memory, the attributes and the fd
+  auto view = std::make_shared<MediaBuffer>(src);
+  if (!view)
+    return nullptr;
+  view->size = length;
+  view->valid_size = length;
+  if (offset > 0) {
+    // only for the cpu, synced now as it is not tracked any more
+    view->ptr = static_cast<uint8_t *>(src.GetPtr()) + offset;
+    view->fd = -1;
+    view->cache_sync.reset();
+  }
+  return view;
+}
+
+bool MediaBuffer::MakeWritable(MemType mem_type) {
+  if (!IsShared())
+    return true;
+  MediaBuffer mb = Alloc2(size, mem_type);
+  if (mb.GetSize() == 0) {
+    LOG_NO_MEMORY();
+    return false;
+  }
+  if (valid_size > 0)
+    memcpy(mb.GetWritablePtr(), GetPtr(), valid_size);
+  ptr = mb.ptr;
+  size = mb.size;
+  fd = mb.fd;
+  userdata = mb.userdata;
+  cache_sync = mb.cache_sync;
+  mem_record = mb.mem_record;
+  return true;
+}
+
 void MediaBuffer::CopyAttribute(MediaBuffer &src_attr) {
   type = src_attr.GetType();
   user_flag = src_attr.GetUserFlag();
   ustimestamp = src_attr.GetUSTimeStamp();
+  atomic_clock = src_attr.GetAtomicClock();
+  trace_frame = src_attr.GetTraceFrame();
   eof = src_attr.IsEOF();
+  priority = src_attr.GetPriority();
 }
 
 struct dma_buf_sync {
@@ -442,62 +1262,271 @@ struct dma_buf_sync {
 #define DMA_BUF_BASE 'b'
 #define DMA_BUF_IOCTL_SYNC _IOW(DMA_BUF_BASE, 0, struct dma_buf_sync)
 
-void MediaBuffer::BeginCPUAccess(bool readonly) {
+static void dma_buf_sync_ioctl(int fd, __u64 flags) {
   struct dma_buf_sync sync = {0};
 
+  sync.flags = flags;
+  int ret = ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync);
+  if (ret < 0)
+    LOG("%s: %s\n", __func__, strerror(errno));
+}
+
+// flush for the devices to read
+static void dma_buf_flush(int fd) {
+  dma_buf_sync_ioctl(fd, DMA_BUF_SYNC_RW | DMA_BUF_SYNC_START);
+  dma_buf_sync_ioctl(fd, DMA_BUF_SYNC_RW | DMA_BUF_SYNC_END);
+}
+
+// invalidate for the cpu to read what the devices wrote
+static void dma_buf_invalidate(int fd) {
+  dma_buf_sync_ioctl(fd, DMA_BUF_SYNC_READ | DMA_BUF_SYNC_START);
+  dma_buf_sync_ioctl(fd, DMA_BUF_SYNC_READ | DMA_BUF_SYNC_END);
+}
+
+void MediaBuffer::BeginCPUAccess(bool readonly) {
   if (fd < 0)
     return;
 
+  if (cache_sync) {
+    // not elided, a device may have written by the fd without
+    // EndDeviceAccess, the same as before the tracking
+    std::lock_guard<std::mutex> _lg(cache_sync->mtx);
+    dma_buf_invalidate(fd);
+    cache_sync->synced.fetch_add(1, std::memory_order_relaxed);
+    if (!readonly)
+      cache_sync->state.store(CacheSync::State::CPU,
+                              std::memory_order_relaxed);
+    else if (cache_sync->GetState() == CacheSync::State::DEVICE)
+      cache_sync->state.store(CacheSync::State::CLEAN,
+                              std::memory_order_relaxed);
+    return;
+  }
+
   if (readonly)
-    sync.flags = DMA_BUF_SYNC_READ | DMA_BUF_SYNC_START;
+    dma_buf_sync_ioctl(fd, DMA_BUF_SYNC_READ | DMA_BUF_SYNC_START);
   else
-    sync.flags = DMA_BUF_SYNC_RW | DMA_BUF_SYNC_START;
-
-  int ret = ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync);
-  if (ret < 0)
-    LOG("%s: %s\n", __func__, strerror(errno));
+    dma_buf_sync_ioctl(fd, DMA_BUF_SYNC_RW | DMA_BUF_SYNC_START);
 }
 
 void MediaBuffer::EndCPUAccess(bool readonly) {
-  struct dma_buf_sync sync = {0};
-
   if (fd < 0)
     return;
 
+  if (cache_sync) {
+    if (readonly) {
+      cache_sync->elided.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    // written back at once, the devices may read it by the fd without
+    // BeginDeviceAccess
+    std::lock_guard<std::mutex> _lg(cache_sync->mtx);
+    dma_buf_flush(fd);
+    cache_sync->synced.fetch_add(1, std::memory_order_relaxed);
+    cache_sync->state.store(CacheSync::State::CLEAN,
+                            std::memory_order_relaxed);
+    return;
+  }
+
   if (readonly)
-    sync.flags = DMA_BUF_SYNC_READ | DMA_BUF_SYNC_END;
+    dma_buf_sync_ioctl(fd, DMA_BUF_SYNC_READ | DMA_BUF_SYNC_END);
   else
-    sync.flags = DMA_BUF_SYNC_RW | DMA_BUF_SYNC_END;
+    dma_buf_sync_ioctl(fd, DMA_BUF_SYNC_RW | DMA_BUF_SYNC_END);
+}
 
-  int ret = ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync);
-  if (ret < 0)
-    LOG("%s: %s\n", __func__, strerror(errno));
+void MediaBuffer::SyncForCpu(bool write) const {
+  if (fd < 0)
+    return;
+  std::lock_guard<std::mutex> _lg(cache_sync->mtx);
+  auto state = cache_sync->GetState();
+  if (state == CacheSync::State::DEVICE) {
+    dma_buf_invalidate(fd);
+    cache_sync->synced.fetch_add(1, std::memory_order_relaxed);
+    state = CacheSync::State::CLEAN;
+  }
+  // only a write dirties the cache, a reader leaves it clean
+  if (write)
+    state = CacheSync::State::CPU;
+  cache_sync->state.store(state, std::memory_order_relaxed);
+}
+
+void MediaBuffer::BeginDeviceAccess(bool readonly) {
+  if (fd < 0)
+    return;
+
+  if (!cache_sync) {
+    if (readonly)
+      dma_buf_flush(fd);
+    return;
+  }
+
+  std::lock_guard<std::mutex> _lg(cache_sync->mtx);
+  if (cache_sync->GetState() != CacheSync::State::CPU) {
+    cache_sync->elided.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  // the cpu wrote, also before a device writes, or the dirty lines evicted
+  // later would overwrite what it wrote. Not after the cpu only read.
+  dma_buf_flush(fd);
+  cache_sync->synced.fetch_add(1, std::memory_order_relaxed);
+  cache_sync->state.store(CacheSync::State::CLEAN, std::memory_order_relaxed);
+}
+
+void MediaBuffer::EndDeviceAccess(bool readonly) {
+  if (fd < 0 || readonly)
+    return;
+
+  if (!cache_sync) {
+    dma_buf_invalidate(fd);
+    return;
+  }
+
+  cache_sync->elided.fetch_add(1, std::memory_order_relaxed);
+  cache_sync->state.store(CacheSync::State::DEVICE, std::memory_order_relaxed);
 }
 
 MediaGroupBuffer *MediaGroupBuffer::Alloc(size_t size,
                                           MediaBuffer::MemType type) {
+  MediaGroupBuffer *mgb = nullptr;
   switch (type) {
   case MediaBuffer::MemType::MEM_COMMON:
-    return alloc_common_memory_group(size);
+    mgb = alloc_common_memory_group(size);
+    break;
 #ifdef LIBDRM
   case MediaBuffer::MemType::MEM_HARD_WARE:
-    return alloc_drm_memory_group(size);
+    mgb = alloc_drm_memory_group(size);
+    break;
 #endif
   default:
     LOG("unknown memtype\n");
     return nullptr;
   }
+  if (mgb) {
+    mgb->mem_record = new MemRecord();
+    if (mgb->mem_record) {
+      MemCensus::GetInstance()->Add(mgb->mem_record, type, size, nullptr);
+      mem_record_hold(mgb->mem_record, MemHolder::POOL, nullptr);
+    }
+  }
+  return mgb;
 }
 
-BufferPool::BufferPool(int cnt, int size, MediaBuffer::MemType type) {
-  bool sucess = true;
+MediaGroupBuffer::~MediaGroupBuffer() {
+  if (mem_record) {
+    MemCensus::GetInstance()->Remove(mem_record);
+    delete mem_record;
+  }
+}
 
-  if (cnt <= 0) {
-    LOG("ERROR: BufferPool: cnt:%d is invalid!\n", cnt);
-    return;
+// The state of a BufferPool, which outlives it while buffers are still lent,
+// so that a late release never touches a destroyed pool.
+class BufferPoolCore {
+public:
+  BufferPoolCore(int min, int max, int size, MediaBuffer::MemType type,
+                 int idle_ms);
+  // Free the unused buffers, and self once none is lent.
+  void Close();
+
+  std::shared_ptr<MediaBuffer> Get(bool block);
+  // last is set when the pool is closed and this is the last lent buffer,
+  // then the caller deletes the core.
+  int Put(MediaGroupBuffer *mgb, bool &last);
+  int Drain(int timeout_ms);
+  void Trim();
+  void GetStats(BufferPoolStats &stats);
+  void ResetStats();
+  void DumpInfo();
+
+  static void ReleaseHandle(MediaGroupBuffer *mgb);
+
+private:
+  bool IsElastic() { return max_cnt > min_cnt; }
+  MediaGroupBuffer *PopFree();
+  // Take n buffers off the free list, the returned list is freed by
+  // FreeList out of the lock.
+  MediaGroupBuffer *TakeFree(int n);
+  MediaGroupBuffer *Shrink(int64_t now);
+  static void FreeList(MediaGroupBuffer *list);
+
+  int min_cnt;
+  int max_cnt;
+  int buf_size;
+  MediaBuffer::MemType mem_type;
+  int64_t idle_us;
+
+  std::mutex mtx;
+  std::condition_variable cond;       // getters waiting for a buffer
+  std::condition_variable drain_cond; // Drain waiting for all buffers
+  std::vector<MediaGroupBuffer *> buffers;
+  MediaGroupBuffer *free_list;
+  int free_cnt;
+  int busy_cnt;
+  int waiters;
+  int drainers;
+  int allocating; // growing out of the lock
+  bool closed;
+  // the least free buffers since window_start, which were not needed
+  int low_free;
+  int64_t window_start;
+
+  int peak_in_use;
+  uint64_t waits;
+  uint64_t wait_us;
+  uint64_t alloc_failed;
+  uint64_t grown;
+  uint64_t shrunk;
+};
+
+// Places the control blocks of the shared_ptr lent by a pool into the storage
+// of the MediaGroupBuffer. Falls back to the heap if the block does not fit,
+// which depends on the c++ library.
+template <typename T> class PoolHandleAllocator {
+public:
+  typedef T value_type;
+  PoolHandleAllocator(MediaGroupBuffer *b, void *s, size_t c)
+      : mgb(b), storage(s), capacity(c) {}
+  template <typename U>
+  PoolHandleAllocator(const PoolHandleAllocator<U> &other)
+      : mgb(other.mgb), storage(other.storage), capacity(other.capacity) {}
+  T *allocate(size_t n) {
+    if (n * sizeof(T) <= capacity &&
+        alignof(T) <= alignof(std::max_align_t))
+      return static_cast<T *>(storage);
+    return static_cast<T *>(::operator new(n * sizeof(T)));
+  }
+  // The block is destroyed already, the storage may be reused by the next
+  // lending right after the release.
+  void deallocate(T *p, size_t) {
+    if (p != storage)
+      ::operator delete(p);
+    BufferPoolCore::ReleaseHandle(mgb);
+  }
+  template <typename U> bool operator==(const PoolHandleAllocator<U> &o) {
+    return storage == o.storage;
+  }
+  template <typename U> bool operator!=(const PoolHandleAllocator<U> &o) {
+    return storage != o.storage;
   }
 
-  for (int i = 0; i < cnt; i++) {
+  MediaGroupBuffer *mgb;
+  void *storage;
+  size_t capacity;
+};
+
+BufferPoolStats::BufferPoolStats()
+    : total(0), in_use(0), peak_in_use(0), waits(0), wait_us(0),
+      alloc_failed(0), grown(0), shrunk(0) {}
+
+BufferPoolCore::BufferPoolCore(int min, int max, int size,
+                               MediaBuffer::MemType type, int idle_ms)
+    : min_cnt(min), max_cnt(max), buf_size(size), mem_type(type),
+      idle_us(idle_ms * 1000LL), free_list(nullptr), free_cnt(0),
+      busy_cnt(0), waiters(0), drainers(0), allocating(0), closed(false),
+      low_free(0), window_start(getmonotonictime()), peak_in_use(0),
+      waits(0), wait_us(0), alloc_failed(0), grown(0), shrunk(0) {
+  bool sucess = true;
+
+  buffers.reserve(max);
+  for (int i = 0; i < min; i++) {
     auto mgb = MediaGroupBuffer::Alloc(size, type);
     if (!mgb) {
       sucess = false;
@@ -506,130 +1535,328 @@ BufferPool::BufferPool(int cnt, int size, MediaBuffer::MemType type) {
     mgb->SetBufferPool(this);
     LOGD("Create: pool:%p, mgb:%p, ptr:%p, fd:%d, size:%zu\n", this, mgb,
          mgb->GetPtr(), mgb->GetFD(), mgb->GetSize());
-    ready_buffers.push_back(mgb);
+    buffers.push_back(mgb);
   }
 
   if (!sucess) {
-    while (ready_buffers.size() > 0)
-      ready_buffers.pop_front();
+    for (auto mgb : buffers)
+      delete mgb;
+    buffers.clear();
+    alloc_failed++;
+    // lend nothing rather than wait forever
+    min_cnt = max_cnt = 0;
     LOG("ERROR: BufferPool: Create buffer pool failed! Please check space is "
         "enough!\n");
     return;
   }
-  buf_cnt = cnt;
-  buf_size = size;
-  LOGD("BufferPool: Create buffer pool:%p, size:%d, cnt:%d\n", this, size, cnt);
+  // the first one on the top of the free list
+  for (auto it = buffers.rbegin(); it != buffers.rend(); ++it) {
+    (*it)->next_free = free_list;
+    free_list = *it;
+  }
+  free_cnt = min;
+  low_free = min;
 }
 
-BufferPool::~BufferPool() {
-  int cnt = 0;
-  int wait_times = 30;
-
-  while (busy_buffers.size() > 0) {
-    if (wait_times-- <= 0) {
-      LOG("ERROR: BufferPool: waiting bufferpool free for 900ms, TimeOut!\n");
-      break;
-    }
-    easymedia::usleep(30000); // wait 30ms
+void BufferPoolCore::Close() {
+  MediaGroupBuffer *list;
+  bool last;
+  {
+    std::lock_guard<std::mutex> _lg(mtx);
+    closed = true;
+    list = TakeFree(free_cnt);
+    buffers.clear();
+    last = (busy_cnt == 0);
+    if (!last)
+      LOG("WARN: BufferPool: destroyed with %d buffers in use, they are freed "
+          "by their last release\n",
+          busy_cnt);
   }
+  FreeList(list);
+  if (last)
+    delete this;
+}
 
-  MediaGroupBuffer *mgb = NULL;
-  while (ready_buffers.size() > 0) {
-    mgb = ready_buffers.front();
-    ready_buffers.pop_front();
-    LOGD("BufferPool: #%02d Destroy buffer pool(ready):[%p,%p]\n", cnt, this,
-         mgb);
-    delete mgb;
-    cnt++;
-  }
+MediaGroupBuffer *BufferPoolCore::PopFree() {
+  MediaGroupBuffer *mgb = free_list;
+  free_list = mgb->next_free;
+  mgb->next_free = nullptr;
+  if (--free_cnt < low_free)
+    low_free = free_cnt;
+  return mgb;
+}
 
-  while (busy_buffers.size() > 0) {
-    mgb = busy_buffers.front();
-    busy_buffers.pop_front();
-    LOG("WARN: BufferPool: #%02d Destroy buffer pool(busy):[%p,%p]\n", cnt,
-        this, mgb);
-    delete mgb;
-    cnt++;
+MediaGroupBuffer *BufferPoolCore::TakeFree(int n) {
+  MediaGroupBuffer *list = nullptr;
+  while (n-- > 0 && free_list) {
+    MediaGroupBuffer *mgb = free_list;
+    free_list = mgb->next_free;
+    free_cnt--;
+    mgb->next_free = list;
+    list = mgb;
+    for (auto it = buffers.begin(); it != buffers.end(); ++it) {
+      if (*it == mgb) {
+        buffers.erase(it);
+        break;
+      }
+    }
   }
+  if (low_free > free_cnt)
+    low_free = free_cnt;
+  return list;
 }
 
-static int __groupe_buffer_free(void *data) {
-  assert(data);
-  if (data == NULL) {
-    LOG("ERROR: BufferPool: free ptr is null!\n");
-    return 0;
-  }
-  MediaGroupBuffer *mgb = (MediaGroupBuffer *)data;
-  if (mgb->pool == NULL) {
-    LOG("ERROR: BufferPool: free pool ptr is null!\n");
-    return 0;
+// Free the buffers beyond min_cnt which stayed free for a whole idle window.
+MediaGroupBuffer *BufferPoolCore::Shrink(int64_t now) {
+  if (now - window_start < idle_us)
+    return nullptr;
+  int n = std::min(low_free, (int)buffers.size() - min_cnt);
+  MediaGroupBuffer *list = nullptr;
+  if (n > 0) {
+    list = TakeFree(n);
+    shrunk += n;
   }
+  window_start = now;
+  low_free = free_cnt;
+  return list;
+}
 
-  BufferPool *bp = (BufferPool *)mgb->pool;
-
-  return bp->PutBuffer(mgb);
+void BufferPoolCore::FreeList(MediaGroupBuffer *list) {
+  while (list) {
+    MediaGroupBuffer *next = list->next_free;
+    delete list;
+    list = next;
+  }
 }
 
-std::shared_ptr<MediaBuffer> BufferPool::GetBuffer(bool block) {
-  AutoLockMutex _alm(mtx);
+void BufferPoolCore::ReleaseHandle(MediaGroupBuffer *mgb) {
+  if (mgb->handles.fetch_sub(1, std::memory_order_acq_rel) != 1)
+    return;
+  BufferPoolCore *core = (BufferPoolCore *)mgb->pool;
+  bool last = false;
+  core->Put(mgb, last);
+  if (last)
+    delete core;
+}
 
-  while (1) {
-    if (!ready_buffers.size()) {
-      if (block)
-        mtx.wait();
-      else
+std::shared_ptr<MediaBuffer> BufferPoolCore::Get(bool block) {
+  MediaGroupBuffer *mgb = nullptr;
+  MediaGroupBuffer *idle = nullptr;
+  {
+    std::unique_lock<std::mutex> lk(mtx);
+    bool grow_tried = false;
+    int64_t wait_start = 0;
+    while (!free_list) {
+      if (!grow_tried &&
+          (int)buffers.size() + allocating < max_cnt) {
+        grow_tried = true;
+        allocating++;
+        lk.unlock();
+        mgb = MediaGroupBuffer::Alloc(buf_size, mem_type);
+        lk.lock();
+        allocating--;
+        if (mgb) {
+          mgb->SetBufferPool(this);
+          buffers.push_back(mgb);
+          grown++;
+          break;
+        }
+        alloc_failed++;
+        continue;
+      }
+      // nothing will return if none is lent
+      if (!block || (busy_cnt == 0 && allocating == 0))
+        break;
+      if (!wait_start) {
+        wait_start = getmonotonictime();
+        waits++;
+      }
+      waiters++;
+      cond.wait(lk);
+      waiters--;
+    }
+    if (wait_start)
+      wait_us += getmonotonictime() - wait_start;
+    if (!mgb) {
+      if (!free_list)
         return nullptr;
+      mgb = PopFree();
     }
-    // mtx.notify wake up all mtx.wait.
-    if (ready_buffers.size() > 0)
-      break;
+    mgb->lent = true;
+    if (++busy_cnt > peak_in_use)
+      peak_in_use = busy_cnt;
+    if (IsElastic())
+      idle = Shrink(getmonotonictime());
+  }
+  FreeList(idle);
+
+  mgb->handles.store(2, std::memory_order_relaxed);
+  std::shared_ptr<void> data(
+      mgb, [](void *) {},
+      PoolHandleAllocator<void>(mgb, &mgb->data_handle,
+                                sizeof(mgb->data_handle)));
+  auto mb = std::allocate_shared<MediaBuffer>(
+      PoolHandleAllocator<MediaBuffer>(mgb, &mgb->buffer_handle,
+                                       sizeof(mgb->buffer_handle)),
+      mgb->GetPtr(), mgb->GetSize(), mgb->GetFD());
+  if (mgb->GetFD() >= 0)
+    mb->SetCacheSync(std::shared_ptr<CacheSync>(data, &mgb->cache_sync));
+  mb->SetUserData(std::move(data));
+  MemRecord *r = mgb->mem_record;
+  if (r) {
+    // aged from the lending
+    r->owner.store(mem_owner, std::memory_order_relaxed);
+    r->born.store(census_now(), std::memory_order_relaxed);
+    mem_record_hold(r, MemHolder::NONE, nullptr);
+    mb->mem_record = r;
   }
-
-  auto mgb = ready_buffers.front();
-  ready_buffers.pop_front();
-  busy_buffers.push_back(mgb);
-
-  auto &&mb = std::make_shared<MediaBuffer>(
-      mgb->GetPtr(), mgb->GetSize(), mgb->GetFD(), mgb, __groupe_buffer_free);
   return mb;
 }
 
-int BufferPool::PutBuffer(MediaGroupBuffer *mgb) {
-  std::list<MediaGroupBuffer *>::iterator it;
-  bool sucess = false;
-  AutoLockMutex _alm(mtx);
-
-  for (it = busy_buffers.begin(); it != busy_buffers.end();) {
-    if (*it == mgb) {
-      sucess = true;
-      it = busy_buffers.erase(it);
-      ready_buffers.push_back(mgb);
-      mtx.notify();
-      break;
+int BufferPoolCore::Put(MediaGroupBuffer *mgb, bool &last) {
+  MediaGroupBuffer *idle = nullptr;
+  if (mgb && mgb->mem_record) {
+    mgb->mem_record->owner.store(nullptr, std::memory_order_relaxed);
+    mem_record_hold(mgb->mem_record, MemHolder::POOL, nullptr);
+  }
+  {
+    std::lock_guard<std::mutex> _lg(mtx);
+    if (!mgb || mgb->pool != this || !mgb->lent) {
+      LOG("ERROR: BufferPool: Unknow media group buffer:%p\n", mgb);
+      return -1;
+    }
+    mgb->lent = false;
+    busy_cnt--;
+    if (closed) {
+      idle = mgb;
+      last = (busy_cnt == 0);
+    } else {
+      mgb->next_free = free_list;
+      free_list = mgb;
+      free_cnt++;
+      if (waiters)
+        cond.notify_one();
+      if (busy_cnt == 0 && drainers)
+        drain_cond.notify_all();
+      if (IsElastic())
+        idle = Shrink(getmonotonictime());
     }
-    it++;
   }
+  FreeList(idle);
+  return 0;
+}
+
+int BufferPoolCore::Drain(int timeout_ms) {
+  std::unique_lock<std::mutex> lk(mtx);
+  auto drained = [this] { return busy_cnt == 0; };
+  drainers++;
+  if (timeout_ms < 0)
+    drain_cond.wait(lk, drained);
+  else
+    drain_cond.wait_for(lk, std::chrono::milliseconds(timeout_ms), drained);
+  drainers--;
+  return busy_cnt;
+}
 
-  if (!sucess)
-    LOG("ERROR: BufferPool: Unknow media group buffer:%p\n", mgb);
+void BufferPoolCore::Trim() {
+  MediaGroupBuffer *list;
+  {
+    std::lock_guard<std::mutex> _lg(mtx);
+    int n = std::min(free_cnt, (int)buffers.size() - min_cnt);
+    list = TakeFree(n);
+    if (n > 0)
+      shrunk += n;
+    window_start = getmonotonictime();
+    low_free = free_cnt;
+  }
+  FreeList(list);
+}
 
-  return sucess ? 0 : -1;
+void BufferPoolCore::GetStats(BufferPoolStats &stats) {
+  std::lock_guard<std::mutex> _lg(mtx);
+  stats.total = buffers.size();
+  stats.in_use = busy_cnt;
+  stats.peak_in_use = peak_in_use;
+  stats.waits = waits;
+  stats.wait_us = wait_us;
+  stats.alloc_failed = alloc_failed;
+  stats.grown = grown;
+  stats.shrunk = shrunk;
 }
 
-void BufferPool::DumpInfo() {
+void BufferPoolCore::ResetStats() {
+  std::lock_guard<std::mutex> _lg(mtx);
+  peak_in_use = busy_cnt;
+  waits = 0;
+  wait_us = 0;
+  alloc_failed = 0;
+  grown = 0;
+  shrunk = 0;
+}
+
+void BufferPoolCore::DumpInfo() {
   int id = 0;
+  std::lock_guard<std::mutex> _lg(mtx);
   LOG("##BufferPool DumpInfo:%p\n", this);
-  LOG("\tcnt:%d\n", buf_cnt);
-  LOG("\tsize:%zu\n", buf_size);
-  LOG("\tready buffers(%d):\n", ready_buffers.size());
-  for (auto dev : ready_buffers)
-    LOG("\t  #%02d Pool:%p, mgb:%p, ptr:%p\n", id++, dev->pool, dev,
-        dev->GetPtr());
-  LOG("\tbusy buffers(%d):\n", busy_buffers.size());
+  LOG("\tcnt:%d, min:%d, max:%d\n", (int)buffers.size(), min_cnt, max_cnt);
+  LOG("\tsize:%d\n", buf_size);
+  LOG("\tpeak:%d, waits:%llu(%lluus), grown:%llu, shrunk:%llu, failed:%llu\n",
+      peak_in_use, (unsigned long long)waits, (unsigned long long)wait_us,
+      (unsigned long long)grown, (unsigned long long)shrunk,
+      (unsigned long long)alloc_failed);
+  LOG("\tready buffers(%d):\n", free_cnt);
+  for (auto dev : buffers) {
+    if (!dev->lent)
+      LOG("\t  #%02d Pool:%p, mgb:%p, ptr:%p\n", id, dev->pool, dev,
+          dev->GetPtr());
+    id++;
+  }
+  LOG("\tbusy buffers(%d):\n", busy_cnt);
   id = 0;
-  for (auto dev : busy_buffers)
-    LOG("\t  #%02d Pool:%p, mgb:%p, ptr:%p\n", id++, dev->pool, dev,
-        dev->GetPtr());
+  for (auto dev : buffers) {
+    if (dev->lent)
+      LOG("\t  #%02d Pool:%p, mgb:%p, ptr:%p\n", id, dev->pool, dev,
+          dev->GetPtr());
+    id++;
+  }
+}
+
+BufferPool::BufferPool(int cnt, int size, MediaBuffer::MemType type)
+    : BufferPool(cnt, cnt, size, type, 0) {}
+
+BufferPool::BufferPool(int min_cnt, int max_cnt, int size,
+                       MediaBuffer::MemType type, int idle_ms) {
+  if (min_cnt < 0 || max_cnt <= 0 || max_cnt < min_cnt) {
+    LOG("ERROR: BufferPool: cnt:%d-%d is invalid!\n", min_cnt, max_cnt);
+    min_cnt = max_cnt = 0;
+  }
+  if (idle_ms < 0)
+    idle_ms = 0;
+  core = new BufferPoolCore(min_cnt, max_cnt, size, type, idle_ms);
+  LOGD("BufferPool: Create buffer pool:%p, size:%d, cnt:%d-%d\n", this, size,
+       min_cnt, max_cnt);
 }
 
+BufferPool::~BufferPool() { core->Close(); }
+
+std::shared_ptr<MediaBuffer> BufferPool::GetBuffer(bool block) {
+  return core->Get(block);
+}
+
+int BufferPool::PutBuffer(MediaGroupBuffer *mgb) {
+  bool last = false;
+  // the pool is alive, so it is never the last of a closed one
+  return core->Put(mgb, last);
+}
+
+int BufferPool::Drain(int timeout_ms) { return core->Drain(timeout_ms); }
+
+void BufferPool::Trim() { core->Trim(); }
+
+void BufferPool::GetStats(BufferPoolStats &stats) { core->GetStats(stats); }
+
+void BufferPool::ResetStats() { core->ResetStats(); }
+
+void BufferPool::DumpInfo() { core->DumpInfo(); }
+
 } // namespace easymedia
@@ -0,0 +1,680 @@
+// Copyright 2019 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "buffer_share.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/statfs.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <set>
+
+#include "utils.h"
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+
+#ifndef DMA_BUF_MAGIC
+#define DMA_BUF_MAGIC 0x444d4142
+#endif
+
+namespace easymedia {
+
+// The memfds kept for the next copies, the others are freed once released.
+#define BUFFER_SHARE_FREE_MEMFD_MAX 8
+// The memfd mappings kept by a consumer, so that a recycled memfd of the
+// producer is neither mapped nor faulted in again.
+#define BUFFER_SHARE_MAPPING_MAX 32
+
+static void init_header(BufferShareHeader &hdr, BufferShareMsg msg) {
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.magic = BUFFER_SHARE_MAGIC;
+  hdr.version = BUFFER_SHARE_VERSION;
+  hdr.msg = (uint32_t)msg;
+}
+
+static bool check_header(const BufferShareHeader &hdr, ssize_t len) {
+  if (len != (ssize_t)sizeof(hdr) || hdr.magic != BUFFER_SHARE_MAGIC ||
+      hdr.version != BUFFER_SHARE_VERSION) {
+    LOG("BufferShare: bad message, len %d\n", (int)len);
+    return false;
+  }
+  return true;
+}
+
+// Only a dma-buf takes the sync ioctls, the other fds are plain memory.
+static bool is_dma_buf(int fd) {
+  struct statfs sfs;
+  if (fstatfs(fd, &sfs) == 0 && sfs.f_type == DMA_BUF_MAGIC)
+    return true;
+  // an anonymous inode before linux 5.3
+  char path[32], link[32];
+  snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+  ssize_t len = readlink(path, link, sizeof(link) - 1);
+  if (len < 0)
+    return false;
+  link[len] = 0;
+  return !strcmp(link, "anon_inode:dmabuf");
+}
+
+// Never blocks, the consumer is skipped if its socket is full.
+static int send_header(int sock, const BufferShareHeader &hdr, int fd) {
+  struct iovec iov;
+  iov.iov_base = (void *)&hdr;
+  iov.iov_len = sizeof(hdr);
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  char cmsg_buf[CMSG_SPACE(sizeof(int))];
+  if (fd >= 0) {
+    memset(cmsg_buf, 0, sizeof(cmsg_buf));
+    msg.msg_control = cmsg_buf;
+    msg.msg_controllen = sizeof(cmsg_buf);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+  }
+  if (sendmsg(sock, &msg, MSG_DONTWAIT | MSG_NOSIGNAL) < 0)
+    return -errno;
+  return 0;
+}
+
+// Return the length received, the fd is set to -1 if none.
+static ssize_t recv_header(int sock, BufferShareHeader &hdr, int &fd) {
+  struct iovec iov;
+  iov.iov_base = &hdr;
+  iov.iov_len = sizeof(hdr);
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  char cmsg_buf[CMSG_SPACE(sizeof(int))];
+  msg.msg_control = cmsg_buf;
+  msg.msg_controllen = sizeof(cmsg_buf);
+  fd = -1;
+  ssize_t len = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+  if (len <= 0)
+    return len;
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  if (cmsg && cmsg->cmsg_level == SOL_SOCKET &&
+      cmsg->cmsg_type == SCM_RIGHTS)
+    memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+  return len;
+}
+
+struct BufferShareServer::Consumer {
+  int sock;
+  int credits;
+  std::set<uint32_t> ids; // held
+};
+
+struct BufferShareServer::Memfd {
+  Memfd() : fd(-1), ptr(MAP_FAILED), size(0) {}
+  ~Memfd() {
+    if (ptr != MAP_FAILED)
+      munmap(ptr, size);
+    if (fd >= 0)
+      close(fd);
+  }
+  int fd;
+  void *ptr;
+  size_t size;
+};
+
+BufferShareServer::BufferShareServer(const std::string &path, int credits)
+    : sock_path(path), max_credits(credits > 0 ? credits : 1), listen_fd(-1),
+      th(nullptr), next_id(1) {
+  wake_fd[0] = wake_fd[1] = -1;
+}
+
+BufferShareServer::~BufferShareServer() { Stop(); }
+
+bool BufferShareServer::Start() {
+  struct sockaddr_un addr;
+  if (sock_path.empty() || sock_path.size() >= sizeof(addr.sun_path)) {
+    LOG("BufferShare: invalid socket path '%s'\n", sock_path.c_str());
+    return false;
+  }
+  listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (listen_fd < 0) {
+    LOG("BufferShare: socket: %m\n");
+    return false;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, sock_path.c_str(), sizeof(addr.sun_path) - 1);
+  unlink(sock_path.c_str());
+  if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+      listen(listen_fd, 8) < 0) {
+    LOG("BufferShare: fail to listen on %s: %m\n", sock_path.c_str());
+    goto err;
+  }
+  if (pipe2(wake_fd, O_CLOEXEC) < 0) {
+    LOG("BufferShare: pipe: %m\n");
+    goto err;
+  }
+  th = new std::thread(&BufferShareServer::Run, this);
+  if (!th)
+    goto err;
+  return true;
+err:
+  Stop();
+  return false;
+}
+
+void BufferShareServer::Stop() {
+  if (th) {
+    char c = 0;
+    if (write(wake_fd[1], &c, 1) != 1)
+      LOG("BufferShare: fail to wake up: %m\n");
+    th->join();
+    delete th;
+    th = nullptr;
+  }
+  for (int i = 0; i < 2; i++) {
+    if (wake_fd[i] >= 0)
+      close(wake_fd[i]);
+    wake_fd[i] = -1;
+  }
+  if (listen_fd >= 0) {
+    close(listen_fd);
+    unlink(sock_path.c_str());
+    listen_fd = -1;
+  }
+  std::vector<std::shared_ptr<void>> unheld;
+  {
+    std::lock_guard<std::mutex> _lg(mtx);
+    while (!consumers.empty())
+      RemoveConsumer(consumers.front(), unheld);
+  }
+  unheld.clear();
+  std::lock_guard<std::mutex> _lg(mtx);
+  free_memfds.clear();
+}
+
+void BufferShareServer::Run() {
+  prctl(PR_SET_NAME, "buffer_share");
+  std::vector<struct pollfd> fds;
+  std::vector<Consumer *> polled;
+  while (true) {
+    fds.clear();
+    polled.clear();
+    struct pollfd pfd = {wake_fd[0], POLLIN, 0};
+    fds.push_back(pfd);
+    pfd.fd = listen_fd;
+    fds.push_back(pfd);
+    {
+      std::lock_guard<std::mutex> _lg(mtx);
+      for (auto c : consumers) {
+        pfd.fd = c->sock;
+        fds.push_back(pfd);
+        polled.push_back(c);
+      }
+    }
+    if (poll(fds.data(), fds.size(), -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      LOG("BufferShare: poll: %m\n");
+      break;
+    }
+    if (fds[0].revents)
+      break;
+    if (fds[1].revents & POLLIN)
+      Accept();
+    std::vector<std::shared_ptr<void>> unheld;
+    {
+      // only this thread removes the consumers
+      std::lock_guard<std::mutex> _lg(mtx);
+      for (size_t i = 0; i < polled.size(); i++) {
+        if (!fds[i + 2].revents)
+          continue;
+        if (!HandleMessage(polled[i], unheld))
+          RemoveConsumer(polled[i], unheld);
+      }
+    }
+  }
+}
+
+void BufferShareServer::Accept() {
+  int sock = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+  if (sock < 0) {
+    LOG("BufferShare: accept: %m\n");
+    return;
+  }
+  Consumer *c = new Consumer();
+  if (!c) {
+    close(sock);
+    return;
+  }
+  c->sock = sock;
+  c->credits = max_credits;
+  std::lock_guard<std::mutex> _lg(mtx);
+  consumers.push_back(c);
+  LOGD("BufferShare: consumer %d connected to %s\n", sock, sock_path.c_str());
+}
+
+bool BufferShareServer::HandleMessage(
+    Consumer *c, std::vector<std::shared_ptr<void>> &unheld) {
+  BufferShareHeader hdr;
+  int fd = -1;
+  ssize_t len = recv_header(c->sock, hdr, fd);
+  if (fd >= 0)
+    close(fd);
+  if (len <= 0)
+    return false;
+  if (!check_header(hdr, len))
+    return false;
+  switch ((BufferShareMsg)hdr.msg) {
+  case BufferShareMsg::HELLO:
+    if (hdr.credits > 0 && (int)hdr.credits < max_credits)
+      c->credits = hdr.credits;
+    break;
+  case BufferShareMsg::RELEASE:
+    if (c->ids.erase(hdr.id))
+      Unhold(hdr.id, unheld);
+    else
+      LOG("BufferShare: release of unknown buffer %u\n", hdr.id);
+    break;
+  default:
+    LOG("BufferShare: unexpected message %u\n", hdr.msg);
+    return false;
+  }
+  return true;
+}
+
+void BufferShareServer::RemoveConsumer(
+    Consumer *c, std::vector<std::shared_ptr<void>> &unheld) {
+  for (auto id : c->ids)
+    Unhold(id, unheld);
+  consumers.remove(c);
+  close(c->sock);
+  LOGD("BufferShare: consumer %d gone\n", c->sock);
+  delete c;
+}
+
+void BufferShareServer::Unhold(uint32_t id,
+                               std::vector<std::shared_ptr<void>> &unheld) {
+  auto it = held.find(id);
+  if (it == held.end())
+    return;
+  if (--it->second.holders > 0)
+    return;
+  unheld.push_back(std::move(it->second.buffer));
+  held.erase(it);
+}
+
+std::shared_ptr<void> BufferShareServer::CopyToMemfd(MediaBuffer &mb, int &fd,
+                                                     size_t &size) {
+  size_t need = mb.GetValidSize();
+  std::shared_ptr<Memfd> m;
+  {
+    std::lock_guard<std::mutex> _lg(mtx);
+    for (auto it = free_memfds.begin(); it != free_memfds.end(); ++it) {
+      if ((*it)->size >= need) {
+        m = *it;
+        free_memfds.erase(it);
+        break;
+      }
+    }
+  }
+  if (!m) {
+    m = std::make_shared<Memfd>();
+    if (!m)
+      return nullptr;
+    m->size = UPALIGNTO(need, (size_t)PAGE_SIZE);
+    m->fd = syscall(SYS_memfd_create, "rkmedia_share", MFD_CLOEXEC);
+    if (m->fd < 0 || ftruncate(m->fd, m->size) < 0) {
+      LOG("BufferShare: fail to create memfd of %zu: %m\n", m->size);
+      return nullptr;
+    }
+    m->ptr =
+        mmap(NULL, m->size, PROT_READ | PROT_WRITE, MAP_SHARED, m->fd, 0);
+    if (m->ptr == MAP_FAILED) {
+      LOG("BufferShare: fail to mmap memfd: %m\n");
+      return nullptr;
+    }
+  }
+  memcpy(m->ptr, mb.GetPtr(), need);
+  fd = m->fd;
+  size = m->size;
+  // back to the free list once all consumers release it
+  return std::shared_ptr<void>(m.get(), [this, m](void *) {
+    std::lock_guard<std::mutex> _lg(mtx);
+    if (free_memfds.size() < BUFFER_SHARE_FREE_MEMFD_MAX)
+      free_memfds.push_back(m);
+  });
+}
+
+int BufferShareServer::Send(const std::shared_ptr<MediaBuffer> &mb) {
+  if (!mb || mb->GetValidSize() == 0)
+    return 0;
+  int ready = 0;
+  {
+    std::lock_guard<std::mutex> _lg(mtx);
+    for (auto c : consumers)
+      ready += ((int)c->ids.size() < c->credits);
+  }
+  if (!ready)
+    return 0;
+
+  BufferShareHeader hdr;
+  init_header(hdr, BufferShareMsg::BUFFER);
+  std::shared_ptr<void> hold;
+  int fd = mb->GetFD();
+  size_t map_size = mb->GetSize();
+  if (fd >= 0 && is_dma_buf(fd)) {
+    // read by the cpu of the consumers, as by a device
+    mb->BeginDeviceAccess(true);
+    hdr.fd_kind = (uint32_t)BufferShareFdKind::DMABUF;
+    hold = mb;
+  } else if (fd >= 0) {
+    // a memfd or the like, shared as is without a cache to sync
+    hdr.fd_kind = (uint32_t)BufferShareFdKind::MEMFD;
+    hold = mb;
+  } else {
+    hdr.fd_kind = (uint32_t)BufferShareFdKind::MEMFD;
+    hold = CopyToMemfd(*mb, fd, map_size);
+    if (!hold)
+      return 0;
+  }
+  hdr.map_size = map_size;
+  hdr.offset = 0;
+  hdr.valid_size = mb->GetValidSize();
+  hdr.ustimestamp = mb->GetUSTimeStamp();
+  hdr.atomic_clock = mb->GetAtomicClock();
+  hdr.user_flag = mb->GetUserFlag();
+  hdr.type = (uint32_t)mb->GetType();
+  hdr.eof = mb->IsEOF();
+  if (mb->GetType() == Type::Image) {
+    auto image = std::static_pointer_cast<ImageBuffer>(mb);
+    const ImageInfo &info = image->GetImageInfo();
+    hdr.pix_fmt = info.pix_fmt;
+    hdr.width = info.width;
+    hdr.height = info.height;
+    hdr.vir_width = info.vir_width;
+    hdr.vir_height = info.vir_height;
+  }
+
+  int sent = 0;
+  std::lock_guard<std::mutex> _lg(mtx);
+  uint32_t id = next_id++;
+  if (!id) // 0 is never a buffer
+    id = next_id++;
+  hdr.id = id;
+  for (auto c : consumers) {
+    if ((int)c->ids.size() >= c->credits)
+      continue;
+    int ret = send_header(c->sock, hdr, fd);
+    if (ret) {
+      // a full socket skips this buffer, an error is seen by the poll
+      if (ret != -EAGAIN)
+        LOG("BufferShare: fail to send to consumer %d: %s\n", c->sock,
+            strerror(-ret));
+      continue;
+    }
+    c->ids.insert(id);
+    sent++;
+  }
+  if (sent > 0) {
+    Entry &e = held[id];
+    e.buffer = hold;
+    e.holders = sent;
+  }
+  return sent;
+}
+
+int BufferShareServer::GetConsumerNum() {
+  std::lock_guard<std::mutex> _lg(mtx);
+  return consumers.size();
+}
+
+// The socket and the mappings of a client, shared with the buffers received
+// so that they release after the client is destroyed.
+class BufferShareClient::Core {
+public:
+  struct Mapping {
+    int fd;
+    void *ptr;
+    size_t size;
+    int users;
+    uint64_t last_used;
+    CacheSync cache_sync;
+  };
+  typedef std::pair<dev_t, ino_t> Key;
+
+  Core(int s) : sock(s), use_count(0) {}
+  ~Core() {
+    Close();
+    for (auto &it : mappings)
+      Unmap(it.second);
+  }
+  void Close() {
+    std::lock_guard<std::mutex> _lg(mtx);
+    if (sock >= 0)
+      close(sock);
+    sock = -1;
+  }
+  // Take the ownership of fd. Only the memfds are cached by inode, the
+  // dma-bufs share one anonymous inode before linux 5.3.
+  Mapping *Map(int fd, size_t size, bool cached);
+  void Release(Mapping *m, uint32_t id);
+  static void Unmap(Mapping *m) {
+    munmap(m->ptr, m->size);
+    close(m->fd);
+    delete m;
+  }
+
+  std::mutex mtx; // for the sock and the mappings
+  int sock;
+  std::map<Key, Mapping *> mappings;
+  uint64_t use_count;
+};
+
+BufferShareClient::Core::Mapping *
+BufferShareClient::Core::Map(int fd, size_t size, bool cached) {
+  if (!cached) {
+    void *ptr = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (ptr == MAP_FAILED) {
+      LOG("BufferShare: fail to mmap %zu: %m\n", size);
+      close(fd);
+      return nullptr;
+    }
+    Mapping *m = new Mapping();
+    m->fd = fd;
+    m->ptr = ptr;
+    m->size = size;
+    m->users = 1;
+    m->last_used = 0; // unmapped on release
+    return m;
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    LOG("BufferShare: fstat: %m\n");
+    close(fd);
+    return nullptr;
+  }
+  Key key(st.st_dev, st.st_ino);
+  std::lock_guard<std::mutex> _lg(mtx);
+  auto it = mappings.find(key);
+  if (it != mappings.end()) {
+    Mapping *m = it->second;
+    if (m->size == size) {
+      // the same buffer again, the fd is not needed any more
+      close(fd);
+      m->users++;
+      m->last_used = ++use_count;
+      return m;
+    }
+    if (m->users == 0) {
+      mappings.erase(it);
+      Unmap(m);
+    }
+  }
+  // evict the least recently used of the idle ones
+  while (mappings.size() >= BUFFER_SHARE_MAPPING_MAX) {
+    auto oldest = mappings.end();
+    for (auto i = mappings.begin(); i != mappings.end(); ++i) {
+      if (i->second->users == 0 &&
+          (oldest == mappings.end() ||
+           i->second->last_used < oldest->second->last_used))
+        oldest = i;
+    }
+    if (oldest == mappings.end())
+      break;
+    Unmap(oldest->second);
+    mappings.erase(oldest);
+  }
+  void *ptr = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  if (ptr == MAP_FAILED) {
+    LOG("BufferShare: fail to mmap %zu: %m\n", size);
+    close(fd);
+    return nullptr;
+  }
+  Mapping *m = new Mapping();
+  m->fd = fd;
+  m->ptr = ptr;
+  m->size = size;
+  m->users = 1;
+  m->last_used = ++use_count;
+  if (mappings.find(key) == mappings.end())
+    mappings[key] = m;
+  else
+    m->last_used = 0; // in use under another size, unmapped on release
+  return m;
+}
+
+void BufferShareClient::Core::Release(Mapping *m, uint32_t id) {
+  std::lock_guard<std::mutex> _lg(mtx);
+  if (sock >= 0) {
+    BufferShareHeader hdr;
+    init_header(hdr, BufferShareMsg::RELEASE);
+    hdr.id = id;
+    if (send(sock, &hdr, sizeof(hdr), MSG_NOSIGNAL) < 0)
+      LOG("BufferShare: fail to release %u: %m\n", id);
+  }
+  if (--m->users == 0 && m->last_used == 0)
+    Unmap(m);
+}
+
+BufferShareClient::BufferShareClient() {}
+
+BufferShareClient::~BufferShareClient() { Close(); }
+
+bool BufferShareClient::Connect(const std::string &path, int credits) {
+  struct sockaddr_un addr;
+  if (path.size() >= sizeof(addr.sun_path))
+    return false;
+  Close();
+  int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (sock < 0) {
+    LOG("BufferShare: socket: %m\n");
+    return false;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+  if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    LOG("BufferShare: fail to connect to %s: %m\n", path.c_str());
+    close(sock);
+    return false;
+  }
+  BufferShareHeader hdr;
+  init_header(hdr, BufferShareMsg::HELLO);
+  hdr.credits = credits > 0 ? credits : 0;
+  if (send(sock, &hdr, sizeof(hdr), MSG_NOSIGNAL) < 0) {
+    LOG("BufferShare: fail to say hello: %m\n");
+    close(sock);
+    return false;
+  }
+  core = std::make_shared<Core>(sock);
+  if (!core) {
+    close(sock);
+    return false;
+  }
+  return true;
+}
+
+void BufferShareClient::Close() {
+  // the buffers still held are released by the producer on disconnection
+  if (core)
+    core->Close();
+  core.reset();
+}
+
+int BufferShareClient::GetFD() { return core ? core->sock : -1; }
+
+std::shared_ptr<MediaBuffer> BufferShareClient::Receive(int timeout_ms) {
+  if (!core)
+    return nullptr;
+  struct pollfd pfd = {core->sock, POLLIN, 0};
+  int ret;
+  do {
+    ret = poll(&pfd, 1, timeout_ms);
+  } while (ret < 0 && errno == EINTR);
+  if (ret <= 0)
+    return nullptr;
+  BufferShareHeader hdr;
+  int fd = -1;
+  ssize_t len = recv_header(core->sock, hdr, fd);
+  if (len <= 0 || !check_header(hdr, len) ||
+      hdr.msg != (uint32_t)BufferShareMsg::BUFFER || fd < 0 ||
+      hdr.offset + hdr.valid_size > hdr.map_size) {
+    if (fd >= 0)
+      close(fd);
+    if (len <= 0)
+      LOG("BufferShare: disconnected\n");
+    return nullptr;
+  }
+  bool dmabuf = (hdr.fd_kind == (uint32_t)BufferShareFdKind::DMABUF);
+  Core::Mapping *m = core->Map(fd, hdr.map_size, !dmabuf);
+  if (!m)
+    return nullptr;
+  auto c = core;
+  uint32_t id = hdr.id;
+  // read only, the memory is the one of the producer
+  MediaBuffer mb((uint8_t *)m->ptr + hdr.offset, hdr.valid_size,
+                 dmabuf ? m->fd : -1);
+  mb.SetUserData(std::shared_ptr<void>(
+      m, [c, id](void *p) { c->Release((Core::Mapping *)p, id); }));
+  mb.SetValidSize(hdr.valid_size);
+  mb.SetUSTimeStamp(hdr.ustimestamp);
+  mb.SetAtomicClock(hdr.atomic_clock);
+  mb.SetUserFlag(hdr.user_flag);
+  mb.SetType((Type)hdr.type);
+  mb.SetEOF(hdr.eof);
+  if (dmabuf) {
+    mb.SetCacheSync(std::shared_ptr<CacheSync>(mb.GetUserData(),
+                                               &m->cache_sync));
+    // written by the producer, invalidated before the first cpu access
+    mb.EndDeviceAccess(false);
+  }
+  if (mb.GetType() == Type::Image) {
+    ImageInfo info;
+    info.pix_fmt = (PixelFormat)hdr.pix_fmt;
+    info.width = hdr.width;
+    info.height = hdr.height;
+    info.vir_width = hdr.vir_width;
+    info.vir_height = hdr.vir_height;
+    auto image = std::make_shared<ImageBuffer>(mb, info);
+    if (image)
+      image->SetValidSize(hdr.valid_size);
+    return image;
+  }
+  return std::make_shared<MediaBuffer>(mb);
+}
+
+} // namespace easymedia
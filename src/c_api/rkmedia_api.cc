@@ -7,6 +7,7 @@
 #include <mutex>
 #include <string>
 
+#include "cpu_governor.h"
 #include "encoder.h"
 #include "image.h"
 #include "key_string.h"
@@ -14,6 +15,7 @@
 #include "media_type.h"
 #include "message.h"
 #include "stream.h"
+#include "trace.h"
 #include "utils.h"
 
 #include "osd/color_table.h"
@@ -601,6 +603,9 @@ FlowOutputCallback(void *handle,
   mb->fd = rkmedia_mb->GetFD();
   mb->size = rkmedia_mb->GetValidSize();
   mb->rkmedia_mb = rkmedia_mb;
+  if (target_chn->rkmedia_flow)
+    rkmedia_mb->SetHolder(MemHolder::USER,
+                          target_chn->rkmedia_flow->GetTraceName());
   mb->mode_id = target_chn->mode_id;
   mb->chn_id = target_chn->chn_id;
   mb->timestamp = (RK_U64)rkmedia_mb->GetUSTimeStamp();
@@ -911,6 +916,219 @@ RK_S32 RK_MPI_SYS_SendMediaBuffer(MOD_ID_E enModID, RK_S32 s32ChnID,
   return RK_ERR_SYS_OK;
 }
 
+static RkmediaChannel *RkmediaChnGet(const MPP_CHN_S *pstChn,
+                                     std::mutex **mtx) {
+  RK_S32 id = pstChn->s32ChnId;
+  switch (pstChn->enModId) {
+#define RKMEDIA_CHN_CASE(MOD, CHNS, MTX, MAX)                                  \
+  case MOD:                                                                    \
+    if (id < 0 || id >= MAX)                                                   \
+      return NULL;                                                             \
+    *mtx = &MTX;                                                               \
+    return &CHNS[id];
+    RKMEDIA_CHN_CASE(RK_ID_VI, g_vi_chns, g_vi_mtx, VI_MAX_CHN_NUM)
+    RKMEDIA_CHN_CASE(RK_ID_VENC, g_venc_chns, g_venc_mtx, VENC_MAX_CHN_NUM)
+    RKMEDIA_CHN_CASE(RK_ID_AI, g_ai_chns, g_ai_mtx, AI_MAX_CHN_NUM)
+    RKMEDIA_CHN_CASE(RK_ID_AO, g_ao_chns, g_ao_mtx, AO_MAX_CHN_NUM)
+    RKMEDIA_CHN_CASE(RK_ID_AENC, g_aenc_chns, g_aenc_mtx, AENC_MAX_CHN_NUM)
+    RKMEDIA_CHN_CASE(RK_ID_ADEC, g_adec_chns, g_adec_mtx, ADEC_MAX_CHN_NUM)
+    RKMEDIA_CHN_CASE(RK_ID_ALGO_MD, g_algo_md_chns, g_algo_md_mtx,
+                     ALGO_MD_MAX_CHN_NUM)
+    RKMEDIA_CHN_CASE(RK_ID_ALGO_OD, g_algo_od_chns, g_algo_od_mtx,
+                     ALGO_OD_MAX_CHN_NUM)
+    RKMEDIA_CHN_CASE(RK_ID_RGA, g_rga_chns, g_rga_mtx, RGA_MAX_CHN_NUM)
+    RKMEDIA_CHN_CASE(RK_ID_VO, g_vo_chns, g_vo_mtx, VO_MAX_CHN_NUM)
+#undef RKMEDIA_CHN_CASE
+  default:
+    return NULL;
+  }
+}
+
+static std::shared_ptr<easymedia::Flow>
+RkmediaChnGetFlow(const MPP_CHN_S *pstChn) {
+  std::shared_ptr<easymedia::Flow> flow;
+  std::mutex *mtx = NULL;
+  RkmediaChannel *target_chn = RkmediaChnGet(pstChn, &mtx);
+  if (!target_chn)
+    return flow;
+  mtx->lock();
+  if (target_chn->status >= CHN_STATUS_OPEN)
+    flow = target_chn->rkmedia_flow;
+  mtx->unlock();
+  return flow;
+}
+
+static void RkmediaHistogramCopy(HISTOGRAM_S *pstHist,
+                                 const easymedia::HistogramInfo &info) {
+  pstHist->u64Count = info.count;
+  pstHist->u64SumUs = info.sum;
+  pstHist->u64MaxUs = info.max;
+  for (int i = 0; i < RK_HISTOGRAM_BUCKETS; i++)
+    pstHist->au64Buckets[i] = info.buckets[i];
+}
+
+static_assert(RK_HISTOGRAM_BUCKETS == FLOW_HISTOGRAM_BUCKETS,
+              "histogram buckets mismatch");
+
+RK_S32 RK_MPI_SYS_GetChnStat(const MPP_CHN_S *pstChn, CHN_STAT_S *pstStat) {
+  if (!pstChn || !pstStat)
+    return -RK_ERR_SYS_ILLEGAL_PARAM;
+  auto flow = RkmediaChnGetFlow(pstChn);
+  if (!flow)
+    return -RK_ERR_SYS_NOTREADY;
+
+  easymedia::FlowStats stats;
+  flow->GetStats(stats);
+  memset(pstStat, 0, sizeof(*pstStat));
+  RkmediaHistogramCopy(&pstStat->stProcessTime, stats.process_time);
+  RkmediaHistogramCopy(&pstStat->stProcessCpuTime, stats.process_cpu_time);
+  pstStat->u64ProcessFailed = stats.process_failed;
+  RkmediaHistogramCopy(&pstStat->stPaceJitter, stats.pace_jitter);
+  pstStat->u64PaceSkipped = stats.pace_skipped;
+  pstStat->u64Decimated = stats.decimated;
+  pstStat->u32InputNum = stats.inputs.size();
+  for (RK_U32 i = 0; i < stats.inputs.size() && i < RK_CHN_STAT_MAX_SLOT;
+       i++) {
+    auto &is = stats.inputs[i];
+    CHN_INPUT_STAT_S *pstIn = &pstStat->astInput[i];
+    pstIn->u64Received = is.received;
+    pstIn->u64DropFront = is.drop_front;
+    pstIn->u64DropCurrent = is.drop_current;
+    pstIn->u64DropStale = is.drop_stale;
+    pstIn->u64DropOvertaken = is.drop_overtaken;
+    pstIn->u64Replaced = is.replaced;
+    pstIn->u64HighPriority = is.high_priority;
+    pstIn->u64Blocked = is.blocked;
+    pstIn->u64BlockedUs = is.blocked_us;
+    pstIn->u32Depth = is.depth;
+    pstIn->u32PeakDepth = is.peak_depth;
+    pstIn->u32Capacity = is.capacity;
+    RkmediaHistogramCopy(&pstIn->stInterArrival, is.inter_arrival);
+  }
+  pstStat->u32OutputNum = stats.outputs.size();
+  for (RK_U32 i = 0; i < stats.outputs.size() && i < RK_CHN_STAT_MAX_SLOT;
+       i++) {
+    auto &os = stats.outputs[i];
+    CHN_OUTPUT_STAT_S *pstOut = &pstStat->astOutput[i];
+    pstOut->u64Buffers = os.buffers;
+    pstOut->u64Sent = os.sent;
+    pstOut->u64NullSent = os.null_sent;
+    pstOut->u64Skipped = os.skipped;
+    pstOut->u64ThrottledUs = os.throttled_us;
+    pstOut->u32FanOut = os.fan_out;
+  }
+  return RK_ERR_SYS_OK;
+}
+
+RK_S32 RK_MPI_SYS_ResetChnStat(const MPP_CHN_S *pstChn) {
+  if (!pstChn)
+    return -RK_ERR_SYS_ILLEGAL_PARAM;
+  auto flow = RkmediaChnGetFlow(pstChn);
+  if (!flow)
+    return -RK_ERR_SYS_NOTREADY;
+  flow->ResetStats();
+  return RK_ERR_SYS_OK;
+}
+
+RK_S32 RK_MPI_SYS_SetChnDecimation(const MPP_CHN_S *pstChn,
+                                   RK_U32 u32Decimation) {
+  if (!pstChn || !u32Decimation)
+    return -RK_ERR_SYS_ILLEGAL_PARAM;
+  auto flow = RkmediaChnGetFlow(pstChn);
+  if (!flow)
+    return -RK_ERR_SYS_NOTREADY;
+  flow->SetDecimation(u32Decimation);
+  return RK_ERR_SYS_OK;
+}
+
+static std::unique_ptr<easymedia::CpuGovernor> g_cpu_governor;
+static std::mutex g_cpu_governor_mtx;
+
+RK_S32 RK_MPI_SYS_StartCpuGovernor(RK_U32 u32BudgetPercent,
+                                   RK_U32 u32PeriodMs, RK_U32 u32Hysteresis) {
+  if (!u32BudgetPercent || u32Hysteresis >= 100)
+    return -RK_ERR_SYS_ILLEGAL_PARAM;
+  std::lock_guard<std::mutex> _lg(g_cpu_governor_mtx);
+  if (g_cpu_governor)
+    return -RK_ERR_SYS_BUSY;
+  g_cpu_governor.reset(new easymedia::CpuGovernor(
+      u32BudgetPercent, u32PeriodMs, u32Hysteresis));
+  if (!g_cpu_governor->Start()) {
+    g_cpu_governor.reset();
+    return -RK_ERR_SYS_NOMEM;
+  }
+  return RK_ERR_SYS_OK;
+}
+
+RK_S32 RK_MPI_SYS_StopCpuGovernor() {
+  std::lock_guard<std::mutex> _lg(g_cpu_governor_mtx);
+  if (!g_cpu_governor)
+    return -RK_ERR_SYS_NOTREADY;
+  g_cpu_governor.reset();
+  return RK_ERR_SYS_OK;
+}
+
+RK_S32 RK_MPI_SYS_AddCpuDegradeStep(const MPP_CHN_S *pstChn,
+                                    RK_U32 u32Decimation) {
+  if (!pstChn || u32Decimation < 2)
+    return -RK_ERR_SYS_ILLEGAL_PARAM;
+  auto flow = RkmediaChnGetFlow(pstChn);
+  if (!flow)
+    return -RK_ERR_SYS_NOTREADY;
+  std::lock_guard<std::mutex> _lg(g_cpu_governor_mtx);
+  if (!g_cpu_governor)
+    return -RK_ERR_SYS_NOTREADY;
+  char name[64];
+  snprintf(name, sizeof(name), "mod %d dev %d chn %d / %u",
+           (int)pstChn->enModId, pstChn->s32DevId, pstChn->s32ChnId,
+           u32Decimation);
+  g_cpu_governor->AddStep(name, flow, u32Decimation);
+  return RK_ERR_SYS_OK;
+}
+
+RK_S32 RK_MPI_SYS_GetCpuGovernorState(RK_U32 *pu32UsagePercent,
+                                      RK_U32 *pu32Level) {
+  if (!pu32UsagePercent || !pu32Level)
+    return -RK_ERR_SYS_ILLEGAL_PARAM;
+  std::lock_guard<std::mutex> _lg(g_cpu_governor_mtx);
+  if (!g_cpu_governor)
+    return -RK_ERR_SYS_NOTREADY;
+  *pu32UsagePercent = g_cpu_governor->GetUsage();
+  *pu32Level = g_cpu_governor->GetLevel();
+  return RK_ERR_SYS_OK;
+}
+
+RK_S32 RK_MPI_SYS_StartWatchdog(RK_U32 u32StallMs) {
+  if (!u32StallMs)
+    return -RK_ERR_SYS_ILLEGAL_PARAM;
+  if (!easymedia::EnableFlowWatchdog(u32StallMs))
+    return -RK_ERR_SYS_NOMEM;
+  return RK_ERR_SYS_OK;
+}
+
+RK_S32 RK_MPI_SYS_StopWatchdog() {
+  easymedia::DisableFlowWatchdog();
+  return RK_ERR_SYS_OK;
+}
+
+RK_S32 RK_MPI_SYS_StartTrace(RK_U32 u32EventsPerThread) {
+  easymedia::EnableTrace(u32EventsPerThread);
+  return RK_ERR_SYS_OK;
+}
+
+RK_S32 RK_MPI_SYS_StopTrace() {
+  easymedia::DisableTrace();
+  return RK_ERR_SYS_OK;
+}
+
+RK_S32 RK_MPI_SYS_DumpTrace(const RK_CHAR *pcFilePath) {
+  if (!pcFilePath)
+    return -RK_ERR_SYS_ILLEGAL_PARAM;
+  if (easymedia::DumpTrace(pcFilePath) < 0)
+    return -RK_ERR_SYS_NOT_PERM;
+  return RK_ERR_SYS_OK;
+}
+
 /********************************************************************
  * Vi api
  ********************************************************************/
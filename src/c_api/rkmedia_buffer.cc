@@ -113,7 +113,8 @@ MEDIA_BUFFER RK_MPI_MB_CreateAudioBuffer(RK_U32 u32BufferSize,
     return NULL;
   }
   mb->rkmedia_mb = rkmedia_mb;
-  mb->ptr = rkmedia_mb->GetPtr();
+  rkmedia_mb->SetHolder(easymedia::MemHolder::USER, __func__);
+  mb->ptr = rkmedia_mb->GetWritablePtr();
   mb->fd = rkmedia_mb->GetFD();
   mb->size = 0;
   mb->type = MB_TYPE_AUDIO;
@@ -171,7 +172,8 @@ MEDIA_BUFFER RK_MPI_MB_CreateImageBuffer(MB_IMAGE_INFO_S *pstImageInfo,
                                 (int)pstImageInfo->u32VerStride};
   mb->rkmedia_mb = std::make_shared<easymedia::ImageBuffer>(*(rkmedia_mb.get()),
                                                             rkmediaImageInfo);
-  mb->ptr = mb->rkmedia_mb->GetPtr();
+  mb->rkmedia_mb->SetHolder(easymedia::MemHolder::USER, __func__);
+  mb->ptr = mb->rkmedia_mb->GetWritablePtr();
   mb->fd = mb->rkmedia_mb->GetFD();
   mb->size = 0;
   mb->type = MB_TYPE_IMAGE;
@@ -270,7 +272,8 @@ MEDIA_BUFFER RK_MPI_MB_CreateBuffer(RK_U32 u32Size, RK_BOOL boolHardWare,
     return NULL;
   }
 
-  mb->ptr = mb->rkmedia_mb->GetPtr();
+  mb->rkmedia_mb->SetHolder(easymedia::MemHolder::USER, __func__);
+  mb->ptr = mb->rkmedia_mb->GetWritablePtr();
   mb->fd = mb->rkmedia_mb->GetFD();
   mb->size = 0;
   mb->type = MB_TYPE_COMMON;
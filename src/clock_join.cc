@@ -0,0 +1,90 @@
+// Copyright 2019 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "clock_join.h"
+
+#include "buffer.h"
+#include "key_string.h"
+
+namespace easymedia {
+
+ClockJoin::ClockJoin(int slot_num, int64_t tolerance_us, int64_t timeout_us,
+                     JoinPolicy p, size_t max_num)
+    : tolerance(tolerance_us), timeout(timeout_us), policy(p),
+      references(max_num) {
+  slots.resize(slot_num > 1 ? slot_num : 1);
+  for (auto &slot : slots)
+    slot.SetCapacity(max_num);
+}
+
+void ClockJoin::Push(int slot, const std::shared_ptr<MediaBuffer> &buffer) {
+  if (slot < 0 || slot >= (int)slots.size() || !buffer)
+    return;
+  int64_t clock = buffer->GetAtomicClock();
+  if (!clock) {
+    LOGD("ClockJoin: slot %d, buffer without atomic clock\n", slot);
+    return;
+  }
+  if (slot == 0)
+    references.Insert(clock, Reference{buffer, getmonotonictime()});
+  else
+    slots[slot].Insert(clock, buffer);
+}
+
+bool ClockJoin::Pop(std::vector<std::shared_ptr<MediaBuffer>> &out) {
+  int64_t target;
+  const Reference *ref = references.Oldest(&target);
+  if (!ref)
+    return false;
+  bool timed_out = getmonotonictime() - ref->arrival >= timeout;
+  size_t num = slots.size();
+  std::vector<const std::shared_ptr<MediaBuffer> *> matched(num, nullptr);
+  std::vector<int64_t> clocks(num, 0);
+  for (size_t i = 1; i < num; i++) {
+    auto &slot = slots[i];
+    if (policy == JoinPolicy::LATEST) {
+      // never waits, the newest one known is the best
+      matched[i] = slot.Find(target, tolerance, policy, &clocks[i]);
+      continue;
+    }
+    matched[i] = slot.Find(target, tolerance, JoinPolicy::EXACT, &clocks[i]);
+    if (matched[i])
+      continue;
+    if (!timed_out && !slot.Passed(target, tolerance))
+      return false;
+    if (policy == JoinPolicy::NEAREST)
+      matched[i] = slot.Find(target, tolerance, policy, &clocks[i]);
+  }
+
+  out.assign(num, nullptr);
+  out[0] = ref->buffer;
+  for (size_t i = 1; i < num; i++) {
+    auto &slot = slots[i];
+    if (matched[i]) {
+      out[i] = *matched[i];
+      slot.EraseBefore(clocks[i], policy != JoinPolicy::LATEST);
+    } else {
+      // the later references will not match them either
+      slot.EraseBefore(target - tolerance);
+    }
+  }
+  references.PopOldest();
+  return true;
+}
+
+void ClockJoin::Clear() {
+  references.Clear();
+  for (auto &slot : slots)
+    slot.Clear();
+}
+
+JoinPolicy GetJoinPolicyByString(const std::string &policy) {
+  if (policy == KEY_JOIN_NEAREST)
+    return JoinPolicy::NEAREST;
+  if (policy == KEY_JOIN_LATEST)
+    return JoinPolicy::LATEST;
+  return JoinPolicy::EXACT;
+}
+
+} // namespace easymedia
@@ -98,8 +98,20 @@ const uint8_t *find_nalu_startcode(const uint8_t *p, const uint8_t *end) {
   return out;
 }
 
-std::list<std::shared_ptr<MediaBuffer>>
-split_h264_separate(const uint8_t *buffer, size_t length, int64_t timestamp) {
+static std::shared_ptr<MediaBuffer>
+new_nal_buffer(const uint8_t *data, size_t size, MediaBuffer *owner) {
+  if (owner)
+    return MediaBuffer::View(*owner, data - (uint8_t *)owner->GetPtr(), size);
+  auto sub_buffer = MediaBuffer::Alloc(size);
+  if (sub_buffer)
+    memcpy(sub_buffer->GetPtr(), data, size);
+  return sub_buffer;
+}
+
+// Views of owner if set, or copies.
+static std::list<std::shared_ptr<MediaBuffer>>
+split_h264(const uint8_t *buffer, size_t length, int64_t timestamp,
+           MediaBuffer *owner) {
   std::list<std::shared_ptr<MediaBuffer>> l;
   const uint8_t *p = buffer;
   const uint8_t *end = p + length;
@@ -128,13 +140,12 @@ split_h264_separate(const uint8_t *buffer, size_t length, int64_t timestamp) {
     if (!flag)
       break;
 
-    auto sub_buffer = MediaBuffer::Alloc(size);
+    auto sub_buffer = new_nal_buffer(nal_start - start_len, size, owner);
     if (!sub_buffer) {
       LOG_NO_MEMORY(); // fatal error
       l.clear();
       return l;
     }
-    memcpy(sub_buffer->GetPtr(), nal_start - start_len, size);
     sub_buffer->SetValidSize(size);
     sub_buffer->SetUserFlag(flag);
     sub_buffer->SetUSTimeStamp(timestamp);
@@ -147,7 +158,20 @@ split_h264_separate(const uint8_t *buffer, size_t length, int64_t timestamp) {
 }
 
 std::list<std::shared_ptr<MediaBuffer>>
-split_h265_separate(const uint8_t *buffer, size_t length, int64_t timestamp) {
+split_h264_separate(const uint8_t *buffer, size_t length, int64_t timestamp) {
+  return split_h264(buffer, length, timestamp, nullptr);
+}
+
+std::list<std::shared_ptr<MediaBuffer>>
+split_h264_separate(MediaBuffer &buffer) {
+  return split_h264((const uint8_t *)buffer.GetPtr(), buffer.GetValidSize(),
+                    buffer.GetUSTimeStamp(), &buffer);
+}
+
+// Views of owner if set, or copies.
+static std::list<std::shared_ptr<MediaBuffer>>
+split_h265(const uint8_t *buffer, size_t length, int64_t timestamp,
+           MediaBuffer *owner) {
   std::list<std::shared_ptr<MediaBuffer>> l;
   const uint8_t *p = buffer;
   const uint8_t *end = p + length;
@@ -177,13 +201,12 @@ split_h265_separate(const uint8_t *buffer, size_t length, int64_t timestamp) {
     if (!flag)
       break;
 
-    auto sub_buffer = MediaBuffer::Alloc(size);
+    auto sub_buffer = new_nal_buffer(nal_start - start_len, size, owner);
     if (!sub_buffer) {
       LOG_NO_MEMORY(); // fatal error
       l.clear();
       return l;
     }
-    memcpy(sub_buffer->GetPtr(), nal_start - start_len, size);
     sub_buffer->SetValidSize(size);
     sub_buffer->SetUserFlag(flag);
     sub_buffer->SetUSTimeStamp(timestamp);
@@ -194,6 +217,17 @@ split_h265_separate(const uint8_t *buffer, size_t length, int64_t timestamp) {
   return std::move(l);
 }
 
+std::list<std::shared_ptr<MediaBuffer>>
+split_h265_separate(const uint8_t *buffer, size_t length, int64_t timestamp) {
+  return split_h265(buffer, length, timestamp, nullptr);
+}
+
+std::list<std::shared_ptr<MediaBuffer>>
+split_h265_separate(MediaBuffer &buffer) {
+  return split_h265((const uint8_t *)buffer.GetPtr(), buffer.GetValidSize(),
+                    buffer.GetUSTimeStamp(), &buffer);
+}
+
 static void *FindNaluByType(std::shared_ptr<MediaBuffer> &mb, int nal_type,
                             int &size, CodecType c_type) {
   if ((c_type != CODEC_TYPE_H264) && (c_type != CODEC_TYPE_H265)) {
@@ -0,0 +1,152 @@
+// Copyright 2019 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "cpu_governor.h"
+
+#include <sys/prctl.h>
+#include <time.h>
+
+#include "flow.h"
+
+namespace easymedia {
+
+// A step is reverted only after the usage stays low for that many periods,
+// so that a restore does not bounce right back over the budget.
+#define CPU_GOVERNOR_RESTORE_PERIODS 3
+
+// return microseconds of the cpu time consumed by all threads of the process
+static int64_t getprocesscputime() {
+  struct timespec ts;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+CpuGovernor::CpuGovernor(int budget, int period_ms, int hyst)
+    : period(period_ms > 0 ? period_ms : 1000),
+      hysteresis(hyst >= 0 && hyst < 100 ? hyst : 10), cpu_budget(budget),
+      usage(0), level(0), calm_periods(0), th(nullptr), quit(false) {}
+
+CpuGovernor::~CpuGovernor() {
+  Stop();
+  RestoreAll();
+}
+
+void CpuGovernor::AddStep(const std::string &name,
+                          std::function<void()> degrade,
+                          std::function<void()> restore) {
+  std::lock_guard<std::mutex> _lg(mtx);
+  Step step = {name, degrade, restore};
+  steps.push_back(step);
+}
+
+void CpuGovernor::AddStep(const std::string &name, std::shared_ptr<Flow> flow,
+                          int decimation) {
+  std::weak_ptr<Flow> weak_flow = flow;
+  // the decimation before degrade, to restore
+  auto last = std::make_shared<int>(1);
+  AddStep(
+      name,
+      [weak_flow, decimation, last] {
+        auto f = weak_flow.lock();
+        if (!f)
+          return;
+        *last = f->GetDecimation();
+        f->SetDecimation(decimation);
+      },
+      [weak_flow, last] {
+        auto f = weak_flow.lock();
+        if (f)
+          f->SetDecimation(*last);
+      });
+}
+
+bool CpuGovernor::Start() {
+  std::lock_guard<std::mutex> _lg(mtx);
+  if (th)
+    return true;
+  quit = false;
+  th = new std::thread(&CpuGovernor::Run, this);
+  if (!th) {
+    errno = ENOMEM;
+    return false;
+  }
+  return true;
+}
+
+void CpuGovernor::Stop() {
+  std::thread *t;
+  {
+    std::lock_guard<std::mutex> _lg(mtx);
+    quit = true;
+    t = th;
+    th = nullptr;
+  }
+  cond.notify_all();
+  if (t) {
+    t->join();
+    delete t;
+  }
+}
+
+void CpuGovernor::Run() {
+  prctl(PR_SET_NAME, "cpu_governor");
+  int64_t last_cpu = getprocesscputime();
+  int64_t last_wall = getmonotonictime();
+  auto deadline = std::chrono::steady_clock::now();
+  std::unique_lock<std::mutex> lck(mtx);
+  while (!quit) {
+    deadline += std::chrono::milliseconds(period);
+    if (cond.wait_until(lck, deadline, [this] { return quit; }))
+      break;
+    int64_t cpu = getprocesscputime();
+    int64_t wall = getmonotonictime();
+    Update(cpu - last_cpu, wall - last_wall);
+    last_cpu = cpu;
+    last_wall = wall;
+  }
+}
+
+// Called with mtx held.
+void CpuGovernor::Update(int64_t cpu_time, int64_t wall_time) {
+  if (wall_time <= 0)
+    return;
+  int now = (int)(cpu_time * 100 / wall_time);
+  int budget = cpu_budget;
+  int l = level;
+  usage = now;
+  if (now > budget) {
+    calm_periods = 0;
+    if (l >= (int)steps.size())
+      return;
+    LOG("CpuGovernor: cpu %d%% over budget %d%%, degrade %d: %s\n", now,
+        budget, l, steps[l].name.c_str());
+    if (steps[l].degrade)
+      steps[l].degrade();
+    level = l + 1;
+  } else if (l > 0 && now < budget * (100 - hysteresis) / 100) {
+    if (++calm_periods < CPU_GOVERNOR_RESTORE_PERIODS)
+      return;
+    calm_periods = 0;
+    l--;
+    LOG("CpuGovernor: cpu %d%% under budget %d%%, restore %d: %s\n", now,
+        budget, l, steps[l].name.c_str());
+    if (steps[l].restore)
+      steps[l].restore();
+    level = l;
+  } else {
+    calm_periods = 0;
+  }
+}
+
+void CpuGovernor::RestoreAll() {
+  std::lock_guard<std::mutex> _lg(mtx);
+  for (int l = level - 1; l >= 0; l--) {
+    if (steps[l].restore)
+      steps[l].restore();
+  }
+  level = 0;
+  calm_periods = 0;
+}
+
+} // namespace easymedia
@@ -6,14 +6,130 @@
 
 #include <algorithm>
 #include <assert.h>
+#include <limits.h>
+#include <stdlib.h>
 #include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
 
 #include "buffer.h"
 #include "key_string.h"
+#include "trace.h"
 #include "utils.h"
 
 namespace easymedia {
 
+// The input ring queue is bounded, this is the size for "no limit" inputs.
+#define FLOW_INPUT_UNLIMITED_CACHE_NUM 1024
+// Size of the high priority lane of an input, a full lane falls back to the
+// normal one.
+#define FLOW_INPUT_PRIORITY_CACHE_NUM 16
+// Max continuous runs of one task before the worker picks the next one.
+#define FLOW_SCHEDULER_MAX_BATCH 8
+// Max flows on the way to look up for credit, in case of a loop.
+#define FLOW_CREDIT_MAX_DEPTH 16
+// The watchdog checks this many times within the stall time, in [10, 250] ms.
+#define FLOW_WATCHDOG_CHECKS_PER_STALL 4
+
+class FlowScheduler;
+
+// Shared by a coroutine and its inputs. A producer may still hold the input
+// after the coroutine is gone, so the input never points to the coroutine.
+class CoroutineWaker {
+public:
+  CoroutineWaker() : batch_threshold(0), task(nullptr) {}
+  void Notify();
+  void SetTask(FlowCoroutine *c);
+
+  // the dedicated thread of coroutine sleeps on it
+  FutexEvent event;
+  // Not 0 while the thread waits for a batch, the producers only notify
+  // once an input queues that many buffers.
+  std::atomic_int batch_threshold;
+
+private:
+  SpinLockMutex task_mtx;
+  // not null if the coroutine runs on the flow scheduler
+  std::atomic<FlowCoroutine *> task;
+};
+
+// Updated by a coroutine around each process, read by the flow watchdog.
+class Heartbeat {
+public:
+  Heartbeat()
+      : busy_since(0), progress(0), frame(0), push_since(0),
+        push_flow(nullptr), push_slot(-1), stall_since(0) {}
+
+  std::atomic<int64_t> busy_since; // us, 0 if not processing
+  std::atomic<int64_t> progress;   // us of the last process done
+  std::atomic<int64_t> frame;      // atomic clock of the buffer in process
+  std::atomic<int64_t> push_since; // us, 0 if not blocked in a push
+  std::atomic<const char *> push_flow;
+  std::atomic_int push_slot;
+  int64_t stall_since; // watchdog only, 0 if no stall reported
+};
+
+// The heartbeat of the coroutine in process on this thread, so that a
+// blocking push to a down flow is accounted to it.
+static thread_local Heartbeat *current_heartbeat = nullptr;
+// Heartbeats are only updated while the watchdog runs, from the next process.
+static std::atomic_bool watchdog_enabled(false);
+
+class FlowWatchdog {
+public:
+  FlowWatchdog();
+  bool Enable(int stall_ms, FlowStallHandler handler);
+  void Disable();
+  void Register(FlowCoroutine *c);
+  void Unregister(FlowCoroutine *c);
+
+private:
+  void Run();
+  void Check(int64_t now, std::vector<FlowStall> &stalls);
+
+  std::mutex mtx;
+  std::condition_variable cond;
+  std::list<FlowCoroutine *> watched;
+  std::thread *th;
+  bool quit;
+  bool env_checked;
+  int64_t stall_us;
+  FlowStallHandler stall_handler;
+};
+
+static FlowWatchdog *GetFlowWatchdog();
+static int64_t clock_age(int64_t clock);
+
+enum class TaskState { IDLE, QUEUED, RUNNING, RUNNING_NOTIFIED, DETACHING };
+
+// Fixed-size worker pool, runs the scheduled coroutines which have inputs.
+class FlowScheduler {
+public:
+  FlowScheduler(int worker_num);
+  ~FlowScheduler();
+  int GetWorkerNum() { return (int)workers.size(); }
+  void Dispatch(FlowCoroutine *c);
+  // After return, the coroutine is neither queued nor running.
+  void Detach(FlowCoroutine *c);
+
+private:
+  void WorkerRun(int id);
+
+  std::mutex mtx;
+  std::condition_variable work_cond;
+  std::condition_variable detach_cond;
+  std::deque<FlowCoroutine *> ready_tasks;
+  std::vector<std::thread *> workers;
+  bool quit;
+};
+
+static std::shared_ptr<FlowScheduler> GetFlowScheduler();
+
 class FlowCoroutine {
 public:
   FlowCoroutine(Flow *f, Model sync_model, FunctionProcess func, float inter);
@@ -25,21 +141,40 @@ public:
   int GetCachedBufferCnt();
   bool IsProcessing();
   void ClearCachedBuffers();
+  bool HasThread() { return th != nullptr; }
+  int ChangeThreadAttr(const ThreadAttr &attr);
+  int QueryThreadAttr(ThreadAttr &attr);
+  void WakeUp() { waker->Notify(); }
+  bool RunInline(Flow::Input &input, std::shared_ptr<MediaBuffer> &buffer);
+  bool CanRunInline(bool producer_on_scheduler);
+  bool RunOnScheduler() { return scheduler != nullptr; }
+  bool MoveToThread();
+  bool HasOutSlot(int idx) {
+    return std::find(out_slots.begin(), out_slots.end(), idx) !=
+           out_slots.end();
+  }
+  const std::shared_ptr<CoroutineWaker> &GetWaker() { return waker; }
 
 private:
+  void InitThread();
   void WhileRun();
   void WhileRunSleep();
+  bool RunTask();
+  void ProcessInput();
+  void RunOnceCommon();
+  void WaitBatch();
   void SyncFetchInput(MediaBufferVector &in);
-  void ASyncFetchInputCommon(MediaBufferVector &in);
+  bool ASyncTryFetchInputCommon(MediaBufferVector &in);
   void ASyncFetchInputAtomic(MediaBufferVector &in);
 
   void SendNullBufferDown(Flow::FlowMap &fm, const MediaBufferVector &in,
-                          std::list<Flow::FlowInputMap> &flows);
+                          const Flow::FlowInputMapList &flows);
   void SendBufferDown(Flow::FlowMap &fm, const MediaBufferVector &in,
-                      std::list<Flow::FlowInputMap> &flows, bool process_ret);
+                      const Flow::FlowInputMapList &flows, bool process_ret);
   void SendBufferDownFromDeque(Flow::FlowMap &fm, const MediaBufferVector &in,
-                               std::list<Flow::FlowInputMap> &flows,
+                               const Flow::FlowInputMapList &flows,
                                bool process_ret);
+  bool HasCredit(const Flow::FlowInputMap &f);
   size_t OutputHoldRelated(Flow::FlowMap &fm,
                            std::shared_ptr<MediaBuffer> &out_buffer,
                            const MediaBufferVector &input_vector);
@@ -54,25 +189,61 @@ private:
   bool is_processing;
   bool clear_buffers_enable;
   ConditionLockMutex clear_buffers_mtx;
+  // Shared with the bound inputs, notified when any of them get a buffer.
+  std::shared_ptr<CoroutineWaker> waker;
+  // not null if run on the flow scheduler instead of a dedicated thread
+  std::shared_ptr<FlowScheduler> scheduler;
+  TaskState task_state; // protected by scheduler
+  std::mutex attr_mtx;
+  ThreadAttr thread_attr;
+  pid_t tid;
+  // held while fetching and processing of ASYNCCOMMON, so that the producer
+  // of a fused input never runs the process at the same time
+  std::mutex run_mtx;
 
   MediaBufferVector in_vector;
   decltype(&FlowCoroutine::SyncFetchInput) fetch_input_func;
   decltype(&FlowCoroutine::SendBufferDown) send_down_func;
 
+  Heartbeat heartbeat;
+
+  friend class CoroutineWaker;
+  friend class FlowScheduler;
+  friend class FlowWatchdog;
+
 public:
   void SetMarkName(std::string s) { name = s; }
   void SetExpectProcessTime(int time) { expect_process_time = time; }
+  void SetDedicatedThread(bool dedicated) { dedicated_thread = dedicated; }
+  void SetPacePolicy(PacePolicy policy) { pace_policy = policy; }
+  void SetBatch(int num, int window) {
+    batch_num = num > 1 ? num : 1;
+    batch_window = window > 0 ? window : 0;
+  }
+  void SetThreadAttr(const ThreadAttr &attr) { thread_attr = attr; }
 
   std::string name;
   int expect_process_time; // ms
+  bool dedicated_thread;
+  PacePolicy pace_policy; // if ASYNCATOMIC
+  int batch_num;          // if ASYNCCOMMON
+  int batch_window;       // ms
 };
 
 FlowCoroutine::FlowCoroutine(Flow *f, Model sync_model, FunctionProcess func,
                              float inter)
     : flow(f), model(sync_model), interval(inter), th(nullptr), th_run(func),
-      is_processing(false), clear_buffers_enable(false), expect_process_time(0) {}
+      is_processing(false), clear_buffers_enable(false),
+      waker(std::make_shared<CoroutineWaker>()), task_state(TaskState::IDLE),
+      tid(0), expect_process_time(0), dedicated_thread(false),
+      pace_policy(PacePolicy::CATCHUP), batch_num(1), batch_window(0) {}
 
 FlowCoroutine::~FlowCoroutine() {
+  GetFlowWatchdog()->Unregister(this);
+  if (scheduler) {
+    waker->SetTask(nullptr);
+    scheduler->Detach(this);
+  }
   if (th) {
     th->join();
     delete th;
@@ -92,8 +263,10 @@ bool FlowCoroutine::Start() {
   auto func = &FlowCoroutine::WhileRun;
   switch (model) {
   case Model::ASYNCCOMMON:
-    need_thread = true;
-    fetch_input_func = &FlowCoroutine::ASyncFetchInputCommon;
+    if (!dedicated_thread && thread_attr.IsDefault())
+      scheduler = GetFlowScheduler();
+    need_thread = !scheduler;
+    fetch_input_func = nullptr; // see RunOnceCommon
     send_down_func = &FlowCoroutine::SendBufferDownFromDeque;
     break;
   case Model::ASYNCATOMIC:
@@ -111,6 +284,9 @@ bool FlowCoroutine::Start() {
     return false;
   }
   in_vector.resize(in_slots.size());
+  GetFlowWatchdog()->Register(this);
+  if (scheduler)
+    waker->SetTask(this);
   if (need_thread) {
     th = new std::thread(func, this);
     if (!th) {
@@ -130,63 +306,265 @@ static void check_consume_time(const char *name, int expect, int exactly) {
 #endif
 
 void FlowCoroutine::RunOnce() {
-  bool ret = true;
+  if (model == Model::ASYNCCOMMON) {
+    RunOnceCommon();
+    return;
+  }
   (this->*fetch_input_func)(in_vector);
+  ProcessInput();
+}
 
-  if (flow->GetRunTimesRemaining()) {
-#ifndef NDEBUG
-    {
-      AutoDuration ad;
-#endif
-      is_processing = true;
-      ret = (*th_run)(flow, in_vector);
-      is_processing = false;
-#ifndef NDEBUG
-      if (expect_process_time > 0)
-        check_consume_time(name.c_str(), expect_process_time,
-                           (int)(ad.Get() / 1000));
+// The task run by the worker of the flow scheduler on this thread.
+static thread_local FlowCoroutine *running_task = nullptr;
+
+// Run by a worker of the flow scheduler, which must not block. The flows
+// which may block leave the scheduler, see MoveToThread.
+bool FlowCoroutine::RunTask() {
+  std::lock_guard<std::mutex> _lg(run_mtx);
+  if (flow->quit || !ASyncTryFetchInputCommon(in_vector))
+    return false;
+  ProcessInput();
+  for (int i = 1; i < batch_num && !flow->quit; i++) {
+    if (!ASyncTryFetchInputCommon(in_vector))
+      break;
+    ProcessInput();
+  }
+  return true;
+}
+
+// Called by the producer of a fused input, return false to queue the buffer.
+bool FlowCoroutine::RunInline(Flow::Input &input,
+                              std::shared_ptr<MediaBuffer> &buffer) {
+  std::lock_guard<std::mutex> _lg(run_mtx);
+  // the buffers queued before being fused go first
+  if (flow->quit || !input.Empty())
+    return false;
+  in_vector[0] = buffer;
+  ProcessInput();
+  return true;
+}
+
+// Leave the flow scheduler for an own thread, as a blocked worker may wait
+// for a task which no other worker is free to run. Not from its own process.
+bool FlowCoroutine::MoveToThread() {
+  std::lock_guard<std::mutex> _lg(attr_mtx);
+  if (!scheduler)
+    return true;
+  if (running_task == this)
+    return false;
+  waker->SetTask(nullptr);
+  scheduler->Detach(this);
+  scheduler.reset();
+  dedicated_thread = true;
+  // the producers on the scheduler must not run the process inline either
+  for (int idx : in_slots)
+    flow->v_input[idx].fused = false;
+  th = new std::thread(&FlowCoroutine::WhileRun, this);
+  if (!th) {
+    LOG("%s: fail to create thread\n", name.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool FlowCoroutine::CanRunInline(bool producer_on_scheduler) {
+  if (model != Model::ASYNCCOMMON || in_slots.size() != 1)
+    return false;
+  std::lock_guard<std::mutex> _lg(attr_mtx);
+  if (!thread_attr.IsDefault() || batch_num > 1 || batch_window > 0)
+    return false;
+  // may block a worker of the flow scheduler
+  return !dedicated_thread || !producer_on_scheduler;
+}
+
+// The traced frame in process of this thread, inherited by the outputs.
+static thread_local int64_t trace_frame = 0;
+
+void FlowCoroutine::ProcessInput() {
+  bool ret = true;
+  bool watched = watchdog_enabled.load(std::memory_order_relaxed);
+  Heartbeat *outer_heartbeat = current_heartbeat; // if nested in a sync flow
+  if (watched) {
+    int64_t clock = 0;
+    for (auto &buffer : in_vector) {
+      if (buffer) {
+        clock = buffer->GetAtomicClock();
+        break;
+      }
+    }
+    heartbeat.frame.store(clock, std::memory_order_relaxed);
+    heartbeat.busy_since.store(getmonotonictime(), std::memory_order_relaxed);
+    current_heartbeat = &heartbeat;
+  }
+  if (!flow->Decimate() && flow->GetRunTimesRemaining()) {
+    const char *trace_name = nullptr;
+    int64_t frame = 0;
+    int64_t outer_frame = trace_frame; // not 0 if nested in a sync flow
+    if (IsTraceEnabled()) {
+      trace_name = flow->GetTraceName();
+      for (size_t i = 0; i < in_vector.size(); i++) {
+        auto &buffer = in_vector[i];
+        if (!buffer)
+          continue;
+        if (!frame)
+          frame = buffer->GetTraceFrame();
+        if (model != Model::ASYNCATOMIC)
+          TraceRecord(TraceType::DEQUEUE, trace_name, in_slots[i],
+                      buffer->GetTraceFrame());
+      }
+      TraceRecord(TraceType::PROCESS_BEGIN, trace_name, -1, frame);
+      trace_frame = frame;
+    }
+    const char *mem_name = flow->GetTraceName();
+    for (auto &buffer : in_vector) {
+      if (buffer)
+        buffer->SetHolder(MemHolder::FLOW, mem_name);
+    }
+    // the buffers allocated by the process are charged to the flow
+    const char *outer_owner = SetMemOwner(mem_name);
+    int64_t start = getmonotonictime();
+    int64_t cpu_start = getthreadcputime();
+    is_processing = true;
+    ret = (*th_run)(flow, in_vector);
+    is_processing = false;
+    SetMemOwner(outer_owner);
+    int64_t cost = getmonotonictime() - start;
+    flow->process_cpu_time.Add(getthreadcputime() - cpu_start);
+    if (trace_name) {
+      TraceRecord(TraceType::PROCESS_END, trace_name, -1, frame);
+      trace_frame = outer_frame;
     }
+    flow->process_time.Add(cost);
+    if (!ret)
+      flow->process_failed.fetch_add(1, std::memory_order_relaxed);
+#ifndef NDEBUG
+    if (expect_process_time > 0)
+      check_consume_time(name.c_str(), expect_process_time,
+                         (int)(cost / 1000));
 #endif // DEBUG
   }
 
   for (int idx : out_slots) {
     auto &fm = flow->downflowmap[idx];
-    std::list<Flow::FlowInputMap> flows;
-    fm.list_mtx.read_lock();
-    flows = fm.flows;
-    fm.list_mtx.unlock();
-    (this->*send_down_func)(fm, in_vector, flows, ret);
+    auto flows = fm.GetFlows();
+    (this->*send_down_func)(fm, in_vector, *flows, ret);
   }
   for (auto &buffer : in_vector)
     buffer.reset();
+  if (watched) {
+    heartbeat.busy_since.store(0, std::memory_order_relaxed);
+    heartbeat.progress.store(getmonotonictime(), std::memory_order_relaxed);
+    current_heartbeat = outer_heartbeat;
+  }
+}
 
-  pthread_yield();
+static int apply_thread_attr(pthread_t th, pid_t tid, const ThreadAttr &attr,
+                             const char *name) {
+  int ret = 0;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (attr.cpu_mask) {
+    for (int i = 0; i < 64 && i < CPU_SETSIZE; i++) {
+      if (attr.cpu_mask & (1ULL << i))
+        CPU_SET(i, &set);
+    }
+  } else {
+    // unpin, a cpu offline now is ignored by the kernel
+    int cpus = (int)sysconf(_SC_NPROCESSORS_CONF);
+    for (int i = 0; i < cpus && i < CPU_SETSIZE; i++)
+      CPU_SET(i, &set);
+  }
+  if (pthread_setaffinity_np(th, sizeof(set), &set)) {
+    LOG("%s: fail to set cpu affinity 0x%llx\n", name,
+        (unsigned long long)attr.cpu_mask);
+    ret = -1;
+  }
+  struct sched_param param;
+  memset(&param, 0, sizeof(param));
+  bool rt = (attr.policy == SCHED_FIFO || attr.policy == SCHED_RR);
+  if (rt)
+    param.sched_priority = attr.priority;
+  if (pthread_setschedparam(th, attr.policy, &param)) {
+    LOG("%s: fail to set sched policy %d, priority %d\n", name, attr.policy,
+        param.sched_priority);
+    ret = -1;
+  }
+  if (!rt && setpriority(PRIO_PROCESS, tid, attr.nice)) {
+    LOG("%s: fail to set nice %d\n", name, attr.nice);
+    ret = -1;
+  }
+  return ret;
 }
 
-void FlowCoroutine::WhileRun() {
+void FlowCoroutine::InitThread() {
   prctl(PR_SET_NAME, this->name.c_str());
   LOGD("flow-name %s\n", this->name.c_str());
+  std::lock_guard<std::mutex> _lg(attr_mtx);
+  tid = (pid_t)syscall(SYS_gettid);
+  if (!thread_attr.IsDefault())
+    apply_thread_attr(pthread_self(), tid, thread_attr, name.c_str());
+}
+
+int FlowCoroutine::ChangeThreadAttr(const ThreadAttr &attr) {
+  // the workers of the flow scheduler are shared, take an own thread
+  if (RunOnScheduler()) {
+    if (attr.IsDefault())
+      return 0;
+    if (!MoveToThread())
+      return -1;
+  }
+  std::lock_guard<std::mutex> _lg(attr_mtx);
+  if (!th)
+    return -1;
+  thread_attr = attr;
+  // not started yet, apply in InitThread
+  if (tid <= 0)
+    return 0;
+  return apply_thread_attr(th->native_handle(), tid, attr, name.c_str());
+}
+
+int FlowCoroutine::QueryThreadAttr(ThreadAttr &attr) {
+  std::lock_guard<std::mutex> _lg(attr_mtx);
+  if (!th || tid <= 0)
+    return -1;
+  pthread_t pth = th->native_handle();
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (pthread_getaffinity_np(pth, sizeof(set), &set))
+    return -1;
+  attr.cpu_mask = 0;
+  for (int i = 0; i < 64 && i < CPU_SETSIZE; i++) {
+    if (CPU_ISSET(i, &set))
+      attr.cpu_mask |= (1ULL << i);
+  }
+  struct sched_param param;
+  int policy;
+  if (pthread_getschedparam(pth, &policy, &param))
+    return -1;
+  attr.policy = policy;
+  attr.priority = param.sched_priority;
+  errno = 0;
+  int nice = getpriority(PRIO_PROCESS, tid);
+  if (nice == -1 && errno)
+    return -1;
+  attr.nice = nice;
+  return 0;
+}
+
+void FlowCoroutine::WhileRun() {
+  InitThread();
   while (!flow->quit)
     RunOnce();
 }
 
 void FlowCoroutine::WhileRunSleep() {
-  int64_t times = 0;
-  AutoDuration ad;
   assert(interval > 0);
-  prctl(PR_SET_NAME, this->name.c_str());
-  LOGD("flow-name %s\n", this->name.c_str());
+  Pacer pacer((int64_t)(interval * 1000), pace_policy, &flow->pace_counter);
+  InitThread();
 
   while (!flow->quit) {
-    if (times == 0)
-      ad.Reset();
     RunOnce();
-    ++times;
-    int64_t remain = (interval * times - ad.Get()) / 1000;
-    if (remain > 0)
-      msleep((int)remain);
-    if (times >= 10000)
-      times = 0;
+    pacer.Wait();
   }
 }
 
@@ -199,50 +577,92 @@ void FlowCoroutine::SyncFetchInput(MediaBufferVector &in) {
   }
 }
 
-void FlowCoroutine::ASyncFetchInputCommon(MediaBufferVector &in) {
-  flow->cond_mtx.lock();
-  bool empty = true;
-  for (size_t i = 0; i < in_slots.size(); i++) {
-    int idx = in_slots[i];
-    auto &input = flow->v_input[idx];
-    auto &v = input.cached_buffers;
-    if (!v.empty())
-      empty = false;
+void FlowCoroutine::RunOnceCommon() {
+  auto &event = waker->event;
+  while (!flow->quit) {
+    uint32_t key = event.prepare_wait();
+    {
+      std::lock_guard<std::mutex> _lg(run_mtx);
+      if (ASyncTryFetchInputCommon(in_vector)) {
+        event.cancel_wait();
+        ProcessInput();
+        for (int i = 1; i < batch_num && !flow->quit; i++) {
+          if (!ASyncTryFetchInputCommon(in_vector))
+            break;
+          ProcessInput();
+        }
+        return;
+      }
+    }
+    // Only the inputs bound to this coroutine notify the event.
+    event.wait(key);
+    if (batch_window > 0)
+      WaitBatch();
+  }
+}
+
+// Woken by the first buffer, wait for the rest of the batch. The producers
+// notify again only when an input has a full batch, or it times out.
+void FlowCoroutine::WaitBatch() {
+  auto &event = waker->event;
+  int64_t deadline = getmonotonictime() + batch_window * 1000LL;
+  waker->batch_threshold.store(batch_num, std::memory_order_seq_cst);
+  while (!flow->quit) {
+    uint32_t key = event.prepare_wait();
+    int64_t remain = deadline - getmonotonictime();
+    bool full = false;
+    for (int idx : in_slots)
+      full |= (int)flow->v_input[idx].Size() >= batch_num;
+    if (full || remain <= 0) {
+      event.cancel_wait();
+      break;
+    }
+    event.wait(key, (int)((remain + 999) / 1000));
   }
+  waker->batch_threshold.store(0, std::memory_order_seq_cst);
+}
 
+// Return false if all the inputs are empty.
+bool FlowCoroutine::ASyncTryFetchInputCommon(MediaBufferVector &in) {
   if (clear_buffers_enable) {
     clear_buffers_mtx.lock();
     clear_buffers_enable = false;
     for (size_t i = 0; i < in_slots.size(); i++) {
       int idx = in_slots[i];
       auto &input = flow->v_input[idx];
-      auto &v = input.cached_buffers;
-      v.clear();
+      input.Clear();
+      input.space_event.notify();
     }
     clear_buffers_mtx.unlock();
-    empty = true;
   }
 
-  if (empty && !flow->quit)
-    flow->cond_mtx.wait();
-  flow->cond_mtx.unlock();
-
+  bool fetched = false;
   for (size_t i = 0; i < in_slots.size(); i++) {
     int idx = in_slots[i];
     auto &input = flow->v_input[idx];
-    auto &v = input.cached_buffers;
-    if (v.empty()) {
+    if (input.Empty()) {
       continue;
     }
     if (!flow->enable) {
       in.assign(in_slots.size(), nullptr);
-      break;
+      return true;
+    }
+    int64_t arrival = 0;
+    while (input.Pop(in[i], arrival)) {
+      // wake the blocked producers and the sources waiting for credit
+      input.space_event.notify();
+      if (input.IsStale(in[i], arrival)) {
+        input.DropStale(in[i]);
+      } else if (input.IsOvertaken(in[i])) {
+        input.DropOvertaken(in[i]);
+      } else {
+        fetched = true;
+        break;
+      }
+      in[i].reset();
     }
-    AutoLockMutex _alm(input.mtx);
-    assert(!v.empty());
-    in[i] = v.front();
-    v.pop_front();
   }
+  return fetched;
 }
 
 void FlowCoroutine::ASyncFetchInputAtomic(MediaBufferVector &in) {
@@ -252,6 +672,7 @@ void FlowCoroutine::ASyncFetchInputAtomic(MediaBufferVector &in) {
     auto &input = flow->v_input[idx];
     input.spin_mtx.lock();
     buffer = input.cached_buffer;
+    input.cached_fetched = true;
     input.spin_mtx.unlock();
     in[i++] = buffer;
   }
@@ -259,7 +680,7 @@ void FlowCoroutine::ASyncFetchInputAtomic(MediaBufferVector &in) {
 
 void FlowCoroutine::SendNullBufferDown(Flow::FlowMap &fm,
                                        const MediaBufferVector &in,
-                                       std::list<Flow::FlowInputMap> &flows) {
+                                       const Flow::FlowInputMapList &flows) {
   std::shared_ptr<MediaBuffer> nullbuffer;
   if (fm.hold_input != HoldInputMode::NONE) {
     auto empty_result = std::make_shared<easymedia::MediaBuffer>();
@@ -268,40 +689,64 @@ void FlowCoroutine::SendNullBufferDown(Flow::FlowMap &fm,
   }
   for (auto &f : flows)
     f.flow->SendInput(nullbuffer, f.index_of_in);
+  fm.counter.null_sent.fetch_add(flows.size(), std::memory_order_relaxed);
 }
 
 void FlowCoroutine::SendBufferDown(Flow::FlowMap &fm,
                                    const MediaBufferVector &in,
-                                   std::list<Flow::FlowInputMap> &flows,
+                                   const Flow::FlowInputMapList &flows,
                                    bool process_ret) {
   if (!process_ret) {
     SendNullBufferDown(fm, in, flows);
     return;
   }
+  size_t sent = 0;
   for (auto &f : flows) {
+    if (!HasCredit(f)) {
+      fm.counter.skipped.fetch_add(1, std::memory_order_relaxed);
+      continue;
+    }
     OutputHoldRelated(fm, fm.cached_buffer, in);
     f.flow->SendInput(fm.cached_buffer, f.index_of_in);
+    sent++;
   }
+  fm.counter.sent.fetch_add(sent, std::memory_order_relaxed);
   fm.cached_buffer.reset();
 }
 
 void FlowCoroutine::SendBufferDownFromDeque(
     Flow::FlowMap &fm, const MediaBufferVector &in,
-    std::list<Flow::FlowInputMap> &flows, bool process_ret) {
+    const Flow::FlowInputMapList &flows, bool process_ret) {
   if (!process_ret) {
     SendNullBufferDown(fm, in, flows);
     return;
   }
   if (fm.cached_buffers.empty())
     return;
+  size_t sent = 0;
   for (auto &buffer : fm.cached_buffers) {
     OutputHoldRelated(fm, buffer, in);
-    for (auto &f : flows)
+    for (auto &f : flows) {
+      if (!HasCredit(f)) {
+        fm.counter.skipped.fetch_add(1, std::memory_order_relaxed);
+        continue;
+      }
       f.flow->SendInput(buffer, f.index_of_in);
+      sent++;
+    }
   }
+  fm.counter.sent.fetch_add(sent, std::memory_order_relaxed);
   fm.cached_buffers.clear();
 }
 
+bool FlowCoroutine::HasCredit(const Flow::FlowInputMap &f) {
+  if (flow->back_pressure == BackPressure::NONE)
+    return true;
+  std::shared_ptr<Flow> neck_flow;
+  int neck_slot = -1;
+  return f.flow->GetInputCredit(f.index_of_in, 0, neck_flow, neck_slot) > 0;
+}
+
 size_t
 FlowCoroutine::OutputHoldRelated(Flow::FlowMap &fm,
                                  std::shared_ptr<MediaBuffer> &out_buffer,
@@ -333,6 +778,330 @@ void FlowCoroutine::ClearCachedBuffers() {
   clear_buffers_mtx.unlock();
 }
 
+void CoroutineWaker::Notify() {
+  if (!task.load(std::memory_order_acquire)) {
+    event.notify();
+    return;
+  }
+  task_mtx.lock();
+  FlowCoroutine *c = task.load(std::memory_order_relaxed);
+  if (c)
+    c->scheduler->Dispatch(c);
+  task_mtx.unlock();
+}
+
+void CoroutineWaker::SetTask(FlowCoroutine *c) {
+  task_mtx.lock();
+  task.store(c, std::memory_order_release);
+  task_mtx.unlock();
+}
+
+FlowScheduler::FlowScheduler(int worker_num) : quit(false) {
+  if (worker_num <= 0)
+    worker_num = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (worker_num <= 0)
+    worker_num = 1;
+  for (int i = 0; i < worker_num; i++) {
+    auto th = new std::thread(&FlowScheduler::WorkerRun, this, i);
+    if (!th) {
+      LOG("FlowScheduler: fail to create worker %d\n", i);
+      break;
+    }
+    workers.push_back(th);
+  }
+  LOG("FlowScheduler: %d workers\n", (int)workers.size());
+}
+
+FlowScheduler::~FlowScheduler() {
+  mtx.lock();
+  quit = true;
+  work_cond.notify_all();
+  mtx.unlock();
+  for (auto th : workers) {
+    th->join();
+    delete th;
+  }
+}
+
+void FlowScheduler::Dispatch(FlowCoroutine *c) {
+  std::lock_guard<std::mutex> _lg(mtx);
+  if (c->task_state == TaskState::IDLE) {
+    c->task_state = TaskState::QUEUED;
+    ready_tasks.push_back(c);
+    work_cond.notify_one();
+  } else if (c->task_state == TaskState::RUNNING) {
+    // the running worker queues it again after this run
+    c->task_state = TaskState::RUNNING_NOTIFIED;
+  }
+}
+
+void FlowScheduler::Detach(FlowCoroutine *c) {
+  std::unique_lock<std::mutex> lk(mtx);
+  switch (c->task_state) {
+  case TaskState::QUEUED:
+    ready_tasks.erase(std::find(ready_tasks.begin(), ready_tasks.end(), c));
+    c->task_state = TaskState::IDLE;
+    break;
+  case TaskState::RUNNING:
+  case TaskState::RUNNING_NOTIFIED:
+    c->task_state = TaskState::DETACHING;
+    while (c->task_state == TaskState::DETACHING)
+      detach_cond.wait(lk);
+    break;
+  default:
+    break;
+  }
+}
+
+void FlowScheduler::WorkerRun(int id) {
+  char name[16];
+  snprintf(name, sizeof(name), "flow_worker%d", id);
+  prctl(PR_SET_NAME, name);
+  std::unique_lock<std::mutex> lk(mtx);
+  while (true) {
+    while (ready_tasks.empty() && !quit)
+      work_cond.wait(lk);
+    if (quit)
+      break;
+    FlowCoroutine *c = ready_tasks.front();
+    ready_tasks.pop_front();
+    c->task_state = TaskState::RUNNING;
+    lk.unlock();
+    int runs = 0;
+    running_task = c;
+    while (runs < FLOW_SCHEDULER_MAX_BATCH && c->RunTask())
+      runs++;
+    running_task = nullptr;
+    lk.lock();
+    if (c->task_state == TaskState::DETACHING) {
+      c->task_state = TaskState::IDLE;
+      detach_cond.notify_all();
+    } else if (runs == FLOW_SCHEDULER_MAX_BATCH ||
+               c->task_state == TaskState::RUNNING_NOTIFIED) {
+      // may have more inputs, queue at the tail to be fair to others
+      c->task_state = TaskState::QUEUED;
+      ready_tasks.push_back(c);
+    } else {
+      c->task_state = TaskState::IDLE;
+    }
+  }
+}
+
+static std::mutex flow_scheduler_mtx;
+static std::shared_ptr<FlowScheduler> flow_scheduler;
+static bool flow_scheduler_env_checked = false;
+
+static std::shared_ptr<FlowScheduler> GetFlowScheduler() {
+  std::lock_guard<std::mutex> _lg(flow_scheduler_mtx);
+  if (!flow_scheduler_env_checked) {
+    flow_scheduler_env_checked = true;
+    const char *ptr = getenv("RKMEDIA_FLOW_SCHEDULER");
+    if (ptr)
+      flow_scheduler = std::make_shared<FlowScheduler>(atoi(ptr));
+  }
+  return flow_scheduler;
+}
+
+bool EnableFlowScheduler(int worker_num) {
+  std::lock_guard<std::mutex> _lg(flow_scheduler_mtx);
+  flow_scheduler_env_checked = true;
+  if (worker_num > 0 && flow_scheduler &&
+      flow_scheduler->GetWorkerNum() == worker_num)
+    return true;
+  flow_scheduler = std::make_shared<FlowScheduler>(worker_num);
+  if (!flow_scheduler || flow_scheduler->GetWorkerNum() == 0) {
+    flow_scheduler.reset();
+    return false;
+  }
+  return true;
+}
+
+void DisableFlowScheduler() {
+  std::lock_guard<std::mutex> _lg(flow_scheduler_mtx);
+  flow_scheduler_env_checked = true;
+  flow_scheduler.reset();
+}
+
+FlowWatchdog::FlowWatchdog()
+    : th(nullptr), quit(false), env_checked(false), stall_us(0) {}
+
+bool FlowWatchdog::Enable(int stall_ms, FlowStallHandler handler) {
+  if (stall_ms <= 0)
+    return false;
+  Disable();
+  std::lock_guard<std::mutex> _lg(mtx);
+  env_checked = true;
+  stall_us = stall_ms * 1000LL;
+  stall_handler = handler;
+  // the heartbeats were not updated while disabled
+  int64_t now = getmonotonictime();
+  for (auto c : watched) {
+    c->heartbeat.progress = now;
+    c->heartbeat.stall_since = 0;
+  }
+  watchdog_enabled = true;
+  quit = false;
+  th = new std::thread(&FlowWatchdog::Run, this);
+  if (!th) {
+    errno = ENOMEM;
+    return false;
+  }
+  LOG("FlowWatchdog: report stalls over %d ms\n", stall_ms);
+  return true;
+}
+
+void FlowWatchdog::Disable() {
+  std::thread *t;
+  {
+    std::lock_guard<std::mutex> _lg(mtx);
+    env_checked = true;
+    watchdog_enabled = false;
+    quit = true;
+    t = th;
+    th = nullptr;
+  }
+  cond.notify_all();
+  if (t) {
+    t->join();
+    delete t;
+  }
+}
+
+void FlowWatchdog::Register(FlowCoroutine *c) {
+  bool enable = false;
+  int stall_ms = 0;
+  {
+    std::lock_guard<std::mutex> _lg(mtx);
+    c->heartbeat.progress = getmonotonictime();
+    watched.push_back(c);
+    if (!env_checked) {
+      env_checked = true;
+      const char *ptr = getenv("RKMEDIA_FLOW_WATCHDOG");
+      if (ptr) {
+        stall_ms = atoi(ptr);
+        enable = true;
+      }
+    }
+  }
+  if (enable)
+    Enable(stall_ms, nullptr);
+}
+
+void FlowWatchdog::Unregister(FlowCoroutine *c) {
+  std::lock_guard<std::mutex> _lg(mtx);
+  watched.remove(c);
+}
+
+void FlowWatchdog::Run() {
+  prctl(PR_SET_NAME, "flow_watchdog");
+  std::vector<FlowStall> stalls;
+  std::unique_lock<std::mutex> lk(mtx);
+  int64_t period = stall_us / FLOW_WATCHDOG_CHECKS_PER_STALL;
+  period = std::min<int64_t>(std::max<int64_t>(period, 10000), 250000);
+  while (!quit) {
+    cond.wait_for(lk, std::chrono::microseconds(period));
+    if (quit)
+      break;
+    Check(getmonotonictime(), stalls);
+    if (stalls.empty())
+      continue;
+    FlowStallHandler handler = stall_handler;
+    lk.unlock();
+    for (auto &stall : stalls) {
+      if (stall.recovered)
+        LOG("FlowWatchdog: Flow[%s] recovered after %lld ms\n",
+            stall.flow_tag, (long long)(stall.stalled_us / 1000));
+      else if (stall.in_slot >= 0)
+        LOG("FlowWatchdog: Flow[%s] input %d has %u buffers pending, "
+            "no progress for %lld ms\n",
+            stall.flow_tag, stall.in_slot, stall.depth,
+            (long long)(stall.stalled_us / 1000));
+      else if (stall.down_flow)
+        LOG("FlowWatchdog: Flow[%s] stuck %lld ms, buffer age %lld ms, "
+            "blocked %lld ms pushing to Flow[%s] input %d\n",
+            stall.flow_tag, (long long)(stall.stalled_us / 1000),
+            (long long)(stall.buffer_age_us / 1000),
+            (long long)(stall.blocked_us / 1000), stall.down_flow,
+            stall.down_slot);
+      else
+        LOG("FlowWatchdog: Flow[%s] stuck %lld ms in process, buffer age "
+            "%lld ms\n",
+            stall.flow_tag, (long long)(stall.stalled_us / 1000),
+            (long long)(stall.buffer_age_us / 1000));
+      if (handler)
+        handler(stall);
+    }
+    stalls.clear();
+    lk.lock();
+  }
+}
+
+// Called with mtx held, the watched coroutines and their flows are alive.
+void FlowWatchdog::Check(int64_t now, std::vector<FlowStall> &stalls) {
+  for (auto c : watched) {
+    Heartbeat &hb = c->heartbeat;
+    FlowStall stall;
+    memset(&stall, 0, sizeof(stall));
+    stall.in_slot = -1;
+    stall.down_slot = -1;
+    stall.buffer_age_us = -1;
+    int64_t busy = hb.busy_since.load(std::memory_order_relaxed);
+    int64_t since = 0;
+    if (busy > 0) {
+      if (now - busy > stall_us) {
+        since = busy;
+        int64_t frame = hb.frame.load(std::memory_order_relaxed);
+        if (frame)
+          stall.buffer_age_us = clock_age(frame);
+        int64_t push = hb.push_since.load(std::memory_order_relaxed);
+        if (push > 0) {
+          stall.down_flow = hb.push_flow.load(std::memory_order_relaxed);
+          stall.down_slot = hb.push_slot.load(std::memory_order_relaxed);
+          stall.blocked_us = now - push;
+        }
+      }
+    } else {
+      int64_t progress = hb.progress.load(std::memory_order_relaxed);
+      for (int idx : c->in_slots) {
+        auto &input = c->flow->v_input[idx];
+        if (input.thread_model != Model::ASYNCCOMMON || input.Empty() ||
+            now - progress <= stall_us)
+          continue;
+        since = progress;
+        stall.in_slot = idx;
+        stall.depth = input.Size();
+        break;
+      }
+    }
+    if (since) {
+      if (hb.stall_since)
+        continue; // reported
+      hb.stall_since = since;
+      stall.stalled_us = now - since;
+    } else {
+      if (!hb.stall_since)
+        continue;
+      stall.recovered = true;
+      stall.stalled_us = now - hb.stall_since;
+      hb.stall_since = 0;
+    }
+    stall.flow_tag = c->flow->GetTraceName();
+    stalls.push_back(stall);
+  }
+}
+
+static FlowWatchdog *GetFlowWatchdog() {
+  // never freed, coroutines may unregister during the static destruction
+  static FlowWatchdog *watchdog = new FlowWatchdog();
+  return watchdog;
+}
+
+bool EnableFlowWatchdog(int stall_ms, FlowStallHandler handler) {
+  return GetFlowWatchdog()->Enable(stall_ms, handler);
+}
+
+void DisableFlowWatchdog() { GetFlowWatchdog()->Disable(); }
+
 DEFINE_REFLECTOR(Flow)
 DEFINE_FACTORY_COMMON_PARSE(Flow)
 DEFINE_PART_FINAL_EXPOSE_PRODUCT(Flow, Flow)
@@ -342,7 +1111,9 @@ const FunctionProcess Flow::void_transaction00 = void_transaction<0, 0>;
 Flow::Flow()
     : out_slot_num(0), input_slot_num(0), down_flow_num(0),
       waite_down_flow(true), event_handler2_(nullptr), event_callback_(nullptr),
-      enable(true), quit(false), event_handler_(nullptr),
+      enable(true), quit(false), process_failed(0), decimation(1),
+      decimation_count(0), decimated(0), trace_name(nullptr),
+      back_pressure(BackPressure::NONE), event_handler_(nullptr),
       play_video_handler_(nullptr), play_audio_handler_(nullptr),
       user_handler_(nullptr), user_callback_(nullptr), out_handler_(nullptr),
       out_callback_(nullptr), run_times(-1) {}
@@ -350,11 +1121,12 @@ Flow::Flow()
 Flow::~Flow() { StopAllThread(); }
 
 void Flow::StopAllThread() {
-  cond_mtx.lock();
   enable = false;
   quit = true;
-  cond_mtx.notify();
-  cond_mtx.unlock();
+  for (auto &input : v_input)
+    input.space_event.notify();
+  for (auto &coroutine : coroutines)
+    coroutine->WakeUp();
   for (auto &coroutine : coroutines)
     coroutine.reset();
   coroutines.clear();
@@ -365,8 +1137,7 @@ bool Flow::IsAllBuffEmpty() {
   int i = 0;
 
   for (auto &input : v_input) {
-    LOG("#FLOW v_input-%d cached_buffers size:%zu\n", i,
-        input.cached_buffers.size());
+    LOG("#FLOW v_input-%d cached_buffers size:%zu\n", i, input.Size());
     LOG("#FLOW v_input-%d cached_buffer :%s\n", i++,
         input.cached_buffer ? "NotNull" : "Null");
   }
@@ -387,7 +1158,7 @@ bool Flow::IsAllBuffEmpty() {
 #endif
 
   for (auto &input : v_input) {
-    if (input.cached_buffers.size() || input.cached_buffer)
+    if (!input.Empty() || input.cached_buffer)
       return false;
   }
 
@@ -408,8 +1179,8 @@ int Flow::GetCachedBufferNum(unsigned int &total, unsigned int &used) {
   unsigned int buf_used_cnt = 0;
   unsigned int buf_total_cnt = 0;
   for (auto &input : v_input) {
-    if (input.cached_buffers.size() > 0)
-      buf_used_cnt += input.cached_buffers.size();
+    if (input.Size() > 0)
+      buf_used_cnt += input.Size();
     else if (input.cached_buffer)
       buf_used_cnt += 1;
 
@@ -430,9 +1201,76 @@ int Flow::GetCachedBufferNum(unsigned int &total, unsigned int &used) {
 void Flow::ClearCachedBuffers() {
   for (auto &coroutin : coroutines) {
     coroutin->ClearCachedBuffers();
+    coroutin->WakeUp();
   }
 }
 
+int Flow::SetThreadAttr(const ThreadAttr &attr) {
+  int ret = -1;
+  for (auto &coroutine : coroutines) {
+    if (!coroutine->HasThread() && !coroutine->RunOnScheduler())
+      continue;
+    if (coroutine->ChangeThreadAttr(attr))
+      return -1;
+    ret = 0;
+  }
+  return ret;
+}
+
+int Flow::GetThreadAttr(ThreadAttr &attr) {
+  for (auto &coroutine : coroutines) {
+    if (!coroutine->QueryThreadAttr(attr))
+      return 0;
+  }
+  return -1;
+}
+
+void Flow::GetStats(FlowStats &stats) {
+  process_time.Get(stats.process_time);
+  process_cpu_time.Get(stats.process_cpu_time);
+  stats.process_failed = process_failed.load(std::memory_order_relaxed);
+  pace_counter.jitter.Get(stats.pace_jitter);
+  stats.pace_skipped = pace_counter.skipped.load(std::memory_order_relaxed);
+  stats.decimated = decimated.load(std::memory_order_relaxed);
+  stats.inputs.resize(v_input.size());
+  for (size_t i = 0; i < v_input.size(); i++) {
+    auto &input = v_input[i];
+    auto &is = stats.inputs[i];
+    input.counter.Get(is);
+    is.depth = input.Size();
+    is.capacity = input.cached_buffers.Capacity();
+  }
+  stats.outputs.resize(downflowmap.size());
+  for (size_t i = 0; i < downflowmap.size(); i++) {
+    auto &fm = downflowmap[i];
+    auto &os = stats.outputs[i];
+    fm.counter.Get(os);
+    os.fan_out = fm.GetFlows()->size();
+  }
+}
+
+void Flow::ResetStats() {
+  process_time.Reset();
+  process_cpu_time.Reset();
+  process_failed.store(0, std::memory_order_relaxed);
+  pace_counter.Reset();
+  decimated.store(0, std::memory_order_relaxed);
+  for (auto &input : v_input)
+    input.counter.Reset();
+  for (auto &fm : downflowmap)
+    fm.counter.Reset();
+}
+
+bool Flow::Decimate() {
+  int n = decimation.load(std::memory_order_relaxed);
+  if (n <= 1)
+    return false;
+  if (decimation_count.fetch_add(1, std::memory_order_relaxed) % n == 0)
+    return false;
+  decimated.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
 void Flow::StartStream() {
   source_start_cond_mtx->lock();
   waite_down_flow = false;
@@ -458,7 +1296,9 @@ int Flow::GetRunTimesRemaining() {
 void Flow::DumpBase(std::string &dump_info) {
   int idx = 0;
   char str_line[1024] = {0};
+  FlowStats stats;
 
+  GetStats(stats);
   dump_info = "";
   sprintf(str_line, "#Dump Flow(%s) base info:\r\n", GetFlowTag());
   dump_info.append(str_line);
@@ -468,6 +1308,38 @@ void Flow::DumpBase(std::string &dump_info) {
   memset(str_line, 0, sizeof(str_line));
   sprintf(str_line, "  OutSlotNum: %d\r\n", out_slot_num);
   dump_info.append(str_line);
+  memset(str_line, 0, sizeof(str_line));
+  sprintf(str_line,
+          "  ProcessTime(us): cnt:%llu, failed:%llu, avg:%lld, p99:%lld, "
+          "max:%llu\r\n",
+          (unsigned long long)stats.process_time.count,
+          (unsigned long long)stats.process_failed,
+          (long long)stats.process_time.Average(),
+          (long long)stats.process_time.Percentile(99),
+          (unsigned long long)stats.process_time.max);
+  dump_info.append(str_line);
+  memset(str_line, 0, sizeof(str_line));
+  sprintf(str_line,
+          "  ProcessCpuTime(us): total:%llu, avg:%lld, p99:%lld, max:%llu, "
+          "decimation:%d, decimated:%llu\r\n",
+          (unsigned long long)stats.process_cpu_time.sum,
+          (long long)stats.process_cpu_time.Average(),
+          (long long)stats.process_cpu_time.Percentile(99),
+          (unsigned long long)stats.process_cpu_time.max, GetDecimation(),
+          (unsigned long long)stats.decimated);
+  dump_info.append(str_line);
+  if (stats.pace_jitter.count) {
+    memset(str_line, 0, sizeof(str_line));
+    sprintf(str_line,
+            "  PaceJitter(us): cnt:%llu, skipped:%llu, avg:%lld, p99:%lld, "
+            "max:%llu\r\n",
+            (unsigned long long)stats.pace_jitter.count,
+            (unsigned long long)stats.pace_skipped,
+            (long long)stats.pace_jitter.Average(),
+            (long long)stats.pace_jitter.Percentile(99),
+            (unsigned long long)stats.pace_jitter.max);
+    dump_info.append(str_line);
+  }
 
   for (auto &input : v_input) {
     memset(str_line, 0, sizeof(str_line));
@@ -486,6 +1358,11 @@ void Flow::DumpBase(std::string &dump_info) {
     else
       sprintf(str_line, "    ThreadMode: NONE\r\n");
     dump_info.append(str_line);
+    if (input.fused) {
+      memset(str_line, 0, sizeof(str_line));
+      sprintf(str_line, "    Fused: True\r\n");
+      dump_info.append(str_line);
+    }
     memset(str_line, 0, sizeof(str_line));
     if (input.mode_when_full == InputMode::BLOCKING)
       sprintf(str_line, "    InputMode: BLOCKING\r\n");
@@ -493,13 +1370,35 @@ void Flow::DumpBase(std::string &dump_info) {
       sprintf(str_line, "    InputMode: DROPCURRENT\r\n");
     else if (input.mode_when_full == InputMode::DROPFRONT)
       sprintf(str_line, "    InputMode: DROPFRONT\r\n");
+    else if (input.mode_when_full == InputMode::DROPSTALE)
+      sprintf(str_line, "    InputMode: DROPSTALE, max age:%lldms\r\n",
+              (long long)(input.max_age_us / 1000));
     else
       sprintf(str_line, "    InputMode: NONE\r\n");
     dump_info.append(str_line);
     memset(str_line, 0, sizeof(str_line));
-    sprintf(str_line, "    BufferCnt: current:%d, max:%d\r\n",
-            input.cached_buffers.size(), input.max_cache_num);
+    sprintf(str_line, "    BufferCnt: current:%zu, max:%d\r\n",
+            input.Size(), input.max_cache_num);
+    dump_info.append(str_line);
+    auto &is = stats.inputs[idx];
+    memset(str_line, 0, sizeof(str_line));
+    sprintf(str_line,
+            "    Stats: received:%llu, peak:%u, drop_front:%llu, "
+            "drop_current:%llu, drop_stale:%llu, drop_overtaken:%llu, "
+            "replaced:%llu, high_priority:%llu, blocked:%llu(%lldus), "
+            "interval(us) avg:%lld, max:%llu\r\n",
+            (unsigned long long)is.received, is.peak_depth,
+            (unsigned long long)is.drop_front,
+            (unsigned long long)is.drop_current,
+            (unsigned long long)is.drop_stale,
+            (unsigned long long)is.drop_overtaken,
+            (unsigned long long)is.replaced,
+            (unsigned long long)is.high_priority,
+            (unsigned long long)is.blocked, (long long)is.blocked_us,
+            (long long)is.inter_arrival.Average(),
+            (unsigned long long)is.inter_arrival.max);
     dump_info.append(str_line);
+    idx++;
   }
 
   idx = 0;
@@ -513,13 +1412,23 @@ void Flow::DumpBase(std::string &dump_info) {
     memset(str_line, 0, sizeof(str_line));
     sprintf(str_line, "    BufferCnt: %d\r\n", fm.cached_buffers.size());
     dump_info.append(str_line);
+    auto &os = stats.outputs[idx];
+    memset(str_line, 0, sizeof(str_line));
+    sprintf(str_line,
+            "    Stats: output:%llu, sent:%llu, null_sent:%llu, "
+            "skipped:%llu, throttled:%lldus\r\n",
+            (unsigned long long)os.buffers, (unsigned long long)os.sent,
+            (unsigned long long)os.null_sent, (unsigned long long)os.skipped,
+            (long long)os.throttled_us);
+    dump_info.append(str_line);
 
     dump_info.append("    NextFlow: ");
-    for (auto &nflow : fm.flows) {
+    for (auto &nflow : *fm.GetFlows()) {
       dump_info.append(nflow.flow->GetFlowTag());
       dump_info.append(" ");
     }
     dump_info.append("\r\n");
+    idx++;
   }
 }
 
@@ -540,7 +1449,8 @@ static bool check_slots(std::vector<int> &slots, const char *debugstr) {
   return true;
 }
 
-Flow::FlowMap::FlowMap(FlowMap &&fm) {
+Flow::FlowMap::FlowMap(FlowMap &&fm)
+    : flows(std::make_shared<const FlowInputMapList>()) {
   if (fm.valid) {
     LOG("Flow::FlowMap is not copyable and moveable after inited\n");
     assert(0);
@@ -566,14 +1476,15 @@ void Flow::FlowMap::SetOutputToQueueBehavior(
   cached_buffers.push_back(output);
 }
 
-Flow::Input::Input(Input &&in) {
+Flow::Input::Input(Input &&in) : Input() {
   if (in.valid) {
     LOG("Flow::Input is not copyable and moveable after inited\n");
     assert(0);
   }
 }
 
-void Flow::Input::Init(Flow *f, Model m, int mcn, InputMode im, bool f_block,
+void Flow::Input::Init(Flow *f, Model m, int mcn, InputMode im,
+                       int max_age_ms, bool f_block, bool single_prod,
                        std::shared_ptr<FlowCoroutine> fc) {
   assert(!valid);
   valid = true;
@@ -582,9 +1493,27 @@ void Flow::Input::Init(Flow *f, Model m, int mcn, InputMode im, bool f_block,
   fetch_block = f_block;
   max_cache_num = mcn;
   mode_when_full = im;
+  if (m == Model::ASYNCCOMMON && im == InputMode::DROPSTALE) {
+    if (max_age_ms <= 0)
+      LOG("Flow[%s]: dropstale without max age, works as dropfront\n",
+          f ? f->GetFlowTag() : "Name is null");
+    else
+      max_age_us = max_age_ms * 1000LL;
+  }
+  waker = fc->GetWaker();
   switch (m) {
   case Model::ASYNCCOMMON:
     send_input_behavior = &Input::ASyncSendInputCommonBehavior;
+    weak_coroutine = fc;
+    if (!cached_buffers.Init(mcn > 0 ? mcn : FLOW_INPUT_UNLIMITED_CACHE_NUM,
+                             single_prod ? RingProducer::SINGLE
+                                         : RingProducer::MULTI) ||
+        !priority_buffers.Init(FLOW_INPUT_PRIORITY_CACHE_NUM,
+                               single_prod ? RingProducer::SINGLE
+                                           : RingProducer::MULTI)) {
+      LOG("Flow[%s]: fail to init input ring queue\n",
+          f ? f->GetFlowTag() : "Name is null");
+    }
     break;
   case Model::ASYNCATOMIC:
     send_input_behavior = &Input::ASyncSendInputAtomicBehavior;
@@ -601,6 +1530,7 @@ void Flow::Input::Init(Flow *f, Model m, int mcn, InputMode im, bool f_block,
     async_full_behavior = &Input::ASyncFullBlockingBehavior;
     break;
   case InputMode::DROPFRONT:
+  case InputMode::DROPSTALE:
     async_full_behavior = &Input::ASyncFullDropFrontBehavior;
     break;
   case InputMode::DROPCURRENT:
@@ -679,16 +1609,21 @@ bool Flow::InstallSlotMap(SlotMap &map, const std::string &mark,
     int max_idx = in_slots[in_slots.size() - 1];
     if ((int)v_input.size() <= max_idx)
       v_input.resize(max_idx + 1);
+    auto &ages = map.input_max_age;
     for (size_t i = 0; i < in_slots.size(); i++) {
       v_input[in_slots[i]].Init(
           this, map.thread_model,
           (map.thread_model == Model::ASYNCCOMMON) ? map.input_maxcachenum[i]
                                                    : 0,
           map.mode_when_full,
+          ages.empty() ? 0 : ages[std::min(i, ages.size() - 1)],
           (map.thread_model == Model::ASYNCCOMMON && map.fetch_block.size() > i)
               ? map.fetch_block[i]
               : true,
-          c);
+          map.single_producer.size() > i ? map.single_producer[i] : false, c);
+      v_input[in_slots[i]].batched =
+          map.thread_model == Model::ASYNCCOMMON &&
+          (map.batch_num > 1 || map.batch_window > 0);
       input_slot_num++;
     }
   }
@@ -706,25 +1641,96 @@ bool Flow::InstallSlotMap(SlotMap &map, const std::string &mark,
 
   c->SetMarkName(mark);
   c->SetExpectProcessTime(exp_process_time);
+  c->SetDedicatedThread(map.dedicated_thread);
+  c->SetPacePolicy(map.pace_policy);
+  if (map.thread_model == Model::ASYNCCOMMON)
+    c->SetBatch(map.batch_num, map.batch_window);
+  c->SetThreadAttr(map.thread_attr);
   c->Start();
+  if (map.back_pressure != BackPressure::NONE)
+    back_pressure = map.back_pressure;
   return true;
 }
 
-void Flow::FlowMap::AddFlow(std::shared_ptr<Flow> flow, int index) {
-  AutoLockMutex _lg(list_mtx);
-  auto i = std::find(flows.begin(), flows.end(), flow);
-  if (i != flows.end()) {
+int Flow::FlowMap::AddFlow(std::shared_ptr<Flow> flow, int index) {
+  std::lock_guard<std::mutex> _lg(list_mtx);
+  int old_index = -1;
+  auto new_flows = std::make_shared<FlowInputMapList>(*GetFlows());
+  auto i = std::find(new_flows->begin(), new_flows->end(), flow);
+  if (i != new_flows->end()) {
     LOG("repeatedly add, update index\n");
+    old_index = i->index_of_in;
     i->index_of_in = index;
-    return;
+  } else {
+    // TODO: sort by sync type in downflow
+    new_flows->emplace_back(flow, index);
+  }
+  std::atomic_store(&flows, std::shared_ptr<const FlowInputMapList>(new_flows));
+  return old_index;
+}
+
+int Flow::FlowMap::RemoveFlow(std::shared_ptr<Flow> flow) {
+  std::lock_guard<std::mutex> _lg(list_mtx);
+  int old_index = -1;
+  auto new_flows = std::make_shared<FlowInputMapList>(*GetFlows());
+  auto i = std::find(new_flows->begin(), new_flows->end(), flow);
+  if (i != new_flows->end()) {
+    old_index = i->index_of_in;
+    new_flows->erase(i);
+  }
+  std::atomic_store(&flows, std::shared_ptr<const FlowInputMapList>(new_flows));
+  return old_index;
+}
+
+static std::atomic_int flow_fusion(-1); // -1 if env is not checked
+
+void EnableFlowFusion(bool enable) { flow_fusion = enable ? 1 : 0; }
+
+static bool IsFlowFusionEnabled() {
+  int fusion = flow_fusion.load();
+  if (fusion < 0) {
+    const char *ptr = getenv("RKMEDIA_FLOW_FUSION");
+    fusion = (ptr && atoi(ptr) > 0) ? 1 : 0;
+    int expected = -1;
+    flow_fusion.compare_exchange_strong(expected, fusion);
   }
-  // TODO: sort by sync type in downflow
-  flows.emplace_back(flow, index);
+  return fusion > 0;
 }
 
-void Flow::FlowMap::RemoveFlow(std::shared_ptr<Flow> flow) {
-  AutoLockMutex _lg(list_mtx);
-  flows.remove_if([&flow](FlowInputMap &fm) { return fm == flow; });
+void Flow::UpdateFusion(int out_slot_index) {
+  auto flows = downflowmap[out_slot_index].GetFlows();
+  bool blocking = false;
+  for (auto &f : *flows) {
+    if (f.index_of_in < 0 || f.index_of_in >= (int)f.flow->v_input.size())
+      continue;
+    auto &in = f.flow->v_input[f.index_of_in];
+    if (in.thread_model == Model::ASYNCCOMMON &&
+        in.mode_when_full == InputMode::BLOCKING)
+      blocking = true;
+  }
+  bool on_scheduler = false;
+  for (auto &c : coroutines) {
+    if (!c->HasOutSlot(out_slot_index))
+      continue;
+    // the push to a full blocking input must not park a scheduler worker
+    if (blocking && c->RunOnScheduler() && c->MoveToThread())
+      LOG("Flow[%s]: blocking output, leave the flow scheduler\n",
+          GetFlowTag());
+    on_scheduler = c->RunOnScheduler();
+  }
+  bool fusion = IsFlowFusionEnabled() && flows->size() == 1;
+  for (auto &f : *flows) {
+    if (f.index_of_in < 0 || f.index_of_in >= (int)f.flow->v_input.size())
+      continue;
+    auto &in = f.flow->v_input[f.index_of_in];
+    auto c = in.weak_coroutine.lock();
+    bool fused = fusion && in.producers == 1 && c &&
+                 c->CanRunInline(on_scheduler);
+    if (fused != in.fused)
+      LOG("Flow[%s]: %s input %d\n", f.flow->GetFlowTag(),
+          fused ? "fuse" : "unfuse", f.index_of_in);
+    in.fused = fused;
+  }
 }
 
 bool Flow::AddDownFlow(std::shared_ptr<Flow> down, int out_slot_index,
@@ -741,7 +1747,18 @@ bool Flow::AddDownFlow(std::shared_ptr<Flow> down, int out_slot_index,
     LOG("can not set self loop flow\n");
     return false;
   }
-  downflowmap[out_slot_index].AddFlow(down, in_slot_index_of_down);
+  int old_index =
+      downflowmap[out_slot_index].AddFlow(down, in_slot_index_of_down);
+  if (old_index != in_slot_index_of_down) {
+    if (old_index >= 0 && old_index < (int)down->v_input.size()) {
+      down->v_input[old_index].producers--;
+      down->v_input[old_index].fused = false;
+    }
+    if (in_slot_index_of_down >= 0 &&
+        in_slot_index_of_down < (int)down->v_input.size())
+      down->v_input[in_slot_index_of_down].producers++;
+  }
+  UpdateFusion(out_slot_index);
   if (source_start_cond_mtx) {
     source_start_cond_mtx->lock();
     down_flow_num++;
@@ -756,10 +1773,17 @@ void Flow::RemoveDownFlow(std::shared_ptr<Flow> down) {
     return;
   // if (down->down_flow_num > 0)
   //   LOG("the removing flow has down flows, remove them first\n");
-  for (auto &dm : downflowmap) {
+  for (size_t i = 0; i < downflowmap.size(); i++) {
+    auto &dm = downflowmap[i];
     if (!dm.valid)
       continue;
-    dm.RemoveFlow(down);
+    int index = dm.RemoveFlow(down);
+    if (index >= 0 && index < (int)down->v_input.size()) {
+      // the other producer, if any, is not fused again
+      down->v_input[index].producers--;
+      down->v_input[index].fused = false;
+      UpdateFusion(i);
+    }
     if (source_start_cond_mtx) {
       source_start_cond_mtx->lock();
       down_flow_num--;
@@ -777,10 +1801,128 @@ void Flow::SendInput(std::shared_ptr<MediaBuffer> &input, int in_slot_index) {
   }
   if (enable) {
     auto &in = v_input[in_slot_index];
+    int64_t now = getmonotonictime();
+    in.counter.Arrive(now);
+    if (input && IsTraceEnabled()) {
+      int64_t frame = input->GetTraceFrame();
+      if (!frame || source_start_cond_mtx) {
+        if (!frame) {
+          // named after the capture time if any
+          frame = input->GetAtomicClock();
+          if (!frame)
+            frame = now;
+          input->SetTraceFrame(frame);
+        }
+        // the capture time may come from another clock, such as the
+        // timestamp of a file, which is meaningless on the timeline
+        int64_t delay = now - frame;
+        TraceRecord(TraceType::CAPTURE, GetTraceName(), in_slot_index, frame,
+                    delay >= 0 && delay < 10000000LL ? frame : now);
+      }
+      if (in.thread_model != Model::ASYNCATOMIC)
+        TraceRecord(TraceType::ENQUEUE, GetTraceName(), in_slot_index, frame,
+                    now);
+    }
     CALL_MEMBER_FN(in, in.send_input_behavior)(input);
   }
 }
 
+int Flow::GetCredit(int out_slot_index) {
+  if (out_slot_index < 0 || out_slot_index >= (int)downflowmap.size())
+    return 0;
+  std::shared_ptr<Flow> neck_flow;
+  int neck_slot = -1;
+  return GetOutputCredit(out_slot_index, 0, neck_flow, neck_slot);
+}
+
+// The buffer is useful if any down flow can take it.
+int Flow::GetOutputCredit(int out_slot_index, int depth,
+                          std::shared_ptr<Flow> &neck_flow, int &neck_slot) {
+  auto flows = downflowmap[out_slot_index].GetFlows();
+  if (flows->empty())
+    return INT_MAX;
+  int credit = 0;
+  for (auto &f : *flows) {
+    std::shared_ptr<Flow> nf;
+    int ns = -1;
+    int c = f.flow->GetInputCredit(f.index_of_in, depth, nf, ns);
+    if (c <= 0 && !neck_flow) {
+      neck_flow = nf ? nf : f.flow;
+      neck_slot = nf ? ns : f.index_of_in;
+    }
+    credit = std::max(credit, c);
+  }
+  return credit;
+}
+
+int Flow::GetInputCredit(int in_slot_index, int depth,
+                         std::shared_ptr<Flow> &neck_flow, int &neck_slot) {
+  if (!enable)
+    return INT_MAX; // drop everything anyway, not a reason to throttle
+  int credit = v_input[in_slot_index].Credit();
+  if (credit <= 0 || depth >= FLOW_CREDIT_MAX_DEPTH)
+    return credit;
+  bool has_output = false;
+  int down_credit = 0;
+  for (size_t i = 0; i < downflowmap.size(); i++) {
+    if (!downflowmap[i].valid)
+      continue;
+    has_output = true;
+    down_credit = std::max(
+        down_credit, GetOutputCredit(i, depth + 1, neck_flow, neck_slot));
+  }
+  if (!has_output)
+    return credit;
+  return std::min(credit, down_credit);
+}
+
+bool Flow::CheckSourceCredit(int out_slot_index) {
+  if (back_pressure == BackPressure::NONE)
+    return true;
+  if (out_slot_index < 0 || out_slot_index >= (int)downflowmap.size())
+    return false;
+  auto &counter = downflowmap[out_slot_index].counter;
+  int64_t start = 0;
+  while (enable && !quit) {
+    std::shared_ptr<Flow> neck_flow;
+    int neck_slot = -1;
+    if (GetOutputCredit(out_slot_index, 0, neck_flow, neck_slot) > 0)
+      break;
+    if (back_pressure == BackPressure::SKIP || !neck_flow) {
+      counter.skipped.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    if (!start)
+      start = getmonotonictime();
+    // woken once the neck input pops a buffer, the timeout is a fallback
+    // for the credit changed by other inputs on the way
+    auto &event = neck_flow->v_input[neck_slot].space_event;
+    uint32_t key = event.prepare_wait();
+    if (neck_flow->v_input[neck_slot].Credit() > 0) {
+      event.cancel_wait();
+      continue;
+    }
+    event.wait(key, 20);
+  }
+  if (start)
+    counter.throttled_us.fetch_add(getmonotonictime() - start,
+                                   std::memory_order_relaxed);
+  return enable && !quit;
+}
+
+const char *Flow::GetTraceName() {
+  const char *name = trace_name.load(std::memory_order_acquire);
+  if (!name) {
+    // some flows have no tag, the mark of slot map is better than nothing
+    if (flow_tag.empty() && !coroutines.empty())
+      name = TraceName(coroutines.front()->name);
+    else
+      name = TraceName(flow_tag);
+    trace_name.store(name, std::memory_order_release);
+  }
+  return name;
+}
+
 bool Flow::SetOutput(const std::shared_ptr<MediaBuffer> &output,
                      int out_slot_index) {
   if (out_slot_index < 0 || out_slot_index >= out_slot_num) {
@@ -789,11 +1931,17 @@ bool Flow::SetOutput(const std::shared_ptr<MediaBuffer> &output,
     return false;
   }
 
+  if (output && trace_frame && !output->GetTraceFrame())
+    output->SetTraceFrame(trace_frame);
+
+  if (output)
+    output->SetHolder(MemHolder::OUTPUT, GetTraceName());
   if (out_callback_ && output)
     out_callback_(out_handler_, output);
 
   if (enable) {
     auto &out = downflowmap[out_slot_index];
+    out.counter.buffers.fetch_add(1, std::memory_order_relaxed);
     CALL_MEMBER_FN(out, out.set_output_behavior)(output);
     return true;
   }
@@ -872,44 +2020,105 @@ void Flow::Input::SyncSendInputBehavior(std::shared_ptr<MediaBuffer> &input) {
 
 void Flow::Input::ASyncSendInputCommonBehavior(
     std::shared_ptr<MediaBuffer> &input) {
-  mtx.lock();
-  if (max_cache_num > 0 && max_cache_num <= (int)cached_buffers.size()) {
+  if (IsStale(input)) {
+    DropStale(input);
+    return;
+  }
+  if (fused.load(std::memory_order_relaxed)) {
+    auto c = weak_coroutine.lock();
+    if (c && c->RunInline(*this, input))
+      return;
+  }
+  // before the push, the consumer may take it right after
+  if (input)
+    input->SetHolder(MemHolder::QUEUE, flow->GetTraceName());
+  // the age of a buffer without capture time starts from here
+  QueuedBuffer entry(input, max_age_us > 0 ? getmonotonictime() : 0);
+  bool queued = false;
+  // A high priority buffer jumps the queue only instead of being dropped for
+  // a full queue, so the order is kept otherwise, and always when blocking.
+  if (input && input->GetPriority() == MediaBuffer::Priority::HIGH &&
+      mode_when_full != InputMode::BLOCKING) {
+    queued = cached_buffers.Push(entry);
+    if (!queued) {
+      queued = priority_buffers.Push(entry);
+      if (queued)
+        counter.high_priority.fetch_add(1, std::memory_order_relaxed);
+      else
+        LOG("WARN: Flow[%s]: Input: high priority lane is full!\n",
+            flow ? flow->GetFlowTag() : "Name is null");
+    }
+  }
+  while (!queued && !cached_buffers.Push(entry)) {
     bool ret = (this->*async_full_behavior)(flow->enable);
     if (!ret) {
-      mtx.unlock();
+      if (input && IsTraceEnabled())
+        TraceRecord(TraceType::DROP, flow->GetTraceName(),
+                    this - flow->v_input.data(), input->GetTraceFrame());
       return;
     }
   }
-  cached_buffers.push_back(input);
-  mtx.unlock();
-  AutoLockMutex _alm(flow->cond_mtx);
-  flow->cond_mtx.notify();
-  pthread_yield();
+  size_t depth = Size();
+  counter.UpdateDepth(depth);
+  if (!batched) {
+    waker->Notify();
+    pthread_yield();
+    return;
+  }
+  // pairs with the threshold reset of WaitBatch, so that it never sleeps
+  // with the buffer unseen
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if ((int)depth >= waker->batch_threshold.load(std::memory_order_seq_cst))
+    waker->Notify();
 }
 
 void Flow::Input::ASyncSendInputAtomicBehavior(
     std::shared_ptr<MediaBuffer> &input) {
+  if (input)
+    input->SetHolder(MemHolder::QUEUE, flow->GetTraceName());
   AutoLockMutex _alm(spin_mtx);
+  if (cached_buffer && !cached_fetched)
+    counter.replaced.fetch_add(1, std::memory_order_relaxed);
   cached_buffer = input;
+  cached_fetched = false;
+}
+
+int Flow::Input::Credit() {
+  if (!valid || thread_model != Model::ASYNCCOMMON)
+    return INT_MAX;
+  size_t used = cached_buffers.Size();
+  size_t capacity = cached_buffers.Capacity();
+  return used < capacity ? (int)(capacity - used) : 0;
 }
 
 bool Flow::Input::ASyncFullBlockingBehavior(volatile bool &pred) {
-#ifndef NDEBUG
-  AutoDuration ad;
-#endif
-  do {
-    mtx.unlock();
-    msleep(5);
-    if (max_cache_num > (int)cached_buffers.size()) {
-      mtx.lock();
+  int64_t start = getmonotonictime();
+  Heartbeat *hb = current_heartbeat;
+  if (hb) {
+    hb->push_flow.store(flow->GetTraceName(), std::memory_order_relaxed);
+    hb->push_slot.store(this - flow->v_input.data(),
+                        std::memory_order_relaxed);
+    hb->push_since.store(start, std::memory_order_relaxed);
+  }
+  while (pred) {
+    uint32_t key = space_event.prepare_wait();
+    if (!cached_buffers.Full() || !pred) {
+      space_event.cancel_wait();
       break;
     }
-    mtx.lock();
-  } while (pred);
+    // Woken by the consumer once it pops, the timeout is only a fallback
+    // for SetDisable() which does not notify.
+    space_event.wait(key, 100);
+  }
+  if (hb)
+    hb->push_since.store(0, std::memory_order_relaxed);
+  int64_t blocked_us = getmonotonictime() - start;
+  counter.blocked.fetch_add(1, std::memory_order_relaxed);
+  counter.blocked_us.fetch_add(blocked_us, std::memory_order_relaxed);
 #ifndef NDEBUG
-  if (ad.Get() > 100000 /*ms*/)
+  if (blocked_us > 100000 /*ms*/)
     LOG("WARN: Flow[%s]: Input[block mode]: block too long(%.2fms) > 5ms\n",
-        flow ? flow->GetFlowTag() : "Name is null", ad.Get() / 1000.0);
+        flow ? flow->GetFlowTag() : "Name is null", blocked_us / 1000.0);
 #endif
   return pred;
 }
@@ -917,16 +2126,90 @@ bool Flow::Input::ASyncFullBlockingBehavior(volatile bool &pred) {
 bool Flow::Input::ASyncFullDropFrontBehavior(volatile bool &pred _UNUSED) {
   LOG("WARN: Flow[%s]: Input: drop front buffer!\n",
       flow ? flow->GetFlowTag() : "Name is null");
-  cached_buffers.pop_front();
+  QueuedBuffer entry;
+  if (cached_buffers.Pop(entry)) {
+    auto &drop = entry.buffer;
+    // a high priority one jumps the queue instead, which makes room as well
+    if (drop && drop->GetPriority() == MediaBuffer::Priority::HIGH &&
+        priority_buffers.Push(entry)) {
+      counter.high_priority.fetch_add(1, std::memory_order_relaxed);
+      return true;
+    }
+    counter.drop_front.fetch_add(1, std::memory_order_relaxed);
+    if (drop && IsTraceEnabled())
+      TraceRecord(TraceType::DROP, flow->GetTraceName(),
+                  this - flow->v_input.data(), drop->GetTraceFrame());
+  }
   return true;
 }
 
 bool Flow::Input::ASyncFullDropCurrentBehavior(volatile bool &pred _UNUSED) {
   LOG("WARN: Flow[%s]: Input: drop current buffer!\n",
       flow ? flow->GetFlowTag() : "Name Is Null");
+  counter.drop_current.fetch_add(1, std::memory_order_relaxed);
   return false;
 }
 
+// The atomic clock is from the monotonic clock, such as the v4l2 timestamp,
+// or from gettimeofday, take the age on the nearer one.
+static int64_t clock_age(int64_t clock) {
+  int64_t age = getmonotonictime() - clock;
+  int64_t real_age = gettimeofday() - clock;
+  return std::llabs(real_age) < std::llabs(age) ? real_age : age;
+}
+
+static int64_t buffer_age(const MediaBuffer &buffer) {
+  return clock_age(buffer.GetAtomicClock());
+}
+
+bool Flow::Input::IsStale(const std::shared_ptr<MediaBuffer> &buffer,
+                          int64_t arrival) {
+  if (max_age_us <= 0 || !buffer)
+    return false;
+  if (buffer->GetAtomicClock())
+    return buffer_age(*buffer) > max_age_us;
+  return arrival > 0 && getmonotonictime() - arrival > max_age_us;
+}
+
+void Flow::Input::DropStale(const std::shared_ptr<MediaBuffer> &buffer) {
+  LOGD("Flow[%s]: Input: drop stale buffer!\n",
+       flow ? flow->GetFlowTag() : "Name is null");
+  counter.drop_stale.fetch_add(1, std::memory_order_relaxed);
+  if (IsTraceEnabled())
+    TraceRecord(TraceType::DROP, flow->GetTraceName(),
+                this - flow->v_input.data(), buffer->GetTraceFrame());
+}
+
+bool Flow::Input::Pop(std::shared_ptr<MediaBuffer> &buffer,
+                      int64_t &arrival) {
+  QueuedBuffer entry;
+  if (priority_buffers.Pop(entry)) {
+    if (entry.buffer && entry.buffer->GetAtomicClock() > overtake_clock)
+      overtake_clock = entry.buffer->GetAtomicClock();
+  } else if (!cached_buffers.Pop(entry)) {
+    return false;
+  }
+  buffer = std::move(entry.buffer);
+  arrival = entry.arrival;
+  return true;
+}
+
+bool Flow::Input::IsOvertaken(const std::shared_ptr<MediaBuffer> &buffer) {
+  return overtake_clock > 0 && buffer &&
+         buffer->GetPriority() == MediaBuffer::Priority::NORMAL &&
+         buffer->GetAtomicClock() &&
+         buffer->GetAtomicClock() < overtake_clock;
+}
+
+void Flow::Input::DropOvertaken(const std::shared_ptr<MediaBuffer> &buffer) {
+  LOGD("Flow[%s]: Input: drop overtaken buffer!\n",
+       flow ? flow->GetFlowTag() : "Name is null");
+  counter.drop_overtaken.fetch_add(1, std::memory_order_relaxed);
+  if (IsTraceEnabled())
+    TraceRecord(TraceType::DROP, flow->GetTraceName(),
+                this - flow->v_input.data(), buffer->GetTraceFrame());
+}
+
 std::string gen_datatype_rule(std::map<std::string, std::string> &params) {
   std::string rule;
   std::string value;
@@ -948,11 +2231,39 @@ Model GetModelByString(const std::string &model) {
   return Model::NONE;
 }
 
+PacePolicy GetPacePolicyByString(const std::string &policy) {
+  if (policy == KEY_PACE_SKIP)
+    return PacePolicy::SKIP;
+  return PacePolicy::CATCHUP;
+}
+
+int GetSchedPolicyByString(const std::string &policy) {
+  static std::map<std::string, int> policy_map = {
+      {KEY_SCHED_OTHER, SCHED_OTHER},
+      {KEY_SCHED_FIFO, SCHED_FIFO},
+      {KEY_SCHED_RR, SCHED_RR}};
+  auto it = policy_map.find(policy);
+  if (it != policy_map.end())
+    return it->second;
+  return SCHED_OTHER;
+}
+
+BackPressure GetBackPressureByString(const std::string &bp) {
+  static std::map<std::string, BackPressure> bp_map = {
+      {KEY_BP_THROTTLE, BackPressure::THROTTLE},
+      {KEY_BP_SKIP, BackPressure::SKIP}};
+  auto it = bp_map.find(bp);
+  if (it != bp_map.end())
+    return it->second;
+  return BackPressure::NONE;
+}
+
 InputMode GetInputModelByString(const std::string &in_model) {
   static std::map<std::string, InputMode> in_model_map = {
       {KEY_BLOCKING, InputMode::BLOCKING},
       {KEY_DROPFRONT, InputMode::DROPFRONT},
-      {KEY_DROPCURRENT, InputMode::DROPCURRENT}};
+      {KEY_DROPCURRENT, InputMode::DROPCURRENT},
+      {KEY_DROPSTALE, InputMode::DROPSTALE}};
   auto it = in_model_map.find(in_model);
   if (it != in_model_map.end())
     return it->second;
@@ -978,6 +2289,32 @@ void ParseParamToSlotMap(std::map<std::string, std::string> &params,
       LOG("warning, input cache num = %d\n", cache_num);
     input_maxcachenum = cache_num;
   }
+  std::string &max_age_str = params[KEY_INPUT_MAX_AGE];
+  if (!max_age_str.empty())
+    sm.input_max_age.push_back(std::stoi(max_age_str));
+  std::string &dedicated_str = params[KEY_DEDICATED_THREAD];
+  if (!dedicated_str.empty())
+    sm.dedicated_thread = !!std::stoi(dedicated_str);
+  std::string value = params[KEY_CPU_AFFINITY];
+  if (!value.empty())
+    sm.thread_attr.cpu_mask = std::stoull(value, nullptr, 0);
+  value = params[KEY_SCHED_POLICY];
+  if (!value.empty())
+    sm.thread_attr.policy = GetSchedPolicyByString(value);
+  value = params[KEY_SCHED_PRIORITY];
+  if (!value.empty())
+    sm.thread_attr.priority = std::stoi(value);
+  value = params[KEY_NICE];
+  if (!value.empty())
+    sm.thread_attr.nice = std::stoi(value);
+  sm.back_pressure = GetBackPressureByString(params[KEY_BACKPRESSURE]);
+  sm.pace_policy = GetPacePolicyByString(params[KEY_PACE_POLICY]);
+  value = params[KEY_BATCH_NUM];
+  if (!value.empty())
+    sm.batch_num = std::stoi(value);
+  value = params[KEY_BATCH_WINDOW];
+  if (!value.empty())
+    sm.batch_window = std::stoi(value);
 }
 
 size_t FlowOutputHoldInput(std::shared_ptr<MediaBuffer> &out_buffer,
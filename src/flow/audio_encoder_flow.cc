@@ -4,6 +4,8 @@
 
 #include <assert.h>
 
+#include <algorithm>
+
 #include "buffer.h"
 #include "encoder.h"
 #include "flow.h"
@@ -165,7 +167,14 @@ AudioEncoderFlow::AudioEncoderFlow(const char *param) {
   sm.process = encode;
   sm.thread_model = Model::ASYNCCOMMON;
   sm.mode_when_full = InputMode::DROPFRONT;
-  sm.input_maxcachenum.push_back(3);
+  std::string &batch_num = params[KEY_BATCH_NUM];
+  if (!batch_num.empty())
+    sm.batch_num = std::stoi(batch_num);
+  std::string &batch_window = params[KEY_BATCH_WINDOW];
+  if (!batch_window.empty())
+    sm.batch_window = std::stoi(batch_window);
+  // room for a whole batch
+  sm.input_maxcachenum.push_back(std::max(3, sm.batch_num));
   if (!InstallSlotMap(sm, "AudioEncoderFlow", 40)) {
     LOG("Fail to InstallSlotMap for AudioEncoderFlow\n");
     SetError(-EINVAL);
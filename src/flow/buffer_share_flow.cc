@@ -0,0 +1,85 @@
+// Copyright 2019 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "buffer_share.h"
+#include "flow.h"
+#include "media_reflector.h"
+
+namespace easymedia {
+
+static bool share_buffer(Flow *f, MediaBufferVector &input_vector);
+
+// Sends the input buffers to the consumers in other processes, see
+// BufferShareClient.
+class BufferShareFlow : public Flow {
+public:
+  BufferShareFlow(const char *param);
+  virtual ~BufferShareFlow() {
+    AutoPrintLine apl(__func__);
+    StopAllThread();
+  }
+  static const char *GetFlowName() { return "buffer_share"; }
+
+private:
+  std::shared_ptr<BufferShareServer> server;
+  friend bool share_buffer(Flow *f, MediaBufferVector &input_vector);
+};
+
+BufferShareFlow::BufferShareFlow(const char *param) {
+  std::map<std::string, std::string> params;
+  if (!parse_media_param_map(param, params)) {
+    SetError(-EINVAL);
+    return;
+  }
+  const std::string &path = params[KEY_SHARE_PATH];
+  if (path.empty()) {
+    LOG("missing %s\n", KEY_SHARE_PATH);
+    SetError(-EINVAL);
+    return;
+  }
+  int credits = 4;
+  const std::string &value = params[KEY_SHARE_CREDITS];
+  if (!value.empty())
+    credits = std::stoi(value);
+  server = std::make_shared<BufferShareServer>(path, credits);
+  if (!server || !server->Start()) {
+    LOG("Fail to share buffers on %s\n", path.c_str());
+    SetError(-EINVAL);
+    return;
+  }
+  SlotMap sm;
+  int input_maxcachenum = 2;
+  ParseParamToSlotMap(params, sm, input_maxcachenum);
+  if (sm.thread_model == Model::NONE)
+    sm.thread_model = Model::ASYNCCOMMON;
+  if (sm.mode_when_full == InputMode::NONE)
+    sm.mode_when_full = InputMode::DROPFRONT;
+  sm.input_slots.push_back(0);
+  sm.input_maxcachenum.push_back(input_maxcachenum);
+  sm.process = share_buffer;
+  std::string tag = "BufferShareFlow:";
+  tag.append(path);
+  if (!InstallSlotMap(sm, tag, -1)) {
+    LOG("Fail to InstallSlotMap for %s\n", tag.c_str());
+    SetError(-EINVAL);
+    return;
+  }
+  SetFlowTag(tag);
+}
+
+bool share_buffer(Flow *f, MediaBufferVector &input_vector) {
+  BufferShareFlow *flow = static_cast<BufferShareFlow *>(f);
+  auto &buffer = input_vector[0];
+  if (!buffer)
+    return true;
+  // no consumer with credit is not an error, the buffer is just dropped
+  flow->server->Send(buffer);
+  return true;
+}
+
+DEFINE_FLOW_FACTORY(BufferShareFlow, Flow)
+const char *FACTORY(BufferShareFlow)::ExpectedInputDataType() { return ""; }
+const char *FACTORY(BufferShareFlow)::OutPutDataType() { return nullptr; }
+
+} // namespace easymedia
@@ -0,0 +1,101 @@
+// Copyright 2019 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "buffer.h"
+#include "clock_join.h"
+#include "flow.h"
+#include "key_string.h"
+#include "media_reflector.h"
+#include "utils.h"
+
+namespace easymedia {
+
+static bool join_buffers(Flow *f, MediaBufferVector &input_vector);
+
+// Joins the buffers of input i to input 0 by the atomic clock, and sends the
+// joined ones to output i at once. The slots without a match are skipped.
+// The timeout is checked when any input arrives.
+class ClockJoinFlow : public Flow {
+public:
+  ClockJoinFlow(const char *param);
+  virtual ~ClockJoinFlow() {
+    AutoPrintLine apl(__func__);
+    StopAllThread();
+  }
+  static const char *GetFlowName() { return "clock_join"; }
+
+private:
+  std::unique_ptr<ClockJoin> join;
+
+  friend bool join_buffers(Flow *f, MediaBufferVector &input_vector);
+};
+
+ClockJoinFlow::ClockJoinFlow(const char *param) {
+  std::map<std::string, std::string> params;
+  if (!parse_media_param_map(param, params)) {
+    SetError(-EINVAL);
+    return;
+  }
+  int input_num = 2;
+  std::string value = params[KEY_JOIN_INPUT_NUM];
+  if (!value.empty())
+    input_num = std::stoi(value);
+  if (input_num < 2) {
+    LOG("ClockJoinFlow: %d inputs, nothing to join\n", input_num);
+    SetError(-EINVAL);
+    return;
+  }
+  int tolerance = 1;
+  value = params[KEY_JOIN_TOLERANCE];
+  if (!value.empty())
+    tolerance = std::stoi(value);
+  int timeout = 100;
+  value = params[KEY_JOIN_TIMEOUT];
+  if (!value.empty())
+    timeout = std::stoi(value);
+
+  SlotMap sm;
+  int input_maxcachenum = 4;
+  ParseParamToSlotMap(params, sm, input_maxcachenum);
+  // every input slot is fetched on its own
+  sm.thread_model = Model::ASYNCCOMMON;
+  if (sm.mode_when_full == InputMode::NONE)
+    sm.mode_when_full = InputMode::DROPFRONT;
+  for (int i = 0; i < input_num; i++) {
+    sm.input_slots.push_back(i);
+    sm.output_slots.push_back(i);
+    sm.input_maxcachenum.push_back(input_maxcachenum);
+  }
+  sm.process = join_buffers;
+  join.reset(new ClockJoin(input_num, tolerance * 1000LL, timeout * 1000LL,
+                           GetJoinPolicyByString(params[KEY_JOIN_POLICY]),
+                           input_maxcachenum * 2));
+  if (!InstallSlotMap(sm, "ClockJoinFlow", -1)) {
+    LOG("Fail to InstallSlotMap for ClockJoinFlow\n");
+    SetError(-EINVAL);
+    return;
+  }
+  SetFlowTag("ClockJoinFlow");
+}
+
+bool join_buffers(Flow *f, MediaBufferVector &input_vector) {
+  ClockJoinFlow *flow = static_cast<ClockJoinFlow *>(f);
+  for (size_t i = 0; i < input_vector.size(); i++)
+    flow->join->Push(i, input_vector[i]);
+  MediaBufferVector joined;
+  bool ret = true;
+  while (flow->join->Pop(joined)) {
+    for (size_t i = 0; i < joined.size(); i++) {
+      if (joined[i])
+        ret &= flow->SetOutput(joined[i], i);
+    }
+  }
+  return ret;
+}
+
+DEFINE_FLOW_FACTORY(ClockJoinFlow, Flow)
+const char *FACTORY(ClockJoinFlow)::ExpectedInputDataType() { return ""; }
+const char *FACTORY(ClockJoinFlow)::OutPutDataType() { return ""; }
+
+} // namespace easymedia
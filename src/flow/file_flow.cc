@@ -6,6 +6,7 @@
 
 #include "buffer.h"
 #include "flow.h"
+#include "pacer.h"
 #include "stream.h"
 #include "utils.h"
 
@@ -26,6 +27,7 @@ private:
   size_t read_size;
   ImageInfo info;
   int fps;
+  Pacer pacer;
   int loop_time;
   bool loop;
   std::thread *read_thread;
@@ -33,7 +35,8 @@ private:
 
 FileReadFlow::FileReadFlow(const char *param)
     : mtype(MediaBuffer::MemType::MEM_COMMON), read_size(0), fps(0),
-      loop_time(0), loop(false), read_thread(nullptr) {
+      pacer(0, PacePolicy::CATCHUP, &pace_counter), loop_time(0), loop(false),
+      read_thread(nullptr) {
   memset(&info, 0, sizeof(info));
   info.pix_fmt = PIX_FMT_NONE;
   std::map<std::string, std::string> params;
@@ -69,6 +72,9 @@ FileReadFlow::FileReadFlow(const char *param)
   value = params[KEY_FPS];
   if (!value.empty())
     fps = std::stoi(value);
+  if (fps > 0)
+    pacer.SetPeriod(1000000 / fps);
+  pacer.SetPolicy(GetPacePolicyByString(params[KEY_PACE_POLICY]));
   value = params[KEY_LOOP_TIME];
   if (!value.empty())
     loop_time = std::stoi(value);
@@ -76,6 +82,7 @@ FileReadFlow::FileReadFlow(const char *param)
     SetError(-EINVAL);
     return;
   }
+  SetBackPressure(GetBackPressureByString(params[KEY_BACKPRESSURE]));
   loop = true;
   read_thread = new std::thread(&FileReadFlow::ReadThreadRun, this);
   if (!read_thread) {
@@ -135,7 +142,7 @@ void FileReadFlow::ReadThreadRun() {
     }
     size_t size;
     if (read_size) {
-      size = fstream->Read(buffer->GetPtr(), 1, read_size);
+      size = fstream->Read(buffer->GetWritablePtr(), 1, read_size);
       if (size != read_size && !fstream->Eof()) {
         LOG("read get %d != expect %d\n", (int)size, (int)read_size);
         SetDisable();
@@ -144,7 +151,7 @@ void FileReadFlow::ReadThreadRun() {
       buffer->SetValidSize(size);
     }
     if (is_image) {
-      if (!fstream->ReadImage(buffer->GetPtr(), info)) {
+      if (!fstream->ReadImage(buffer->GetWritablePtr(), info)) {
         if (!fstream->Eof()) {
           SetDisable();
           break;
@@ -154,11 +161,10 @@ void FileReadFlow::ReadThreadRun() {
       }
     }
     buffer->SetUSTimeStamp(gettimeofday());
-    SendInput(buffer, 0);
-    if (fps != 0) {
-      static int interval = 1000 / fps;
-      msleep(interval);
-    }
+    // keep the fps even if the buffer is skipped
+    if (CheckSourceCredit())
+      SendInput(buffer, 0);
+    pacer.Wait();
   }
 }
 
@@ -261,6 +267,7 @@ FileWriteFlow::FileWriteFlow(const char *param)
   sm.thread_model = Model::ASYNCCOMMON;
   sm.mode_when_full = InputMode::DROPFRONT;
   sm.input_maxcachenum.push_back(0);
+  sm.dedicated_thread = true; // blocking file io
   sm.process = save_buffer;
 
   if (!InstallSlotMap(sm, "FileWriteFlow", 0)) {
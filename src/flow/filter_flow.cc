@@ -79,6 +79,9 @@ FilterFlow::FilterFlow(const char *param)
   thread_model = sm.thread_model;
   if (sm.mode_when_full == InputMode::NONE)
     sm.mode_when_full = InputMode::DROPCURRENT;
+  // may wait for an exhausted buffer pool, see below
+  if (!params[KEY_MEM_TYPE].empty() && !params[KEY_MEM_CNT].empty())
+    sm.dedicated_thread = true;
   int input_idx = 0;
   for (auto &param_str : separate_list) {
     auto filter =
@@ -135,7 +138,20 @@ FilterFlow::FilterFlow(const char *param)
       size_t m_size = CalPixFmtSize(out_img_info);
       MediaBuffer::MemType m_type =  StringToMemType(mem_type.c_str());
 
-      buffer_pool = std::make_shared<BufferPool>(m_cnt, m_size, m_type);
+      int m_max_cnt = m_cnt;
+      std::string &mem_max_cnt = params[KEY_MEM_MAX_CNT];
+      if (!mem_max_cnt.empty())
+        m_max_cnt = std::stoi(mem_max_cnt);
+      if (m_max_cnt > m_cnt) {
+        int idle_ms = 1000;
+        std::string &mem_idle_time = params[KEY_MEM_IDLE_TIME];
+        if (!mem_idle_time.empty())
+          idle_ms = std::stoi(mem_idle_time);
+        buffer_pool = std::make_shared<BufferPool>(m_cnt, m_max_cnt, m_size,
+                                                   m_type, idle_ms);
+      } else {
+        buffer_pool = std::make_shared<BufferPool>(m_cnt, m_size, m_type);
+      }
     }
   } else {
     // support async mode (one input, multi output)
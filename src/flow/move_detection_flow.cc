@@ -182,7 +182,7 @@ bool md_process(Flow *f, MediaBufferVector &input_vector) {
       LOG_NO_MEMORY();
       return false;
     }
-    memcpy(dst->GetPtr(), info_list, result_size);
+    memcpy(dst->GetWritablePtr(), info_list, result_size);
   } else {
     dst = MediaBuffer::Alloc(4, MediaBuffer::MemType::MEM_COMMON);
     if (!dst) {
@@ -215,82 +215,66 @@ bool md_process(Flow *f, MediaBufferVector &input_vector) {
   return true;
 }
 
+// The time stamps of images acquired by multiple image acquisition channels
+// at the same time cannot exceed 1 ms.
+#define MD_RESULT_CLOCK_TOLERANCE 1000 // us
+
 std::shared_ptr<MediaBuffer>
 MoveDetectionFlow::LookForMdResult(int64_t atomic_clock, int timeout_us) {
-  std::shared_ptr<MediaBuffer> right_result = NULL;
-  std::shared_ptr<MediaBuffer> last_restult = NULL;
-  int clk_delta = 0;
-  int clk_delta_min = 0;
+  const std::shared_ptr<MediaBuffer> *result = nullptr;
   int64_t start_ts = gettimeofday();
-  int left_time = 0;
+  int64_t left_time = 0;
 #ifndef NDBUEG
   AutoDuration ad;
 #endif
 
   LOGD("#LookForMdResult, target:%.1f, timeout:%.1f\n", atomic_clock / 1000.0,
        timeout_us / 1000.0);
+  std::unique_lock<std::mutex> lck(md_results_mtx);
   do {
     // Step1: Lookfor mdinfo first.
-    md_results_mtx.lock();
-    for (auto &tmp : md_results) {
-      clk_delta = abs(atomic_clock - tmp->GetAtomicClock());
-      LOGD("...Compare vs :%.1f\n", tmp->GetAtomicClock() / 1000.0);
-      // The time stamps of images acquired by multiple image
-      // acquisition channels at the same time cannot exceed 1 ms.
-      if (clk_delta <= 1000) {
-        LOGD(">>> MD get right result\n");
-        right_result = tmp;
-        break;
-      }
-      // Find the closest value.
-      if ((!clk_delta_min || (clk_delta <= clk_delta_min))) {
-        clk_delta_min = clk_delta;
-        last_restult = tmp;
-      }
+    result = md_results.Find(atomic_clock, MD_RESULT_CLOCK_TOLERANCE,
+                             JoinPolicy::EXACT);
+    if (result) {
+      LOGD(">>> MD get right result\n");
+      break;
     }
-    md_results_mtx.unlock();
-
-    // Step2: wait for new mdinfo, then lookup again.
-    // If no new mdinfo is received within the remaining time,
-    // timeout processing: directly use the closest mdinfo as
-    // the result.
+    // Step2: wait for new mdinfo, then lookup again, unless a later one
+    // is in already. If no new mdinfo is received within the remaining
+    // time, use the closest mdinfo as the result.
     left_time = timeout_us - (gettimeofday() - start_ts);
-    if ((md_results.size() > 0) && !right_result && (left_time > 0)) {
-      std::unique_lock<std::mutex> lck(md_results_mtx);
-      if (con_var.wait_for(lck, std::chrono::microseconds(left_time)) ==
-          std::cv_status::timeout) {
+    if (md_results.Empty() ||
+        md_results.Passed(atomic_clock, MD_RESULT_CLOCK_TOLERANCE) ||
+        left_time <= 0 ||
+        con_var.wait_for(lck, std::chrono::microseconds(left_time)) ==
+            std::cv_status::timeout) {
+      int64_t clock = 0;
+      result = md_results.Find(atomic_clock, MD_RESULT_CLOCK_TOLERANCE,
+                               JoinPolicy::NEAREST, &clock);
+      if (result)
         LOG("WARN:MD get closest result, deltaTime=%.1fms.\n",
-            clk_delta_min / 1000.0);
-        right_result = last_restult;
-        break; // stop while
-      }
-#ifndef NDEBUG
-      else {
-        LOGD("#RetryLookForMdResult target:%.1f\n", atomic_clock / 1000.0);
-      }
-#endif
-    } else
-      break; // stop while
+            std::llabs(clock - atomic_clock) / 1000.0);
+      break;
+    }
+    LOGD("#RetryLookForMdResult target:%.1f\n", atomic_clock / 1000.0);
   } while (1);
 
 #ifndef NDBUEG
   LOGD("#%s cost:%dms\n", __func__, (int)(ad.Get() / 1000));
 #endif
 
-  return right_result;
+  return result ? *result : nullptr;
 }
 
 void MoveDetectionFlow::InsertMdResult(std::shared_ptr<MediaBuffer> &buffer) {
   md_results_mtx.lock();
-  while (md_results.size() > MD_RESULT_MAX_CNT)
-    md_results.pop_front();
-
-  md_results.push_back(buffer);
+  md_results.Insert(buffer->GetAtomicClock(), buffer);
   md_results_mtx.unlock();
   con_var.notify_all();
 }
 
-MoveDetectionFlow::MoveDetectionFlow(const char *param) {
+MoveDetectionFlow::MoveDetectionFlow(const char *param)
+    : md_results(MD_RESULT_MAX_CNT + 1) {
   md_ctx = NULL;
   std::list<std::string> separate_list;
   std::map<std::string, std::string> params;
@@ -432,9 +416,7 @@ MoveDetectionFlow::~MoveDetectionFlow() {
   if (roi_in)
     free(roi_in);
 
-  std::list<std::shared_ptr<MediaBuffer>>::iterator it;
-  for (it = md_results.begin(); it != md_results.end();)
-    it = md_results.erase(it);
+  md_results.Clear();
 }
 
 int MoveDetectionFlow::Control(unsigned long int request, ...) {
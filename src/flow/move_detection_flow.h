@@ -13,6 +13,7 @@
 #include <move_detect/move_detection.h>
 
 #include "buffer.h"
+#include "clock_join.h"
 #include "media_type.h"
 
 namespace easymedia {
@@ -46,7 +47,7 @@ private:
   int ds_width, ds_height;
   std::mutex md_results_mtx;
   std::condition_variable con_var;
-  std::list<std::shared_ptr<MediaBuffer>> md_results;
+  ClockIndex<std::shared_ptr<MediaBuffer>> md_results;
   friend bool md_process(Flow *f, MediaBufferVector &input_vector);
 };
 
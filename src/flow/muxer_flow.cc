@@ -156,6 +156,7 @@ MuxerFlow::MuxerFlow(const char *param)
   sm.input_maxcachenum.push_back(20);
   sm.fetch_block.push_back(false);
   sm.fetch_block.push_back(false);
+  sm.dedicated_thread = true; // blocking file io
   sm.process = save_buffer;
 
   if (!InstallSlotMap(sm, "MuxerFlow", 0)) {
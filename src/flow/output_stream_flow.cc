@@ -43,6 +43,7 @@ OutPutStreamFlow::OutPutStreamFlow(const char *param) {
   const char *stream_name = name.c_str();
   SlotMap sm;
   int input_maxcachenum = 10;
+  sm.dedicated_thread = true; // stream write may block, such as alsa
   ParseParamToSlotMap(params, sm, input_maxcachenum);
   if (sm.thread_model == Model::NONE)
     sm.thread_model =
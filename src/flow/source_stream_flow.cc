@@ -56,6 +56,7 @@ SourceStreamFlow::SourceStreamFlow(const char *param)
     SetError(-EINVAL);
     return;
   }
+  SetBackPressure(GetBackPressureByString(params[KEY_BACKPRESSURE]));
   loop = true;
   read_thread = new std::thread(&SourceStreamFlow::ReadThreadRun, this);
   if (!read_thread) {
@@ -102,6 +103,9 @@ void SourceStreamFlow::ReadThreadRun() {
       break;
     }
     auto buffer = stream->Read();
+    // a skipped buffer is given back to the stream at once
+    if (buffer && !CheckSourceCredit())
+      continue;
     SendInput(buffer, 0);
   }
 }
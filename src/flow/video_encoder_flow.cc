@@ -133,6 +133,9 @@ bool encode(Flow *f, MediaBufferVector &input_vector) {
   // when output fps less len input fps, enc->Proccess() may
   // return a empty mediabuff.
   if (dst->GetValidSize() > 0) {
+    // the stream is undecodable till the next gop if an intra frame drops
+    if (dst->GetUserFlag() & (MediaBuffer::kIntra | MediaBuffer::kExtraIntra))
+      dst->SetPriority(MediaBuffer::Priority::HIGH);
     ret = vf->SetOutput(dst, 0);
     if (vf->extra_output)
       ret &= vf->SetOutput(extra_dst, 1);
@@ -283,6 +286,7 @@ VideoEncoderFlow::VideoEncoderFlow(const char *param) : extra_output(false),
       extra_buf->SetPtr(extra_data);
       extra_buf->SetValidSize(extra_data_size);
       extra_buf->SetUserFlag(MediaBuffer::kExtraIntra);
+      extra_buf->SetPriority(MediaBuffer::Priority::HIGH);
       SetOutput(extra_buf, 0);
     } else {
       if (output_dt == VIDEO_H264)
@@ -293,6 +297,7 @@ VideoEncoderFlow::VideoEncoderFlow(const char *param) : extra_output(false),
                                               extra_data_size, gettimeofday());
       for (auto &extra_buffer : extra_buffer_list) {
         assert(extra_buffer->GetUserFlag() & MediaBuffer::kExtraIntra);
+        extra_buffer->SetPriority(MediaBuffer::Priority::HIGH);
         SetOutput(extra_buffer, 0);
       }
     }
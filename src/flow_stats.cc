@@ -0,0 +1,100 @@
+// Copyright 2019 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "flow_stats.h"
+
+#include <string.h>
+
+namespace easymedia {
+
+HistogramInfo::HistogramInfo() : count(0), sum(0), max(0) {
+  memset(buckets, 0, sizeof(buckets));
+}
+
+int64_t HistogramInfo::Percentile(double p) const {
+  if (!count)
+    return 0;
+  uint64_t target = (uint64_t)(count * p / 100.0);
+  if (target == 0)
+    target = 1;
+  uint64_t acc = 0;
+  for (int i = 0; i < FLOW_HISTOGRAM_BUCKETS; i++) {
+    acc += buckets[i];
+    if (acc >= target)
+      return i == FLOW_HISTOGRAM_BUCKETS - 1 ? (int64_t)max : (1LL << i);
+  }
+  return (int64_t)max;
+}
+
+void Histogram::Get(HistogramInfo &info) const {
+  info.count = count.load(std::memory_order_relaxed);
+  info.sum = sum.load(std::memory_order_relaxed);
+  info.max = max.load(std::memory_order_relaxed);
+  for (int i = 0; i < FLOW_HISTOGRAM_BUCKETS; i++)
+    info.buckets[i] = buckets[i].load(std::memory_order_relaxed);
+}
+
+void Histogram::Reset() {
+  count.store(0, std::memory_order_relaxed);
+  sum.store(0, std::memory_order_relaxed);
+  max.store(0, std::memory_order_relaxed);
+  for (int i = 0; i < FLOW_HISTOGRAM_BUCKETS; i++)
+    buckets[i].store(0, std::memory_order_relaxed);
+}
+
+InputStats::InputStats()
+    : received(0), drop_front(0), drop_current(0), drop_stale(0),
+      drop_overtaken(0), replaced(0), high_priority(0), blocked(0),
+      blocked_us(0), depth(0), peak_depth(0), capacity(0) {}
+
+OutputStats::OutputStats()
+    : buffers(0), sent(0), null_sent(0), fan_out(0), skipped(0),
+      throttled_us(0) {}
+
+void InputCounter::Get(InputStats &stats) const {
+  stats.received = received.load(std::memory_order_relaxed);
+  stats.drop_front = drop_front.load(std::memory_order_relaxed);
+  stats.drop_current = drop_current.load(std::memory_order_relaxed);
+  stats.drop_stale = drop_stale.load(std::memory_order_relaxed);
+  stats.drop_overtaken = drop_overtaken.load(std::memory_order_relaxed);
+  stats.replaced = replaced.load(std::memory_order_relaxed);
+  stats.high_priority = high_priority.load(std::memory_order_relaxed);
+  stats.blocked = blocked.load(std::memory_order_relaxed);
+  stats.blocked_us = blocked_us.load(std::memory_order_relaxed);
+  stats.peak_depth = peak_depth.load(std::memory_order_relaxed);
+  inter_arrival.Get(stats.inter_arrival);
+}
+
+void InputCounter::Reset() {
+  received.store(0, std::memory_order_relaxed);
+  drop_front.store(0, std::memory_order_relaxed);
+  drop_current.store(0, std::memory_order_relaxed);
+  drop_stale.store(0, std::memory_order_relaxed);
+  drop_overtaken.store(0, std::memory_order_relaxed);
+  replaced.store(0, std::memory_order_relaxed);
+  high_priority.store(0, std::memory_order_relaxed);
+  blocked.store(0, std::memory_order_relaxed);
+  blocked_us.store(0, std::memory_order_relaxed);
+  peak_depth.store(0, std::memory_order_relaxed);
+  last_arrival.store(0, std::memory_order_relaxed);
+  inter_arrival.Reset();
+}
+
+void OutputCounter::Get(OutputStats &stats) const {
+  stats.buffers = buffers.load(std::memory_order_relaxed);
+  stats.sent = sent.load(std::memory_order_relaxed);
+  stats.null_sent = null_sent.load(std::memory_order_relaxed);
+  stats.skipped = skipped.load(std::memory_order_relaxed);
+  stats.throttled_us = throttled_us.load(std::memory_order_relaxed);
+}
+
+void OutputCounter::Reset() {
+  buffers.store(0, std::memory_order_relaxed);
+  sent.store(0, std::memory_order_relaxed);
+  null_sent.store(0, std::memory_order_relaxed);
+  skipped.store(0, std::memory_order_relaxed);
+  throttled_us.store(0, std::memory_order_relaxed);
+}
+
+} // namespace easymedia
@@ -64,7 +64,8 @@ bool SendMediaToServer(Flow *f, MediaBufferVector &input_vector) {
     if (!buffer)
       continue;
     if (buffer && buffer->IsHwBuffer()) {
-      // hardware buffer is limited, copy it
+      // hardware buffer is limited, copy it, as live555 caches up to 60
+      // frames and a view would hold the packet buffers of the encoder
       auto new_buffer = MediaBuffer::Clone(*buffer.get());
       new_buffer->SetType(buffer->GetType());
       buffer = new_buffer;
@@ -73,13 +74,9 @@ bool SendMediaToServer(Flow *f, MediaBufferVector &input_vector) {
     if ((buffer->GetUserFlag() & MediaBuffer::kIntra)) {
       std::list<std::shared_ptr<easymedia::MediaBuffer>> spspps;
       if (rtsp_flow->video_type == VIDEO_H264) {
-        spspps = split_h264_separate((const uint8_t *)buffer->GetPtr(),
-                                     buffer->GetValidSize(),
-                                     buffer->GetUSTimeStamp());
+        spspps = split_h264_separate(*buffer);
       } else if (rtsp_flow->video_type == VIDEO_H265) {
-        spspps = split_h265_separate((const uint8_t *)buffer->GetPtr(),
-                                     buffer->GetValidSize(),
-                                     buffer->GetUSTimeStamp());
+        spspps = split_h265_separate(*buffer);
       }
       // Independently send vps, sps, pps packets to live555.
       for (auto &buf : spspps)
@@ -162,6 +159,7 @@ RtspServerFlow::RtspServerFlow(const char *param) {
     sm.process = SendMediaToServer;
     sm.thread_model = Model::ASYNCCOMMON;
     sm.mode_when_full = InputMode::BLOCKING;
+    sm.dedicated_thread = true; // may block on the live555 session
     sm.input_maxcachenum.push_back(0); // no limit
     if (sm.input_slots.size() > 1)
       sm.input_maxcachenum.push_back(0);
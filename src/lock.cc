@@ -4,7 +4,13 @@
 
 #include "lock.h"
 
+#include <errno.h>
+#include <limits.h>
+#include <linux/futex.h>
 #include <stdio.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
 
 namespace easymedia {
 
@@ -81,4 +87,49 @@ void SpinLockMutex::unlock() {
   flag.clear(std::memory_order_release);
 }
 
+static int futex(std::atomic<uint32_t> *uaddr, int op, uint32_t val,
+                 const struct timespec *timeout) {
+  return syscall(SYS_futex, reinterpret_cast<uint32_t *>(uaddr), op, val,
+                 timeout, NULL, 0);
+}
+
+uint32_t FutexEvent::prepare_wait() {
+  waiters.fetch_add(1, std::memory_order_seq_cst);
+  return seq.load(std::memory_order_seq_cst);
+}
+
+void FutexEvent::cancel_wait() {
+  waiters.fetch_sub(1, std::memory_order_seq_cst);
+}
+
+bool FutexEvent::wait(uint32_t key, int timeout_ms) {
+  struct timespec ts;
+  struct timespec *pts = nullptr;
+  if (timeout_ms >= 0) {
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+    pts = &ts;
+  }
+  bool timeout = false;
+  while (seq.load(std::memory_order_acquire) == key) {
+    int ret = futex(&seq, FUTEX_WAIT_PRIVATE, key, pts);
+    if (ret < 0 && errno == ETIMEDOUT) {
+      timeout = true;
+      break;
+    }
+    // EINTR or spurious wakeup of a relative timeout wait, just return and
+    // let the caller check its condition again.
+    if (pts)
+      break;
+  }
+  waiters.fetch_sub(1, std::memory_order_seq_cst);
+  return !timeout;
+}
+
+void FutexEvent::notify(bool all) {
+  seq.fetch_add(1, std::memory_order_seq_cst);
+  if (waiters.load(std::memory_order_seq_cst) > 0)
+    futex(&seq, FUTEX_WAKE_PRIVATE, all ? INT_MAX : 1, nullptr);
+}
+
 } // namespace easymedia
@@ -0,0 +1,53 @@
+// Copyright 2019 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "pacer.h"
+
+#include <errno.h>
+#include <time.h>
+
+namespace easymedia {
+
+Pacer::Pacer(int64_t period_us, PacePolicy policy, PaceCounter *pc)
+    : period(period_us), deadline(0), pace_policy(policy), counter(pc) {}
+
+void Pacer::SetPeriod(int64_t period_us) {
+  period = period_us;
+  deadline = 0;
+}
+
+int Pacer::Wait() {
+  int64_t now = getmonotonictime();
+  if (period <= 0)
+    return 0;
+  if (!deadline)
+    deadline = now + period;
+  if (deadline > now) {
+    struct timespec ts;
+    ts.tv_sec = deadline / 1000000;
+    ts.tv_nsec = (deadline % 1000000) * 1000;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) ==
+           EINTR)
+      ;
+    now = getmonotonictime();
+  }
+  if (counter)
+    counter->jitter.Add(now - deadline);
+  deadline += period;
+  if (deadline > now)
+    return 0;
+  // late for the next deadline too
+  int64_t late = (now - deadline) / period + 1;
+  int skipped = 0;
+  if (pace_policy == PacePolicy::SKIP)
+    skipped = (int)late;
+  else if (late > PACER_MAX_CATCHUP)
+    skipped = (int)(late - PACER_MAX_CATCHUP);
+  deadline += skipped * period;
+  if (counter && skipped)
+    counter->skipped.fetch_add(skipped, std::memory_order_relaxed);
+  return skipped;
+}
+
+} // namespace easymedia
@@ -405,6 +405,8 @@ int MPPDecoder::Process(const std::shared_ptr<MediaBuffer> &input,
     LOG("Received a errinfo frame.\n");
     goto out;
   }
+  // written by the fd
+  output->EndDeviceAccess(false);
   if (SetImageBufferWithMppFrame(std::static_pointer_cast<ImageBuffer>(output),
                                  mpp_ctx, frame))
     goto out;
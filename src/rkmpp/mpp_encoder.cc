@@ -314,6 +314,11 @@ int MPPEncoder::Process(const std::shared_ptr<MediaBuffer> &input,
   ret = Process(frame, packet, mv_buf);
   if (ret)
     goto ENCODE_OUT;
+  // written by the fd
+  if (import_packet)
+    output->EndDeviceAccess(false);
+  if (mv_buf)
+    extra_output->EndDeviceAccess(false);
 
   if (!packet) {
     LOG("ERROR: MPP Encoder: input frame:%p, %zuBytes; output null packet!\n",
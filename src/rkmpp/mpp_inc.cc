@@ -167,7 +167,7 @@ MPP_RET init_mpp_buffer(MppBuffer &buffer,
                         size_t frame_size) {
   MPP_RET ret;
   int fd = mb->GetFD();
-  void *ptr = mb->GetPtr();
+  void *ptr = mb->GetDevicePtr();
   size_t size = mb->GetValidSize();
 
   if (fd >= 0) {
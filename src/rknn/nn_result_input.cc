@@ -5,6 +5,7 @@
 #include <queue>
 
 #include "buffer.h"
+#include "clock_join.h"
 #include "control.h"
 #include "encoder.h"
 #include "filter.h"
@@ -37,7 +38,7 @@ private:
   std::condition_variable cond_;
   ReadWriteLockMutex result_mutex_;
 
-  std::deque<std::list<RknnResult>> nn_cache_;
+  ClockIndex<std::list<RknnResult>> nn_cache_;
   std::deque<std::shared_ptr<ImageBuffer>> image_pool_;
 };
 
@@ -54,6 +55,7 @@ NNResultInput::NNResultInput(const char *param) {
   const std::string &cache_size_str = params[KEY_CACHE_SIZE];
   if (!cache_size_str.empty())
     cache_size_ = std::stoi(cache_size_str);
+  nn_cache_.SetCapacity(cache_size_ + 1);
 
   clock_delta_ms_ = 90;
   const std::string &clock_delta_str = params[KEY_CLOCK_DELTA];
@@ -67,32 +69,19 @@ NNResultInput::NNResultInput(const char *param) {
 }
 
 void NNResultInput::PushResult(std::list<RknnResult> &results) {
+  if (results.empty())
+    return;
   std::lock_guard<std::mutex> lock(mutex_);
-  if (nn_cache_.size() > cache_size_)
-    nn_cache_.pop_front();
-  nn_cache_.push_back(results);
+  nn_cache_.Insert(results.front().timeval, results);
 }
 
 std::list<RknnResult> NNResultInput::PopResult(int64_t atomic_clock) {
   std::unique_lock<std::mutex> lock(mutex_);
-
-  int64_t min_delta = 10000000LL;
-  std::list<RknnResult> result;
-
-  for (auto &iter : nn_cache_) {
-    for (RknnResult &tmp : iter) {
-      int64_t delta = std::llabs(tmp.timeval - atomic_clock);
-      if (delta < min_delta) {
-        min_delta = delta;
-        result = iter;
-      }
-      break;
-    }
-  }
-  int64_t clock_delta = clock_delta_ms_ * 1000;
-  if (!result.empty() && clock_delta < min_delta)
-    result.clear();
-  return std::move(result);
+  auto result = nn_cache_.Find(atomic_clock, clock_delta_ms_ * 1000LL,
+                               JoinPolicy::EXACT);
+  if (!result)
+    return std::list<RknnResult>();
+  return *result;
 }
 
 int NNResultInput::Process(std::shared_ptr<MediaBuffer> input,
@@ -178,8 +178,9 @@ int rga_blit(std::shared_ptr<ImageBuffer> src, std::shared_ptr<ImageBuffer> dst,
 #endif
 
   // flush cache,  2688x1520 NV12 cost 1399us, 1080P cost 905us
-  src->BeginCPUAccess(false);
-  src->EndCPUAccess(false);
+  // only if the cpu may have written since
+  src->BeginDeviceAccess(true);
+  dst->BeginDeviceAccess(false);
 
   int ret = RgaFilter::gRkRga.RkRgaBlit(&src_info, &dst_info, NULL);
   if (ret) {
@@ -195,8 +196,9 @@ int rga_blit(std::shared_ptr<ImageBuffer> src, std::shared_ptr<ImageBuffer> dst,
   }
 
   // invalidate cache, 2688x1520 NV12 cost  1072us, 1080P cost 779us
-  dst->BeginCPUAccess(true);
-  dst->EndCPUAccess(true);
+  // deferred to the cpu access if tracked, skipped if only devices follow
+  src->EndDeviceAccess(true);
+  dst->EndDeviceAccess(false);
 
   return ret;
 }
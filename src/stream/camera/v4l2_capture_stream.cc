@@ -108,6 +108,7 @@ public:
   void *ptr;
   size_t length;
   int (*munmap_f)(void *_start, size_t length);
+  CacheSync cache_sync;
 };
 
 static int __free_v4l2buffer(void *arg) {
@@ -267,6 +268,8 @@ int V4L2CaptureStream::Open() {
         V4L2Buffer *buffer = static_cast<V4L2Buffer *>(mb.GetUserData().get());
         buffer->dmafd = dmafd;
         mb.SetFD(dmafd);
+        mb.SetCacheSync(std::shared_ptr<CacheSync>(mb.GetUserData(),
+                                                   &buffer->cache_sync));
       }
     }
   }
@@ -346,6 +349,9 @@ std::shared_ptr<MediaBuffer> V4L2CaptureStream::Read() {
     ret_buf->SetAtomicTimeVal(buf_ts);
     ret_buf->SetTimeVal(buf_ts);
     ret_buf->SetValidSize(buf.bytesused);
+    // written by the camera, the cpu invalidates only if it reads
+    if (ret_buf->GetCacheSync())
+      ret_buf->EndDeviceAccess(false);
   } else {
     if (v4l2_ctx->IoCtrl(VIDIOC_QBUF, &buf) < 0)
       LOG("%s, index=%d, ioctl(VIDIOC_QBUF): %m\n", dev, buf.index);
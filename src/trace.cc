@@ -0,0 +1,293 @@
+// Copyright 2019 Fuzhou Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <vector>
+
+namespace easymedia {
+
+// Single writer ring, readers validate each record by its sequence.
+class TraceRing {
+public:
+  struct Event {
+    int64_t ts;
+    int64_t frame;
+    const char *name;
+    pid_t tid;
+    int slot;
+    TraceType type;
+  };
+
+  TraceRing(size_t size, pid_t owner)
+      : records(new Record[size]), num(size), head(0), tid(owner), owned(true) {
+    for (size_t i = 0; i < num; i++)
+      records[i].seq.store(0, std::memory_order_relaxed);
+  }
+
+  void Add(TraceType type, const char *name, int slot, int64_t frame,
+           int64_t ts) {
+    uint64_t pos = head.load(std::memory_order_relaxed);
+    Record &r = records[pos % num];
+    r.seq.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    r.ts.store(ts, std::memory_order_relaxed);
+    r.frame.store(frame, std::memory_order_relaxed);
+    r.name.store(name, std::memory_order_relaxed);
+    r.info.store(((uint64_t)(uint32_t)tid << 32) |
+                     ((uint64_t)(uint16_t)slot << 8) | (uint64_t)type,
+                 std::memory_order_relaxed);
+    r.seq.store(pos + 1, std::memory_order_release);
+    head.store(pos + 1, std::memory_order_release);
+  }
+
+  void Collect(std::vector<Event> &events) {
+    uint64_t end = head.load(std::memory_order_acquire);
+    uint64_t pos = end > num ? end - num : 0;
+    for (; pos < end; pos++) {
+      Record &r = records[pos % num];
+      uint64_t seq = r.seq.load(std::memory_order_acquire);
+      Event e;
+      e.ts = r.ts.load(std::memory_order_relaxed);
+      e.frame = r.frame.load(std::memory_order_relaxed);
+      e.name = r.name.load(std::memory_order_relaxed);
+      uint64_t info = r.info.load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (seq != pos + 1 || r.seq.load(std::memory_order_relaxed) != seq)
+        continue; // cleared or being overwritten
+      e.tid = (pid_t)(info >> 32);
+      e.slot = (int)(int16_t)((info >> 8) & 0xFFFF);
+      e.type = (TraceType)(info & 0xFF);
+      events.push_back(e);
+    }
+  }
+
+  void Clear() {
+    for (size_t i = 0; i < num; i++)
+      records[i].seq.store(0, std::memory_order_relaxed);
+  }
+
+private:
+  struct Record {
+    std::atomic<uint64_t> seq; // position + 1, 0 if invalid
+    std::atomic<int64_t> ts;
+    std::atomic<int64_t> frame;
+    std::atomic<const char *> name;
+    std::atomic<uint64_t> info; // tid << 32 | slot << 8 | type
+  };
+  std::unique_ptr<Record[]> records;
+  size_t num;
+  std::atomic<uint64_t> head;
+
+public:
+  pid_t tid;
+  std::atomic<bool> owned;
+};
+
+static std::atomic<bool> trace_enabled(false);
+static std::atomic<size_t> trace_ring_size(TRACE_DEFAULT_EVENTS_PER_THREAD);
+static std::mutex trace_mtx;
+static std::vector<std::shared_ptr<TraceRing>> trace_rings;
+static std::set<std::string> trace_names;
+static std::map<pid_t, std::string> trace_thread_names;
+
+// Rings are kept after the thread exits for later dump, a new thread
+// reuses a ring released by an exited thread.
+class TraceRingHolder {
+public:
+  TraceRingHolder() : ring(nullptr) {}
+  ~TraceRingHolder() {
+    if (ring)
+      ring->owned.store(false, std::memory_order_release);
+  }
+  TraceRing *Get() {
+    if (!ring)
+      ring = Acquire();
+    return ring;
+  }
+
+private:
+  static TraceRing *Acquire() {
+    pid_t tid = (pid_t)syscall(SYS_gettid);
+    char name[17] = {0};
+    prctl(PR_GET_NAME, name);
+    std::lock_guard<std::mutex> _lg(trace_mtx);
+    trace_thread_names[tid] = name;
+    for (auto &r : trace_rings) {
+      bool expected = false;
+      if (r->owned.compare_exchange_strong(expected, true)) {
+        r->tid = tid;
+        return r.get();
+      }
+    }
+    auto r = std::make_shared<TraceRing>(
+        trace_ring_size.load(std::memory_order_relaxed), tid);
+    trace_rings.push_back(r);
+    return r.get();
+  }
+  TraceRing *ring;
+};
+
+static thread_local TraceRingHolder trace_ring_holder;
+
+void EnableTrace(size_t events_per_thread) {
+  if (events_per_thread == 0)
+    events_per_thread = TRACE_DEFAULT_EVENTS_PER_THREAD;
+  trace_ring_size.store(events_per_thread, std::memory_order_relaxed);
+  trace_enabled.store(true, std::memory_order_release);
+}
+
+void DisableTrace() { trace_enabled.store(false, std::memory_order_release); }
+
+bool IsTraceEnabled() { return trace_enabled.load(std::memory_order_relaxed); }
+
+const char *TraceName(const std::string &name) {
+  std::lock_guard<std::mutex> _lg(trace_mtx);
+  return trace_names.insert(name).first->c_str();
+}
+
+void TraceRecord(TraceType type, const char *name, int slot, int64_t frame,
+                 int64_t ts) {
+  if (!trace_enabled.load(std::memory_order_relaxed))
+    return;
+  TraceRing *ring = trace_ring_holder.Get();
+  ring->Add(type, name, slot, frame, ts ? ts : getmonotonictime());
+}
+
+void ClearTrace() {
+  std::lock_guard<std::mutex> _lg(trace_mtx);
+  for (auto &r : trace_rings)
+    r->Clear();
+}
+
+static void write_json_string(FILE *fp, const char *s) {
+  fputc('"', fp);
+  for (; s && *s; s++) {
+    if (*s == '"' || *s == '\\')
+      fputc('\\', fp);
+    if ((unsigned char)*s >= 0x20)
+      fputc(*s, fp);
+  }
+  fputc('"', fp);
+}
+
+int DumpTrace(const char *path) {
+  std::vector<TraceRing::Event> events;
+  std::map<pid_t, std::string> thread_names;
+  {
+    std::lock_guard<std::mutex> _lg(trace_mtx);
+    for (auto &r : trace_rings)
+      r->Collect(events);
+    thread_names = trace_thread_names;
+  }
+  std::stable_sort(events.begin(), events.end(),
+                   [](const TraceRing::Event &a, const TraceRing::Event &b) {
+                     return a.ts < b.ts;
+                   });
+  // The latency of each event is from the first event of its frame,
+  // which is the capture if it is still in the ring.
+  std::map<int64_t, int64_t> frame_start;
+  for (auto &e : events) {
+    if (!e.frame)
+      continue;
+    if (e.type == TraceType::CAPTURE || !frame_start.count(e.frame))
+      frame_start[e.frame] = e.ts;
+  }
+  FILE *fp = fopen(path, "w");
+  if (!fp) {
+    LOG("Fail to open trace file %s: %m\n", path);
+    return -1;
+  }
+  int pid = getpid();
+  bool first = true;
+  std::set<pid_t> tids;
+  fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+  for (auto &e : events) {
+    const char *name = e.name ? e.name : "unknown";
+    const char *ph = "i";
+    const char *cat = "frame";
+    bool queue = false;
+    switch (e.type) {
+    case TraceType::CAPTURE:
+      cat = "capture";
+      break;
+    case TraceType::ENQUEUE:
+      ph = "b";
+      queue = true;
+      break;
+    case TraceType::DEQUEUE:
+    case TraceType::DROP:
+      ph = "e";
+      queue = true;
+      break;
+    case TraceType::PROCESS_BEGIN:
+      ph = "B";
+      cat = "process";
+      break;
+    case TraceType::PROCESS_END:
+      ph = "E";
+      cat = "process";
+      break;
+    }
+    fprintf(fp, "%s\n{\"name\":", first ? "" : ",");
+    first = false;
+    if (queue) {
+      std::string qname(name);
+      qname.append(":in").append(std::to_string(e.slot));
+      write_json_string(fp, qname.c_str());
+      cat = "queue";
+    } else {
+      write_json_string(fp, name);
+    }
+    fprintf(fp, ",\"cat\":\"%s\",\"ph\":\"%s\",\"ts\":%lld,\"pid\":%d,"
+                "\"tid\":%d",
+            cat, ph, (long long)e.ts, pid, e.tid);
+    if (queue)
+      fprintf(fp, ",\"id\":\"%llx-%p-%d\"", (long long)e.frame, e.name,
+              e.slot);
+    else if (*ph == 'i')
+      fprintf(fp, ",\"s\":\"g\"");
+    fprintf(fp, ",\"args\":{\"frame\":%lld,\"latency_us\":%lld%s}}",
+            (long long)e.frame,
+            (long long)(e.frame ? e.ts - frame_start[e.frame] : 0),
+            e.type == TraceType::DROP ? ",\"dropped\":1" : "");
+    tids.insert(e.tid);
+  }
+  for (pid_t tid : tids) {
+    std::string &tname = thread_names[tid];
+    if (tname.empty())
+      continue;
+    fprintf(fp, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,"
+                "\"tid\":%d,\"args\":{\"name\":",
+            first ? "" : ",", pid, tid);
+    first = false;
+    write_json_string(fp, tname.c_str());
+    fprintf(fp, "}}");
+  }
+  fprintf(fp, "\n]}\n");
+  fclose(fp);
+  return (int)events.size();
+}
+
+static struct TraceEnvInit {
+  TraceEnvInit() {
+    const char *ptr = getenv("RKMEDIA_TRACE");
+    if (ptr)
+      EnableTrace((size_t)atoi(ptr));
+  }
+} trace_env_init;
+
+} // namespace easymedia
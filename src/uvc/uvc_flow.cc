@@ -90,6 +90,7 @@ UvcFlow::UvcFlow(const char *param)
   SlotMap sm;
   sm.thread_model = Model::ASYNCCOMMON;
   sm.mode_when_full = InputMode::DROPFRONT;
+  sm.dedicated_thread = true; // blocking uvc gadget io
   sm.input_slots.push_back(0);
   sm.input_maxcachenum.push_back(2);
   sm.fetch_block.push_back(true);